@@ -0,0 +1,626 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+// Build with the extraction modules and the PNG code:
+// cc -O2 benchmark.c canterbury-mac/core1940/{topcolors,image,extract,colorrun,lineio,linefile,merge,lineindex,spans,stats}.c canterbury-mac/png/*.c -lz -lm -lpthread -o benchmark
+#include "canterbury-mac/core1940/canterbury.h"
+#include "canterbury-mac/png/pnglite.h"
+
+#define MAX_MAPS 16
+#define MAX_UPSCALES 8
+#define MAX_RECORDS 512
+#define BENCHMARK_QUERIES 200000     // Queries timed against the line index of each map
+#define BENCHMARK_QUERY_RESULTS 1024 // Lines kept from each rectangle query
+
+// One measured stage of the pipeline on one map.
+typedef struct {
+    char map[256];
+    size_t width;
+    size_t height;
+    const char *stage;
+    double seconds;  // Best of the repeats.
+    size_t lines;    // Lines handled by the stage, 0 if it works on pixels only.
+    long peakRssKB;  // High-water mark of the process that ran the stage.
+} BenchmarkRecord;
+
+// Everything a benchmark run needs to know.
+typedef struct {
+    const char *maps[MAX_MAPS];
+    int mapCount;
+    int upscales[MAX_UPSCALES];
+    int upscaleCount;
+    int repeats;
+    int threadCount;        // Also time the tiled extraction when above 0.
+    const char *toolDirectory; // Where reduction, fifth and reconstruct are found.
+    const char *workDirectory; // Scratch space for upscaled maps and line files.
+    const char *outputLocation;
+    BenchmarkRecord records[MAX_RECORDS];
+    int recordCount;
+} Benchmark;
+
+// Function to read a monotonic clock in seconds.
+static double currentSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Function to convert ru_maxrss to kilobytes; macOS reports bytes and Linux kilobytes.
+static long maxRssKB(const struct rusage *usage) {
+#ifdef __APPLE__
+    return (long)(usage->ru_maxrss / 1024);
+#else
+    return (long)usage->ru_maxrss;
+#endif
+}
+
+// Function to read the high-water mark of this process.
+static long selfPeakRssKB(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return maxRssKB(&usage);
+}
+
+// Function to add a stage measurement and echo it for whoever is watching.
+static void addRecord(Benchmark *benchmark, const char *map, size_t width, size_t height, const char *stage,
+                      double seconds, size_t lines, long peakRssKB) {
+    if (benchmark->recordCount >= MAX_RECORDS) {
+        return;
+    }
+    BenchmarkRecord *record = &benchmark->records[benchmark->recordCount++];
+    snprintf(record->map, sizeof(record->map), "%s", map);
+    record->width = width;
+    record->height = height;
+    record->stage = stage;
+    record->seconds = seconds;
+    record->lines = lines;
+    record->peakRssKB = peakRssKB;
+    fprintf(stderr, "%-28s %-18s %10.4fs %10zu lines %10ld KB\n", map, stage, seconds, lines, peakRssKB);
+}
+
+// A tool run handed to the launcher process, and what it sends back.
+typedef struct {
+    char tool[512];
+    char input[512];
+    char output[512];
+} ToolRequest;
+
+typedef struct {
+    double seconds; // Negative if the tool could not be run or failed.
+    long peakRssKB;
+} ToolReply;
+
+static int launcherRequests = -1;
+static int launcherReplies = -1;
+
+// Function to run one tool to completion with its output discarded.
+static ToolReply launchTool(const ToolRequest *request) {
+    ToolReply reply = {-1.0, 0};
+    double start = currentSeconds();
+    pid_t pid = fork();
+    if (pid < 0) {
+        return reply;
+    }
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0) {
+            dup2(devNull, STDOUT_FILENO);
+            close(devNull);
+        }
+        execl(request->tool, request->tool, request->input, request->output, (char *)NULL);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        reply.seconds = currentSeconds() - start;
+        reply.peakRssKB = maxRssKB(&usage);
+    }
+    return reply;
+}
+
+// Function to fork the process that starts the tools, while this one is still small.
+// A forked child counts its parent's resident pages in its own high-water mark, so tools
+// forked later from the benchmark itself would report the benchmark's memory as theirs.
+static bool startLauncher(void) {
+    int requests[2], replies[2];
+    if (pipe(requests) != 0 || pipe(replies) != 0) {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        close(requests[1]);
+        close(replies[0]);
+        ToolRequest request;
+        while (read(requests[0], &request, sizeof(request)) == sizeof(request)) {
+            ToolReply reply = launchTool(&request);
+            if (write(replies[1], &reply, sizeof(reply)) != sizeof(reply)) {
+                break;
+            }
+        }
+        _exit(0);
+    }
+    close(requests[0]);
+    close(replies[1]);
+    launcherRequests = requests[1];
+    launcherReplies = replies[0];
+    return true;
+}
+
+// Function to stop the launcher once every tool has run.
+static void stopLauncher(void) {
+    if (launcherRequests >= 0) {
+        close(launcherRequests);
+        close(launcherReplies);
+        wait(NULL);
+    }
+}
+
+// Function to run a tool through the launcher.
+// Returns the wall time, or a negative value if it could not be run or failed.
+static double runTool(const char *tool, const char *input, const char *output, long *peakRssKB) {
+    ToolRequest request;
+    ToolReply reply;
+    snprintf(request.tool, sizeof(request.tool), "%s", tool);
+    snprintf(request.input, sizeof(request.input), "%s", input);
+    snprintf(request.output, sizeof(request.output), "%s", output);
+    if (write(launcherRequests, &request, sizeof(request)) != sizeof(request) ||
+        read(launcherReplies, &reply, sizeof(reply)) != sizeof(reply)) {
+        return -1.0;
+    }
+    *peakRssKB = reply.peakRssKB;
+    return reply.seconds;
+}
+
+// Function to time one of the standalone tools over the repeats, skipping it if it is not built.
+static void benchmarkTool(Benchmark *benchmark, const char *map, size_t width, size_t height, const char *stage,
+                          const char *toolName, const char *input, const char *output, size_t lines) {
+    char tool[512];
+    snprintf(tool, sizeof(tool), "%s/%s", benchmark->toolDirectory, toolName);
+    if (access(tool, X_OK) != 0) {
+        fprintf(stderr, "%-28s %-18s skipped, %s not found\n", map, stage, tool);
+        return;
+    }
+
+    double best = -1.0;
+    long peakRssKB = 0;
+    for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+        long runPeakRssKB = 0;
+        double seconds = runTool(tool, input, output, &runPeakRssKB);
+        if (seconds < 0.0) {
+            fprintf(stderr, "%-28s %-18s failed\n", map, stage);
+            return;
+        }
+        if (best < 0.0 || seconds < best) {
+            best = seconds;
+        }
+        if (runPeakRssKB > peakRssKB) {
+            peakRssKB = runPeakRssKB;
+        }
+    }
+    addRecord(benchmark, map, width, height, stage, best, lines, peakRssKB);
+}
+
+// Function to write a nearest-neighbour enlargement of a map, a synthetic stand-in for bigger maps.
+static bool writeUpscaledMap(const char *filename, const uint8_t *pixels, size_t width, size_t height, int factor) {
+    size_t bigWidth = width * factor;
+    size_t bigHeight = height * factor;
+    uint8_t *big = malloc(bigWidth * bigHeight * 3);
+    if (!big) {
+        return false;
+    }
+    for (size_t row = 0; row < bigHeight; row++) {
+        const uint8_t *source = pixels + (row / factor) * width * 3;
+        uint8_t *target = big + row * bigWidth * 3;
+        for (size_t col = 0; col < bigWidth; col++) {
+            memcpy(target + col * 3, source + (col / factor) * 3, 3);
+        }
+    }
+    bool written = write_png_file((char *)filename, (int)bigWidth, (int)bigHeight, big) == 0;
+    free(big);
+    return written;
+}
+
+// Function to copy decoded pixels into a working image and label it, ready to extract from.
+static bool prepareExtraction(Image *image, Arena *labelArena, LabelImage *labels, const uint8_t *pixels,
+                              const uint32_t topColors[TOPCOLORENTRIES]) {
+    imageFromPacked(image, pixels);
+    arenaFree(labelArena);
+    return arenaInit(labelArena, labelImageArenaSize(image->width, image->height)) &&
+           labelImageBuild(labels, labelArena, image, topColors);
+}
+
+// Function to run every stage of the pipeline on one map file.
+static bool benchmarkMap(Benchmark *benchmark, const char *path, const char *name) {
+    png_t png;
+    uint8_t *pixels = NULL;
+    double best = 0.0;
+
+    // PNG decode.
+    for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+        free(pixels);
+        double start = currentSeconds();
+        pixels = read_png_file((char *)path, &png);
+        double seconds = currentSeconds() - start;
+        if (!pixels) {
+            fprintf(stderr, "Failed to read %s\n", path);
+            return false;
+        }
+        if (repeat == 0 || seconds < best) best = seconds;
+    }
+    size_t width = png.width, height = png.height;
+    addRecord(benchmark, name, width, height, "decode", best, 0, selfPeakRssKB());
+
+    // PNG decode again with the scalar unfilter kernels, which must give exactly the same pixels.
+    uint8_t *scalarPixels = NULL;
+    png_set_unfilter_simd(0);
+    for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+        free(scalarPixels);
+        double start = currentSeconds();
+        scalarPixels = read_png_file((char *)path, &png);
+        double seconds = currentSeconds() - start;
+        if (repeat == 0 || seconds < best) best = seconds;
+    }
+    png_set_unfilter_simd(1);
+    bool unfilterMatches = scalarPixels && memcmp(scalarPixels, pixels, width * height * 3) == 0;
+    free(scalarPixels);
+    if (!unfilterMatches) {
+        fprintf(stderr, "SIMD and scalar unfiltering disagree on %s\n", path);
+        free(pixels);
+        return false;
+    }
+    addRecord(benchmark, name, width, height, "decodeScalar", best, 0, selfPeakRssKB());
+
+    // Color histogram.
+    uint32_t topColors[TOPCOLORENTRIES];
+    uint32_t pixelCounts[TOPCOLORENTRIES];
+    for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+        double start = currentSeconds();
+        findTopColors(pixels, width, height, topColors, pixelCounts);
+        double seconds = currentSeconds() - start;
+        if (repeat == 0 || seconds < best) best = seconds;
+    }
+    addRecord(benchmark, name, width, height, "histogram", best, 0, selfPeakRssKB());
+
+    // PNG encode of the decoded map, at the default level.
+    char encodedLocation[512];
+    snprintf(encodedLocation, sizeof(encodedLocation), "%s/%s-encoded.png", benchmark->workDirectory, name);
+    for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+        double start = currentSeconds();
+        write_png_file(encodedLocation, (int)width, (int)height, pixels);
+        double seconds = currentSeconds() - start;
+        if (repeat == 0 || seconds < best) best = seconds;
+    }
+    addRecord(benchmark, name, width, height, "encode", best, 0, selfPeakRssKB());
+
+    Arena arena, labelArena = {NULL, 0, 0};
+    Image image;
+    LabelImage labels;
+    if (!arenaInit(&arena, imageArenaSize(width, height)) || !imageAllocate(&image, &arena, width, height)) {
+        fprintf(stderr, "Memory allocation failed\n");
+        arenaFree(&arena);
+        free(pixels);
+        return false;
+    }
+
+    // PNG decode straight into the padded rows of the working image, as the extractor loads a map.
+    for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+        double start = currentSeconds();
+        bool decoded = read_png_header((char *)path, &png) == 0 &&
+                       read_png_pixels(&png, (unsigned char *)image.pixels, image.stride * sizeof(RGB), sizeof(RGB)) == 0;
+        double seconds = currentSeconds() - start;
+        if (!decoded) {
+            fprintf(stderr, "Failed to read %s\n", path);
+            arenaFree(&arena);
+            free(pixels);
+            return false;
+        }
+        if (repeat == 0 || seconds < best) best = seconds;
+    }
+    addRecord(benchmark, name, width, height, "decodeImage", best, 0, selfPeakRssKB());
+
+    // Palette labelling.
+    for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+        imageFromPacked(&image, pixels);
+        arenaFree(&labelArena);
+        if (!arenaInit(&labelArena, labelImageArenaSize(width, height))) break;
+        double start = currentSeconds();
+        labelImageBuild(&labels, &labelArena, &image, topColors);
+        double seconds = currentSeconds() - start;
+        if (repeat == 0 || seconds < best) best = seconds;
+    }
+    addRecord(benchmark, name, width, height, "quantize", best, 0, selfPeakRssKB());
+
+    // Line extraction, serial and optionally tiled. Every repeat starts from the decoded map.
+    LineBuffer lines = {NULL, 0, 0};
+    for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+        lineBufferFree(&lines);
+        if (!prepareExtraction(&image, &labelArena, &labels, pixels, topColors)) break;
+        double start = currentSeconds();
+        removeLines(&image, &labels, &lines);
+        double seconds = currentSeconds() - start;
+        if (repeat == 0 || seconds < best) best = seconds;
+    }
+    addRecord(benchmark, name, width, height, "extract", best, lines.count, selfPeakRssKB());
+
+    // Merging the serial lines into simplified polylines, within a pixel.
+    LineBuffer mergedLines = {NULL, 0, 0};
+    for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+        lineBufferFree(&mergedLines);
+        mergedLines.lines = malloc(lines.count * sizeof(LineInfo) + 1);
+        if (!mergedLines.lines) break;
+        memcpy(mergedLines.lines, lines.lines, lines.count * sizeof(LineInfo));
+        mergedLines.count = mergedLines.capacity = lines.count;
+        double start = currentSeconds();
+        mergeLines(&mergedLines, 1.0);
+        double seconds = currentSeconds() - start;
+        if (repeat == 0 || seconds < best) best = seconds;
+    }
+    addRecord(benchmark, name, width, height, "mergeLines", best, mergedLines.count, selfPeakRssKB());
+    lineBufferFree(&mergedLines);
+
+    // Bulk loading the spatial index over the serial lines, then rectangle and nearest line queries at
+    // points spread over the map, counted in queries.
+    LineIndex lineIndex;
+    bool indexed = false;
+    for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+        if (indexed) lineIndexFree(&lineIndex);
+        double start = currentSeconds();
+        indexed = lineIndexBuild(&lineIndex, lines.lines, lines.count);
+        double seconds = currentSeconds() - start;
+        if (!indexed) break;
+        if (repeat == 0 || seconds < best) best = seconds;
+    }
+    if (indexed) {
+        addRecord(benchmark, name, width, height, "indexLines", best, lines.count, selfPeakRssKB());
+
+        size_t found[BENCHMARK_QUERY_RESULTS];
+        for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+            uint32_t seed = 1;
+            double start = currentSeconds();
+            for (int query = 0; query < BENCHMARK_QUERIES; query++) {
+                seed = seed * 1664525u + 1013904223u;
+                int x = (int)((seed >> 8) % width), y = (int)((seed >> 4) % height);
+                lineIndexSearch(&lineIndex, x, y, x + (int)(seed & 15), y + (int)(seed & 15), NULL, found,
+                                BENCHMARK_QUERY_RESULTS);
+            }
+            double seconds = currentSeconds() - start;
+            if (repeat == 0 || seconds < best) best = seconds;
+        }
+        addRecord(benchmark, name, width, height, "queryRectangles", best, BENCHMARK_QUERIES, selfPeakRssKB());
+
+        for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+            uint32_t seed = 1;
+            size_t nearest;
+            double start = currentSeconds();
+            for (int query = 0; query < BENCHMARK_QUERIES; query++) {
+                seed = seed * 1664525u + 1013904223u;
+                lineIndexNearest(&lineIndex, (double)((seed >> 8) % width) + 0.5, (double)((seed >> 4) % height) + 0.5,
+                                 NULL, &nearest, NULL);
+            }
+            double seconds = currentSeconds() - start;
+            if (repeat == 0 || seconds < best) best = seconds;
+        }
+        addRecord(benchmark, name, width, height, "queryNearest", best, BENCHMARK_QUERIES, selfPeakRssKB());
+        lineIndexFree(&lineIndex);
+    }
+
+    // Span encoding of the whole map, counted in strips.
+    SpanBuffer spans = {NULL, 0, 0};
+    for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+        spanBufferFree(&spans);
+        if (!prepareExtraction(&image, &labelArena, &labels, pixels, topColors)) break;
+        double start = currentSeconds();
+        extractSpans(&image, &labels, &spans);
+        double seconds = currentSeconds() - start;
+        if (repeat == 0 || seconds < best) best = seconds;
+    }
+    addRecord(benchmark, name, width, height, "extractSpans", best, spans.count, selfPeakRssKB());
+    spanBufferFree(&spans);
+
+    if (benchmark->threadCount > 0) {
+        LineBuffer tiledLines = {NULL, 0, 0};
+        for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+            lineBufferFree(&tiledLines);
+            if (!prepareExtraction(&image, &labelArena, &labels, pixels, topColors)) break;
+            double start = currentSeconds();
+            removeLinesParallel(&image, &labels, &tiledLines, benchmark->threadCount);
+            double seconds = currentSeconds() - start;
+            if (repeat == 0 || seconds < best) best = seconds;
+        }
+        addRecord(benchmark, name, width, height, "extractTiled", best, tiledLines.count, selfPeakRssKB());
+
+        // Incremental update of the tiled lines after a small hand edit in the middle of the map.
+        Arena previousArena = {NULL, 0, 0};
+        Image previous;
+        uint8_t *edited = malloc(width * height * 3);
+        if (edited && arenaInit(&previousArena, imageArenaSize(width, height)) &&
+            imageAllocate(&previous, &previousArena, width, height)) {
+            imageFromPacked(&previous, pixels);
+            memcpy(edited, pixels, width * height * 3);
+            size_t side = (width < 16 || height < 16) ? 1 : 16;
+            for (size_t row = height / 2; row < height / 2 + side; row++) {
+                for (size_t col = width / 2; col < width / 2 + side; col++) {
+                    memcpy(edited + (row * width + col) * 3, pixels + ((height / 2) * width + col) * 3, 3);
+                }
+            }
+
+            LineBuffer updatedLines = {NULL, 0, 0};
+            for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+                lineBufferFree(&updatedLines);
+                if (!prepareExtraction(&image, &labelArena, &labels, edited, topColors)) break;
+                double start = currentSeconds();
+                removeLinesIncremental(&image, &labels, &previous, tiledLines.lines, tiledLines.count, &updatedLines,
+                                       benchmark->threadCount);
+                double seconds = currentSeconds() - start;
+                if (repeat == 0 || seconds < best) best = seconds;
+            }
+            addRecord(benchmark, name, width, height, "extractIncremental", best, updatedLines.count, selfPeakRssKB());
+            lineBufferFree(&updatedLines);
+        }
+        arenaFree(&previousArena);
+        free(edited);
+        lineBufferFree(&tiledLines);
+    }
+    free(pixels);
+    arenaFree(&labelArena);
+    arenaFree(&arena);
+
+    // Line file output in both formats; the binary file feeds the tools below.
+    char jsonLocation[512], lineFileLocation[512], reducedLocation[512], sampledLocation[512], imageLocation[512];
+    snprintf(jsonLocation, sizeof(jsonLocation), "%s/%s.json", benchmark->workDirectory, name);
+    snprintf(lineFileLocation, sizeof(lineFileLocation), "%s/%s" LINEFILE_EXTENSION, benchmark->workDirectory, name);
+    snprintf(reducedLocation, sizeof(reducedLocation), "%s/%s-reduced" LINEFILE_EXTENSION, benchmark->workDirectory, name);
+    snprintf(sampledLocation, sizeof(sampledLocation), "%s/%s-fifth" LINEFILE_EXTENSION, benchmark->workDirectory, name);
+    snprintf(imageLocation, sizeof(imageLocation), "%s/%s-reconstructed.ppm", benchmark->workDirectory, name);
+
+    const char *emitStages[3] = {"emitJSON", "emitCompactJSON", "emitBinary"};
+    const char *emitLocations[3] = {jsonLocation, jsonLocation, lineFileLocation};
+    for (int format = 0; format < 3; format++) {
+        for (int repeat = 0; repeat < benchmark->repeats; repeat++) {
+            double start = currentSeconds();
+            bool written = writeLines(emitLocations[format], lines.lines, lines.count, topColors, format == 1, false);
+            double seconds = currentSeconds() - start;
+            if (!written) {
+                fprintf(stderr, "Failed to write %s\n", emitLocations[format]);
+                lineBufferFree(&lines);
+                return false;
+            }
+            if (repeat == 0 || seconds < best) best = seconds;
+        }
+        addRecord(benchmark, name, width, height, emitStages[format], best, lines.count, selfPeakRssKB());
+    }
+    size_t lineCount = lines.count;
+    lineBufferFree(&lines);
+
+    // The standalone tools, each run as its own process so its peak memory is its own.
+    benchmarkTool(benchmark, name, width, height, "reduction", "reduction", lineFileLocation, reducedLocation, lineCount);
+    benchmarkTool(benchmark, name, width, height, "sampling", "fifth", lineFileLocation, sampledLocation, lineCount);
+    benchmarkTool(benchmark, name, width, height, "reconstruction", "reconstruct", lineFileLocation, imageLocation, lineCount);
+    return true;
+}
+
+// Function to write the measurements as JSON, with throughput worked out per stage.
+static void writeBenchmarkJSON(FILE *file, const Benchmark *benchmark) {
+    fprintf(file, "{\n  \"repeats\": %d,\n  \"threads\": %d,\n  \"stages\": [\n", benchmark->repeats, benchmark->threadCount);
+    for (int i = 0; i < benchmark->recordCount; i++) {
+        const BenchmarkRecord *record = &benchmark->records[i];
+        double seconds = (record->seconds > 0.0) ? record->seconds : 1e-9;
+        fprintf(file, "    {\"map\": \"%s\", \"width\": %zu, \"height\": %zu, \"stage\": \"%s\", \"seconds\": %.6f, "
+                      "\"mpixelsPerSecond\": %.3f, \"lines\": %zu, \"linesPerSecond\": %.0f, \"peakRssKB\": %ld}%s\n",
+                record->map, record->width, record->height, record->stage, record->seconds,
+                (double)(record->width * record->height) / seconds / 1e6, record->lines,
+                (double)record->lines / seconds, record->peakRssKB, (i + 1 < benchmark->recordCount) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+// Function to drop the directories and extension from a map path.
+static void mapName(char *name, size_t size, const char *path) {
+    const char *slash = strrchr(path, '/');
+    snprintf(name, size, "%s", slash ? slash + 1 : path);
+    char *dot = strrchr(name, '.');
+    if (dot) {
+        *dot = '\0';
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    static Benchmark benchmark;
+    benchmark.repeats = 3;
+    benchmark.toolDirectory = ".";
+    benchmark.workDirectory = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            benchmark.repeats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            benchmark.threadCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc && benchmark.upscaleCount < MAX_UPSCALES) {
+            benchmark.upscales[benchmark.upscaleCount++] = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            benchmark.toolDirectory = argv[++i];
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            benchmark.workDirectory = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            benchmark.outputLocation = argv[++i];
+        } else if (argv[i][0] != '-' && benchmark.mapCount < MAX_MAPS) {
+            benchmark.maps[benchmark.mapCount++] = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [-r repeats] [-t threads] [-u factor]... [-b tool_dir] [-w work_dir] [-o results.json] [map.png]...\n", argv[0]);
+            fprintf(stderr, "Runs every pipeline stage on each map and on its -u enlargements (default the three\n");
+            fprintf(stderr, "Canterbury maps, at x1 and x2). reduction, fifth and reconstruct are run from tool_dir.\n");
+            return 1;
+        }
+    }
+    if (benchmark.repeats < 1) {
+        benchmark.repeats = 1;
+    }
+    if (benchmark.mapCount == 0) {
+        benchmark.maps[benchmark.mapCount++] = "canterbury100.png";
+        benchmark.maps[benchmark.mapCount++] = "canterbury400.png";
+        benchmark.maps[benchmark.mapCount++] = "canterbury1600.png";
+    }
+    if (benchmark.upscaleCount == 0) {
+        benchmark.upscales[benchmark.upscaleCount++] = 1;
+        benchmark.upscales[benchmark.upscaleCount++] = 2;
+    }
+
+    if (!startLauncher()) {
+        fprintf(stderr, "Could not start the tool launcher\n");
+        return 1;
+    }
+
+    int result = 0;
+    for (int m = 0; m < benchmark.mapCount; m++) {
+        char name[256];
+        mapName(name, sizeof(name), benchmark.maps[m]);
+
+        for (int u = 0; u < benchmark.upscaleCount; u++) {
+            int factor = benchmark.upscales[u];
+            if (factor <= 1) {
+                if (!benchmarkMap(&benchmark, benchmark.maps[m], name)) result = 1;
+                continue;
+            }
+
+            // Decode the original once to build the enlarged map, then benchmark it like any other file.
+            png_t png;
+            uint8_t *pixels = read_png_file((char *)benchmark.maps[m], &png);
+            char upscaledName[300], upscaledLocation[600];
+            snprintf(upscaledName, sizeof(upscaledName), "%s-x%d", name, factor);
+            snprintf(upscaledLocation, sizeof(upscaledLocation), "%s/%s.png", benchmark.workDirectory, upscaledName);
+            bool written = pixels && writeUpscaledMap(upscaledLocation, pixels, png.width, png.height, factor);
+            free(pixels);
+            if (!written || !benchmarkMap(&benchmark, upscaledLocation, upscaledName)) {
+                fprintf(stderr, "Failed to benchmark %s\n", upscaledName);
+                result = 1;
+            }
+        }
+    }
+
+    stopLauncher();
+
+    FILE *output = benchmark.outputLocation ? fopen(benchmark.outputLocation, "w") : stdout;
+    if (!output) {
+        fprintf(stderr, "Could not open %s for writing\n", benchmark.outputLocation);
+        return 1;
+    }
+    writeBenchmarkJSON(output, &benchmark);
+    if (output != stdout) {
+        fclose(output);
+    }
+    return result;
+}
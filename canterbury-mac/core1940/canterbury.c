@@ -36,8 +36,6 @@
 
 #if 1
 
-#define TOLERANCE_VALUE (20)
-
 #include "canterbury.h"
 #include <unistd.h>
 #include "pnglite.h"
@@ -48,361 +46,275 @@
 #include <math.h>
 #include <stdbool.h>
 
-// Define a structure to store RGB color frequencies.
-typedef struct {
-    uint32_t color; // 32-bit representation of the RGB color.
-    uint32_t count; // Frequency of the color.
-    float luminance; // Luminance of the color (darker colors have lower luminance).
-} ColorFreq;
-
-// Comparator function for sorting colors by frequency in descending order and luminance in ascending order.
-int compareColorFreq(const void *a, const void *b) {
-    ColorFreq *cf1 = (ColorFreq *)a;
-    ColorFreq *cf2 = (ColorFreq *)b;
-    if (cf1->count == cf2->count) {
-        return (cf1->luminance < cf2->luminance) ? -1 : 1;
-    }
-    return (cf2->count - cf1->count);
-}
-
-// Calculate the luminance of a color.
-float calculateLuminance(uint32_t color) {
-    uint8_t r = (color >> 16) & 0xFF;
-    uint8_t g = (color >> 8) & 0xFF;
-    uint8_t b = color & 0xFF;
-    return 0.2126 * r + 0.7152 * g + 0.0722 * b; // Standard luminance formula.
-}
+#define MAPLOCATION "/Users/barbalet/github/ds-canterbury1940/canterbury400.png"
 
-// Find the top colors in an image and their pixel counts.
-void findTopColors(uint8_t *image, size_t width, size_t height, uint32_t topColors[TOPCOLORENTRIES], uint32_t pixelCounts[TOPCOLORENTRIES]) {
-    #define MAX_COLORS 16777216 // Maximum possible unique RGB colors (24-bit).
-    uint32_t *colorFrequency = calloc(MAX_COLORS, sizeof(uint32_t));
-    if (!colorFrequency) {
-        fprintf(stderr, "Memory allocation failed\n");
-        return;
-    }
+#define NEWLOCATION "/Users/barbalet/github/ds-canterbury1940/"
 
-    // Count the frequency of each color in the image.
-    size_t imageSize = width * height * 3;
-    for (size_t i = 0; i < imageSize; i += 3) {
-        uint32_t color = (image[i] << 16) | (image[i + 1] << 8) | image[i + 2];
-        colorFrequency[color]++;
-    }
+static int fileCount = 0;
 
-    // Transfer non-zero color frequencies to an array for sorting.
-    ColorFreq *colorFreqArray = malloc(MAX_COLORS * sizeof(ColorFreq));
-    if (!colorFreqArray) {
-        fprintf(stderr, "Memory allocation failed\n");
-        free(colorFrequency);
-        return;
-    }
+// Write the image to a PNG file with an incrementing counter.
+void pngWriteWithCounter(Image *canterbury, int level) {
+    char outfileName[200];
+    snprintf(outfileName, sizeof(outfileName), "%soutput%d.png", NEWLOCATION, fileCount++);
 
-    size_t colorCount = 0;
-    for (uint32_t color = 0; color < MAX_COLORS; ++color) {
-        if (colorFrequency[color] > 0) {
-            colorFreqArray[colorCount++] = (ColorFreq){color, colorFrequency[color], calculateLuminance(color)};
+    // Padded rows are packed first; an image without padding is written as it is.
+    unsigned char *packed = (unsigned char *)canterbury->pixels;
+    if (canterbury->stride != canterbury->width) {
+        packed = malloc(canterbury->width * canterbury->height * sizeof(RGB));
+        if (!packed) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return;
         }
+        imageToPacked(canterbury, packed);
     }
-
-    free(colorFrequency); // Free the hash table.
-
-    // Sort colors by frequency and luminance.
-    qsort(colorFreqArray, colorCount, sizeof(ColorFreq), compareColorFreq);
-
-    // Extract the top TOPCOLORENTRIES colors.
-    for (size_t i = 0; i < TOPCOLORENTRIES && i < colorCount; ++i) {
-        topColors[i] = colorFreqArray[i].color;
-        pixelCounts[i] = colorFreqArray[i].count;
+    write_png_file_level(outfileName, (int)canterbury->width, (int)canterbury->height, packed, level);
+    if (packed != (unsigned char *)canterbury->pixels) {
+        free(packed);
     }
-
-    // Fill remaining entries with 0 if there are fewer than TOPCOLORENTRIES colors.
-    for (size_t i = colorCount; i < TOPCOLORENTRIES; ++i) {
-        topColors[i] = 0;
-        pixelCounts[i] = 0;
-    }
-
-    free(colorFreqArray); // Free the sorted array.
 }
 
-#ifdef NEW1600
-#define MAPLOCATION "/Users/barbalet/github/ds-canterbury1940/canterbury1600.png"
-#else
-#define MAPLOCATION "/Users/barbalet/github/ds-canterbury1940/canterbury400.png"
-#endif
-
-#define NEWLOCATION "/Users/barbalet/github/ds-canterbury1940/"
-
-extern unsigned char *read_png_file(char *filename, png_t *ptr);
-extern int write_png_file(char *filename, int width, int height, unsigned char *buffer);
-
-// Map raw image data to an RGB array.
-void mapToOutput(RGB output[WIDTH][HEIGHT], unsigned char *map) {
-    int index = 0;
-    for (int x = 0; x < WIDTH; x++) {
-        for (int y = 0; y < HEIGHT; y++) {
-            output[x][y].r = map[index++];
-            output[x][y].g = map[index++];
-            output[x][y].b = map[index++];
-        }
+// Function to decode the previous map into an image the size of the current one.
+static bool loadPreviousMap(const char *location, Image *previous, Arena *arena, const Image *current) {
+    png_t png;
+    if (read_png_header((char *)location, &png) != 0) {
+        return false;
     }
+    if (png.width != current->width || png.height != current->height) {
+        png_close_file(&png);
+        return false;
+    }
+    if (!arenaInit(arena, imageArenaSize(png.width, png.height)) || !imageAllocate(previous, arena, png.width, png.height)) {
+        png_close_file(&png);
+        return false;
+    }
+    return read_png_pixels(&png, (unsigned char *)previous->pixels, previous->stride * sizeof(RGB), sizeof(RGB)) == 0;
 }
 
-static int fileCount = 0;
-
-// Write the image to a PNG file with an incrementing counter.
-void pngWriteWithCounter(unsigned char *canterbury) {
-    char outfileName[200];
-    snprintf(outfileName, sizeof(outfileName), "%soutput%d.png", NEWLOCATION, fileCount++);
-    write_png_file(outfileName, WIDTH, HEIGHT, canterbury);
+static int compareColors(const void *a, const void *b) {
+    uint32_t c1 = *(const uint32_t *)a;
+    uint32_t c2 = *(const uint32_t *)b;
+    return (c1 > c2) - (c1 < c2);
 }
 
-// Structure to store line information.
-typedef struct {
-    int startX, startY;
-    int endX, endY;
-    RGB color;
-} LineInfo;
-
-// Check if two RGB colors are similar within a tolerance.
-bool isColorSimilar(RGB color1, RGB color2, int tolerance) {
-    return abs((int)color1.r - (int)color2.r) <= tolerance &&
-           abs((int)color1.g - (int)color2.g) <= tolerance &&
-           abs((int)color1.b - (int)color2.b) <= tolerance;
+// Function to check that two maps label their pixels alike. Labels are exact matches, so the
+// top colors must be the same set, in whatever order their counts put them.
+static bool isSamePalette(const uint32_t first[TOPCOLORENTRIES], const uint32_t second[TOPCOLORENTRIES]) {
+    uint32_t sortedFirst[TOPCOLORENTRIES], sortedSecond[TOPCOLORENTRIES];
+    memcpy(sortedFirst, first, sizeof(sortedFirst));
+    memcpy(sortedSecond, second, sizeof(sortedSecond));
+    qsort(sortedFirst, TOPCOLORENTRIES, sizeof(uint32_t), compareColors);
+    qsort(sortedSecond, TOPCOLORENTRIES, sizeof(uint32_t), compareColors);
+    return memcmp(sortedFirst, sortedSecond, sizeof(sortedFirst)) == 0;
 }
 
-// Function to draw a line with a real-number gradient.
-void drawLine(RGB image[WIDTH][HEIGHT], int startX, int startY, int endX, int endY, RGB color) {
-    int dx = abs(endX - startX);
-    int dy = abs(endY - startY);
-    int sx = (startX < endX) ? 1 : -1;
-    int sy = (startY < endY) ? 1 : -1;
-    int err = dx - dy;
-
-    while (1) {
-        image[startX][startY] = color;
-
-        if (startX == endX && startY == endY) break;
-
-        int e2 = 2 * err;
-        if (e2 > -dy) {
-            err -= dy;
-            startX += sx;
-        }
-        if (e2 < dx) {
-            err += dx;
-            startY += sy;
-        }
+// Function to update the lines of the previous map for the edits made to it since, extracting only the
+// tiles that changed. Falls back to a full tiled extraction when the maps are too different to reuse.
+static void updateLines(Image *canterbury, LabelImage *labels, const uint32_t topColors[TOPCOLORENTRIES],
+                        const CanterburyOptions *options, LineBuffer *lines) {
+    Arena arena = {NULL, 0, 0};
+    Image previous;
+    size_t previousCount = 0;
+    LineInfo *previousLines = readLines(options->previousLinesLocation, &previousCount);
+
+    bool reusable = previousLines && loadPreviousMap(options->previousMapLocation, &previous, &arena, canterbury);
+    if (reusable) {
+        // Every tile depends on the palette, so a change in the top colors changes them all.
+        uint32_t previousColors[TOPCOLORENTRIES];
+        uint32_t pixelCounts[TOPCOLORENTRIES];
+        findImageTopColors(&previous, previousColors, pixelCounts);
+        reusable = isSamePalette(previousColors, topColors);
     }
-}
-
-// Function to detect and remove lines of the same color in all four quadrants.
-void removeLines(RGB image[WIDTH][HEIGHT], FILE *jsonFile, uint32_t topColors[TOPCOLORENTRIES]) {
-    fprintf(jsonFile, "[\n"); // Start of JSON array.
-
-    int firstLine = 1; // Flag to handle commas between JSON objects.
 
-    // Array to keep track of processed colors.
-    bool *processedColors = calloc(TOPCOLORENTRIES, sizeof(bool));
-    if (!processedColors) {
-        fprintf(stderr, "Memory allocation failed\n");
-        return;
+    if (reusable) {
+        int tiles = removeLinesIncremental(canterbury, labels, &previous, previousLines, previousCount, lines, options->threadCount);
+        printf("Re-extracted %d of %zu tiles\n", tiles,
+               ((canterbury->width + EXTRACT_TILE_SIZE - 1) / EXTRACT_TILE_SIZE) * ((canterbury->height + EXTRACT_TILE_SIZE - 1) / EXTRACT_TILE_SIZE));
+    } else {
+        printf("Previous map or lines can not be reused, extracting every tile\n");
+        removeLinesParallel(canterbury, labels, lines, options->threadCount);
     }
 
-    // Loop until all colors are processed.
-    while (1) {
-        bool allColorsProcessed = true;
-        bool lineFound = false;
-
-        // Iterate through all four quadrants of the image.
-        for (int quadrant = 0; quadrant < 4; quadrant++) {
-            int startX = 0, startY = 0, endX = WIDTH, endY = HEIGHT;
-
-            // Define the bounds for each quadrant.
-            switch (quadrant) {
-                case 0: // Top-left quadrant
-                    startX = 0;
-                    startY = 0;
-                    endX = WIDTH / 2;
-                    endY = HEIGHT / 2;
-                    break;
-                case 1: // Top-right quadrant
-                    startX = WIDTH / 2;
-                    startY = 0;
-                    endX = WIDTH;
-                    endY = HEIGHT / 2;
-                    break;
-                case 2: // Bottom-left quadrant
-                    startX = 0;
-                    startY = HEIGHT / 2;
-                    endX = WIDTH / 2;
-                    endY = HEIGHT;
-                    break;
-                case 3: // Bottom-right quadrant
-                    startX = WIDTH / 2;
-                    startY = HEIGHT / 2;
-                    endX = WIDTH;
-                    endY = HEIGHT;
-                    break;
-            }
+    arenaFree(&arena);
+    free(previousLines);
+}
 
-            // Iterate through the current quadrant.
-            for (int x = startX; x < endX; x++) {
-                for (int y = startY; y < endY; y++) {
-                    if (image[x][y].r != 255 || image[x][y].g != 255 || image[x][y].b != 255) { // Skip white pixels.
-                        RGB color = image[x][y];
-                        uint32_t colorKey = (color.r << 16) | (color.g << 8) | color.b;
-
-                        // Check if the color has been processed.
-                        bool colorProcessed = false;
-                        for (int i = 0; i < TOPCOLORENTRIES; i++) {
-                            if (processedColors[i] && topColors[i] == colorKey) {
-                                colorProcessed = true;
-                                break;
-                            }
-                        }
-
-                        if (!colorProcessed) {
-                            allColorsProcessed = false;
-
-                            // Check lines in all directions using real-number gradients.
-                            for (int dx = -1; dx <= 1; dx++) {
-                                for (int dy = -1; dy <= 1; dy++) {
-                                    if (dx == 0 && dy == 0) continue; // Skip the current pixel.
-
-                                    int endXLine = x, endYLine = y;
-
-                                    // Move in the direction until the color changes or the image boundary is reached.
-                                    while (1) {
-                                        int nextX = endXLine + dx;
-                                        int nextY = endYLine + dy;
-
-                                        if (nextX < 0 || nextX >= WIDTH || nextY < 0 || nextY >= HEIGHT) {
-                                            break; // Out of bounds.
-                                        }
-
-                                        if (!isColorSimilar(image[nextX][nextY], color, TOLERANCE_VALUE)) { // Tolerance for color similarity.
-                                            break; // Color change.
-                                        }
-
-                                        endXLine = nextX;
-                                        endYLine = nextY;
-                                    }
-
-                                    // If a line is detected, write it to the JSON file.
-                                    if (endXLine != x || endYLine != y) {
-                                        if (!firstLine) {
-                                            fprintf(jsonFile, ",\n"); // Add comma between JSON objects.
-                                        }
-                                        firstLine = 0;
-
-                                        fprintf(jsonFile, "  {\n");
-                                        fprintf(jsonFile, "    \"startX\": %d,\n", x);
-                                        fprintf(jsonFile, "    \"startY\": %d,\n", y);
-                                        fprintf(jsonFile, "    \"endX\": %d,\n", endXLine);
-                                        fprintf(jsonFile, "    \"endY\": %d,\n", endYLine);
-                                        fprintf(jsonFile, "    \"color\": {\"r\": %d, \"g\": %d, \"b\": %d}\n", color.r, color.g, color.b);
-                                        fprintf(jsonFile, "  }");
-
-                                        // Remove the line from the image.
-                                        drawLine(image, x, y, endXLine, endYLine, (RGB){255, 255, 255});
-                                        lineFound = true;
-                                    }
-                                }
-                            }
-
-                            // Mark the color as processed.
-                            for (int i = 0; i < TOPCOLORENTRIES; i++) {
-                                if (topColors[i] == colorKey) {
-                                    processedColors[i] = true;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+// Function to remove lines from the image and write them to the line file.
+static void extractLinesToFile(Image *canterbury, LabelImage *labels, const uint32_t topColors[TOPCOLORENTRIES],
+                               const CanterburyOptions *options) {
+    LineBuffer lines = {NULL, 0, 0};
+    if (options->previousMapLocation && options->previousLinesLocation) {
+        updateLines(canterbury, labels, topColors, options, &lines);
+    } else if (options->parallel) {
+        removeLinesParallel(canterbury, labels, &lines, options->threadCount);
+    } else {
+        removeLines(canterbury, labels, &lines);
+    }
 
-        // If no lines were found in this iteration, break the loop.
-        if (!lineFound) {
-            break;
+    if (options->merge) {
+        size_t extracted = lines.count;
+        if (mergeLines(&lines, options->mergeError)) {
+            printf("Merged %zu lines into %zu\n", extracted, lines.count);
         }
+    }
 
-        // If all colors have been processed, break the loop.
-        if (allColorsProcessed) {
-            break;
-        }
+    char linesFileName[200];
+    if (options->linesLocation) {
+        snprintf(linesFileName, sizeof(linesFileName), "%s", options->linesLocation);
+    } else {
+        snprintf(linesFileName, sizeof(linesFileName), "%slines.json", NEWLOCATION);
     }
+    writeLines(linesFileName, lines.lines, lines.count, topColors, options->compactJSON, options->versionedJSON);
+    if (options->pyramidLocation) {
+        writeLinePyramid(options->pyramidLocation, lines.lines, lines.count, canterbury->width, canterbury->height, topColors);
+    }
+    lineBufferFree(&lines);
+}
 
-    fprintf(jsonFile, "\n]\n"); // End of JSON array.
-    free(processedColors); // Free the processed colors array.
+// Function to encode the whole image as strips of one color and write them to a span file.
+static void extractSpansToFile(Image *canterbury, LabelImage *labels, const uint32_t topColors[TOPCOLORENTRIES],
+                               const char *spansFileName) {
+    SpanBuffer spans = {NULL, 0, 0};
+    if (extractSpans(canterbury, labels, &spans)) {
+        printf("Encoded %zu strips\n", spans.count);
+        writeSpans(spansFileName, spans.spans, spans.count, topColors, canterbury->width, canterbury->height);
+    }
+    spanBufferFree(&spans);
 }
 
 // Main function to gather calculations and process the image.
-void gatherCalculations(void) {
+void gatherCalculations(const CanterburyOptions *options) {
     png_t snip;
-    unsigned char *canterburyByte = read_png_file(MAPLOCATION, &snip);
-    if (!canterburyByte) {
+    if (read_png_header((char *)options->mapLocation, &snip) != 0) {
         fprintf(stderr, "Failed to read PNG file.\n");
         return;
     }
 
-    RGB canterbury[WIDTH][HEIGHT] = {0};
-    mapToOutput(canterbury, canterburyByte);
+    // Size the working image from the PNG itself so any map fits without recompiling.
+    Arena arena;
+    Image canterbury;
+    if (!arenaInit(&arena, imageArenaSize(snip.width, snip.height) + labelImageArenaSize(snip.width, snip.height)) ||
+        !imageAllocate(&canterbury, &arena, snip.width, snip.height)) {
+        fprintf(stderr, "Memory allocation failed\n");
+        arenaFree(&arena);
+        png_close_file(&snip);
+        return;
+    }
+
+    // Decode straight into the padded rows of the working image.
+    if (read_png_pixels(&snip, (unsigned char *)canterbury.pixels, canterbury.stride * sizeof(RGB), sizeof(RGB)) != 0) {
+        fprintf(stderr, "Failed to read PNG file.\n");
+        arenaFree(&arena);
+        return;
+    }
 
     uint32_t topColors[TOPCOLORENTRIES];
     uint32_t pixelCounts[TOPCOLORENTRIES];
-    findTopColors(canterburyByte, WIDTH, HEIGHT, topColors, pixelCounts);
+    findImageTopColors(&canterbury, topColors, pixelCounts);
     printf("findTopColors\n");
-    free(canterburyByte);
-
-    // Open a JSON file to write line information.
-    char jsonFileName[200];
-    snprintf(jsonFileName, sizeof(jsonFileName), "%slines.json", NEWLOCATION);
-    FILE *jsonFile = fopen(jsonFileName, "w");
-    if (!jsonFile) {
-        fprintf(stderr, "Failed to open JSON file for writing.\n");
+
+    // Label each pixel with its top color once, so extraction never searches the palette.
+    LabelImage labels;
+    if (!labelImageBuild(&labels, &arena, &canterbury, topColors)) {
+        fprintf(stderr, "Memory allocation failed\n");
+        arenaFree(&arena);
         return;
     }
 
-    // Remove lines and write them to the JSON file.
-    removeLines(canterbury, jsonFile, topColors);
-
-    fclose(jsonFile); // Close the JSON file.
+    if (options->linesLocation && isSpanFileName(options->linesLocation)) {
+        extractSpansToFile(&canterbury, &labels, topColors, options->linesLocation);
+    } else {
+        extractLinesToFile(&canterbury, &labels, topColors, options);
+    }
 
     // Write the modified image to a PNG file.
-    pngWriteWithCounter((unsigned char *)canterbury);
+    pngWriteWithCounter(&canterbury, options->pngLevel);
+
+#ifdef CANTERBURY_STATS
+    char statsFileName[200];
+    if (options->statsLocation) {
+        snprintf(statsFileName, sizeof(statsFileName), "%s", options->statsLocation);
+    } else {
+        snprintf(statsFileName, sizeof(statsFileName), "%sstats.json", NEWLOCATION);
+    }
+    statsWrite(statsFileName, topColors);
+#else
+    if (options->statsLocation) {
+        fprintf(stderr, "Extraction counters are only kept when built with -DCANTERBURY_STATS.\n");
+    }
+#endif
+
+    arenaFree(&arena);
 }
 
 int main(int argc, const char *argv[]) {
-    gatherCalculations();
+    CanterburyOptions options = {MAPLOCATION, NULL, false, 0, -1, NULL, NULL, NULL, false, false, false, -1.0, NULL};
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            // Tiled extraction on the given number of threads, 0 for one per core.
+            options.parallel = true;
+            options.threadCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            // Line file to write; a LINEFILE_EXTENSION name selects the binary format and a
+            // SPANFILE_EXTENSION name the span encoding.
+            options.linesLocation = argv[++i];
+        } else if (strcmp(argv[i], "-z") == 0 && i + 1 < argc) {
+            // Compression level of the output PNG; 1 is much faster for looking at intermediate images.
+            options.pngLevel = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-u") == 0 && i + 2 < argc) {
+            // Update the lines of a tiled extraction of a previous map, extracting only the tiles that changed.
+            options.previousMapLocation = argv[++i];
+            options.previousLinesLocation = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            // Where the extraction counters go, in builds with CANTERBURY_STATS.
+            options.statsLocation = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            // Merge the lines into simplified polylines within this pixel error, or with a negative error
+            // only join lines that continue each other on a row, column or diagonal. Merged lines are no
+            // longer tile by tile, so they can not be the previous lines of an incremental update.
+            options.merge = true;
+            options.mergeError = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            // Also write a level of detail pyramid of the lines, tiled so a viewer reads only what it shows.
+            options.pyramidLocation = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0) {
+            // Compact JSON lines, one object per row; smaller and quicker to write than the indented layout.
+            options.compactJSON = true;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            // Versioned JSON lines, with X the column as in the binary file, instead of the bare array
+            // other readers of the JSON expect.
+            options.versionedJSON = true;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [-t threads] [-o lines.json|lines" LINEFILE_EXTENSION "|strips" SPANFILE_EXTENSION "] [-z png_level] "
+                            "[-u previous.png previous_lines] [-s stats.json] [-c] [-v] [-m pixel_error] [-p pyramid" PYRAMIDFILE_EXTENSION "] [map.png]\n", argv[0]);
+            return 1;
+        } else {
+            options.mapLocation = argv[i];
+        }
+    }
+
+    gatherCalculations(&options);
     return 0;
 }
 
 #else
 
 #include "canterbury.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-//#define WIDTH 400  // Replace with the actual width of the image.
-//#define HEIGHT 400 // Replace with the actual height of the image.
+#define RENDER_TILE_SIZE 128 // Side of the screen tiles the reconstruction is drawn in
 
 // Structure to represent an RGB color.
 //typedef struct {
 //    unsigned char r, g, b;
 //} RGB;
 
-// Structure to represent a line.
-typedef struct {
-    int startX, startY;
-    int endX, endY;
-    RGB color;
-} LineInfo;
-
-// Function to draw a line on the image array.
-void drawLine(RGB image[WIDTH][HEIGHT], LineInfo line) {
+// Function to draw a line on the image.
+void drawLine(Image *image, LineInfo line) {
     int dx = abs(line.endX - line.startX);
     int dy = abs(line.endY - line.startY);
     int sx = (line.startX < line.endX) ? 1 : -1;
@@ -414,7 +326,7 @@ void drawLine(RGB image[WIDTH][HEIGHT], LineInfo line) {
 
     while (1) {
         // Set the pixel color.
-        image[x][y] = line.color;
+        IMAGE_AT(image, y, x) = line.color;
 
         if (x == line.endX && y == line.endY) {
             break; // Line drawing complete.
@@ -432,56 +344,281 @@ void drawLine(RGB image[WIDTH][HEIGHT], LineInfo line) {
     }
 }
 
-// Function to parse the JSON file and extract line information.
-void parseJSONFile(const char *filename, RGB image[WIDTH][HEIGHT]) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Failed to open JSON file.\n");
+#define RENDER_SEVERAL_TILES UINT32_MAX // Marks a line drawn clipped: it covers more than one tile or leaves the image
+
+// Lines binned by the screen tiles their bounding boxes touch. Each bin keeps the lines in file order,
+// so every pixel ends up with the color of the last line drawn over it, as when drawn one by one.
+typedef struct {
+    Image *image;
+    const LineInfo *lines;
+    size_t lineCount;
+    int tilesAcross;
+    int tilesDown;
+    int workerCount;
+    uint32_t *lineTile; // Tile of each line, RENDER_SEVERAL_TILES, or RENDER_SEVERAL_TILES - 1 if it is wholly off the image.
+    size_t *cursors;    // Per worker and tile: lines counted, then where the next one goes in binLines.
+    size_t *binStart;   // Where each tile's lines start in binLines, with one more entry for the end.
+    uint32_t *binLines;
+    pthread_mutex_t lock;
+    int nextTile;
+} RenderJob;
+
+typedef struct {
+    RenderJob *job;
+    int worker;
+} RenderWorker;
+
+// Find the range of tiles covered by the bounding box of a line, clipped to the image.
+// Returns false if the line lies outside the image.
+static bool lineTiles(const RenderJob *job, LineInfo line, int *firstCol, int *lastCol, int *firstRow, int *lastRow) {
+    int minX = line.startX < line.endX ? line.startX : line.endX;
+    int maxX = line.startX < line.endX ? line.endX : line.startX;
+    int minY = line.startY < line.endY ? line.startY : line.endY;
+    int maxY = line.startY < line.endY ? line.endY : line.startY;
+    if (maxX < 0 || maxY < 0 || minX >= (int)job->image->width || minY >= (int)job->image->height) {
+        return false;
+    }
+
+    *firstCol = (minX < 0 ? 0 : minX) / RENDER_TILE_SIZE;
+    *firstRow = (minY < 0 ? 0 : minY) / RENDER_TILE_SIZE;
+    *lastCol = (maxX >= (int)job->image->width ? (int)job->image->width - 1 : maxX) / RENDER_TILE_SIZE;
+    *lastRow = (maxY >= (int)job->image->height ? (int)job->image->height - 1 : maxY) / RENDER_TILE_SIZE;
+    return true;
+}
+
+// Whether both ends of a line, and so all of it, lie on the image.
+static bool lineOnImage(const Image *image, LineInfo line) {
+    return line.startX >= 0 && line.endX >= 0 && line.startY >= 0 && line.endY >= 0 &&
+           line.startX < (int)image->width && line.endX < (int)image->width &&
+           line.startY < (int)image->height && line.endY < (int)image->height;
+}
+
+// Function to draw the part of a line that falls inside a tile, setting the same pixels as drawLine.
+// Every step of drawLine moves one pixel along the longer axis, and after k steps the shorter axis has
+// moved (2 k shorter + longer - 1) / (2 longer) pixels, so the walk can start where the line reaches the
+// tile along both axes. As the steps only ever move one way in X and in Y, it stops once the line
+// has left the tile, so no more than a tile's width of steps is walked.
+static void drawLineInTile(Image *image, LineInfo line, int tileStartX, int tileStartY, int tileEndX, int tileEndY) {
+    int dx = abs(line.endX - line.startX);
+    int dy = abs(line.endY - line.startY);
+    int sx = (line.startX < line.endX) ? 1 : -1;
+    int sy = (line.startY < line.endY) ? 1 : -1;
+    int err = dx - dy;
+
+    int x = line.startX;
+    int y = line.startY;
+
+    // Steps before the line reaches the tile along each axis; the shorter axis takes the first step
+    // after which it has moved far enough.
+    bool alongX = dx >= dy;
+    long long longer = alongX ? dx : dy;
+    long long shorter = alongX ? dy : dx;
+    long long toX = (sx > 0) ? tileStartX - x : x - (tileEndX - 1);
+    long long toY = (sy > 0) ? tileStartY - y : y - (tileEndY - 1);
+    long long skip = alongX ? toX : toY;
+    long long across = alongX ? toY : toX;
+    if (across > 0) {
+        if (shorter == 0) {
+            return;
+        }
+        long long acrossSkip = (2 * longer * across - longer + 1 + 2 * shorter - 1) / (2 * shorter);
+        if (acrossSkip > skip) {
+            skip = acrossSkip;
+        }
+    }
+    if (skip > longer) {
         return;
     }
+    if (skip > 0) {
+        across = (2 * skip * shorter + longer - 1) / (2 * longer);
+        long long stepsX = alongX ? skip : across;
+        long long stepsY = alongX ? across : skip;
+        x += sx * (int)stepsX;
+        y += sy * (int)stepsY;
+        err = (int)(dx - dy - stepsX * dy + stepsY * dx);
+    }
 
-    char line[256];
-    LineInfo currentLine;
-    int readingLine = 0;
-
-    while (fgets(line, sizeof(line), file)) {
-        // Remove newline characters.
-        line[strcspn(line, "\n")] = 0;
-
-        if (strstr(line, "\"startX\":")) {
-            sscanf(line, "    \"startX\": %d,", &currentLine.startX);
-        } else if (strstr(line, "\"startY\":")) {
-            sscanf(line, "    \"startY\": %d,", &currentLine.startY);
-        } else if (strstr(line, "\"endX\":")) {
-            sscanf(line, "    \"endX\": %d,", &currentLine.endX);
-        } else if (strstr(line, "\"endY\":")) {
-            sscanf(line, "    \"endY\": %d,", &currentLine.endY);
-        } else if (strstr(line, "\"r\":")) {
-            sscanf(line, "    \"color\": {\"r\": %hhu, \"g\": %hhu, \"b\": %hhu}", &currentLine.color.r, &currentLine.color.g, &currentLine.color.b);
-            readingLine = 1; // All line data has been read.
+    while (1) {
+        if (x >= tileStartX && x < tileEndX && y >= tileStartY && y < tileEndY) {
+            IMAGE_AT(image, y, x) = line.color;
+        } else if ((sx > 0 ? x >= tileEndX : x < tileStartX) || (sy > 0 ? y >= tileEndY : y < tileStartY)) {
+            break; // Past the tile, so the rest of the line is too.
         }
 
-        // If we have read a complete line, draw it on the image.
-        if (readingLine) {
-            // Swap x and y coordinates if necessary.
-            int temp = currentLine.startX;
-            currentLine.startX = currentLine.startY;
-            currentLine.startY = temp;
+        if (x == line.endX && y == line.endY) {
+            break;
+        }
 
-            temp = currentLine.endX;
-            currentLine.endX = currentLine.endY;
-            currentLine.endY = temp;
+        int e2 = 2 * err;
+        if (e2 > -dy) {
+            err -= dy;
+            x += sx;
+        }
+        if (e2 < dx) {
+            err += dx;
+            y += sy;
+        }
+    }
+}
+
+// Count the lines of one worker's share of the file into each tile, noting the tile of every line.
+static void *countWorker(void *argument) {
+    RenderWorker *worker = argument;
+    RenderJob *job = worker->job;
+    size_t *counts = job->cursors + (size_t)worker->worker * job->tilesAcross * job->tilesDown;
+    size_t first = job->lineCount * worker->worker / job->workerCount;
+    size_t last = job->lineCount * (worker->worker + 1) / job->workerCount;
+
+    for (size_t i = first; i < last; i++) {
+        int firstCol, lastCol, firstRow, lastRow;
+        if (!lineTiles(job, job->lines[i], &firstCol, &lastCol, &firstRow, &lastRow)) {
+            job->lineTile[i] = RENDER_SEVERAL_TILES - 1;
+        } else if (firstCol == lastCol && firstRow == lastRow && lineOnImage(job->image, job->lines[i])) {
+            job->lineTile[i] = (uint32_t)(firstRow * job->tilesAcross + firstCol);
+            counts[job->lineTile[i]]++;
+        } else {
+            job->lineTile[i] = RENDER_SEVERAL_TILES;
+            for (int row = firstRow; row <= lastRow; row++) {
+                for (int col = firstCol; col <= lastCol; col++) {
+                    counts[row * job->tilesAcross + col]++;
+                }
+            }
+        }
+    }
+    return NULL;
+}
 
-            drawLine(image, currentLine);
-            readingLine = 0; // Reset for the next line.
+// Place one worker's share of the lines in the bins, from the cursors worked out for it.
+static void *placeWorker(void *argument) {
+    RenderWorker *worker = argument;
+    RenderJob *job = worker->job;
+    size_t *cursors = job->cursors + (size_t)worker->worker * job->tilesAcross * job->tilesDown;
+    size_t first = job->lineCount * worker->worker / job->workerCount;
+    size_t last = job->lineCount * (worker->worker + 1) / job->workerCount;
+
+    for (size_t i = first; i < last; i++) {
+        uint32_t tile = job->lineTile[i];
+        if (tile < RENDER_SEVERAL_TILES - 1) {
+            job->binLines[cursors[tile]++] = (uint32_t)i;
+        } else if (tile == RENDER_SEVERAL_TILES) {
+            int firstCol, lastCol, firstRow, lastRow;
+            lineTiles(job, job->lines[i], &firstCol, &lastCol, &firstRow, &lastRow);
+            for (int row = firstRow; row <= lastRow; row++) {
+                for (int col = firstCol; col <= lastCol; col++) {
+                    job->binLines[cursors[row * job->tilesAcross + col]++] = (uint32_t)i;
+                }
+            }
         }
     }
+    return NULL;
+}
 
-    fclose(file);
+// Fill and draw tiles, taken in turn, until none are left.
+static void *drawWorker(void *argument) {
+    RenderJob *job = ((RenderWorker *)argument)->job;
+    int tileCount = job->tilesAcross * job->tilesDown;
+
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        int tile = job->nextTile++;
+        pthread_mutex_unlock(&job->lock);
+        if (tile >= tileCount) {
+            break;
+        }
+
+        int startX = (tile % job->tilesAcross) * RENDER_TILE_SIZE;
+        int startY = (tile / job->tilesAcross) * RENDER_TILE_SIZE;
+        int endX = startX + RENDER_TILE_SIZE < (int)job->image->width ? startX + RENDER_TILE_SIZE : (int)job->image->width;
+        int endY = startY + RENDER_TILE_SIZE < (int)job->image->height ? startY + RENDER_TILE_SIZE : (int)job->image->height;
+
+        // The white background is filled tile by tile too, by the thread that then draws on it.
+        for (int y = startY; y < endY; y++) {
+            RGB *row = IMAGE_ROW(job->image, y);
+            for (int x = startX; x < endX; x++) {
+                row[x] = (RGB){{255, 255, 255}};
+            }
+        }
+        // Lines within the tile need no clipping.
+        for (size_t i = job->binStart[tile]; i < job->binStart[tile + 1]; i++) {
+            uint32_t index = job->binLines[i];
+            if (job->lineTile[index] == RENDER_SEVERAL_TILES) {
+                drawLineInTile(job->image, job->lines[index], startX, startY, endX, endY);
+            } else {
+                drawLine(job->image, job->lines[index]);
+            }
+        }
+    }
+    return NULL;
 }
 
-// Function to save the image array as a PNG file.
-void saveImageAsPNG(const char *filename, RGB image[WIDTH][HEIGHT]) {
+// Function to fill the image with white and draw the lines on it, in screen tiles spread over threads,
+// 0 for one per core. The lines are binned with a counting sort: each worker counts and then places
+// a contiguous share of the file, so each bin stays in file order. Returns false if the bins can not
+// be allocated, leaving the image untouched.
+bool renderLines(Image *image, const LineInfo *lines, size_t lineCount, int threadCount) {
+    RenderJob job = {.image = image, .lines = lines, .lineCount = lineCount,
+                     .tilesAcross = (int)((image->width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE),
+                     .tilesDown = (int)((image->height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE)};
+    int tileCount = job.tilesAcross * job.tilesDown;
+    if (lineCount >= RENDER_SEVERAL_TILES - 1) {
+        return false;
+    }
+
+    if (threadCount <= 0) {
+        threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threadCount < 1) {
+        threadCount = 1;
+    }
+    job.workerCount = threadCount;
+
+    job.lineTile = malloc(lineCount * sizeof(uint32_t) + 1);
+    job.cursors = calloc((size_t)threadCount * tileCount, sizeof(size_t));
+    job.binStart = malloc(((size_t)tileCount + 1) * sizeof(size_t));
+    RenderWorker *workers = malloc((size_t)threadCount * sizeof(RenderWorker));
+    bool result = job.lineTile && job.cursors && job.binStart && workers;
+
+    if (result) {
+        for (int w = 0; w < threadCount; w++) {
+            workers[w] = (RenderWorker){&job, w};
+        }
+        runWorkers(workers, sizeof(RenderWorker), threadCount, countWorker);
+
+        // Each tile's bin holds the lines of worker zero, then worker one, and so on.
+        size_t total = 0;
+        for (int tile = 0; tile < tileCount; tile++) {
+            job.binStart[tile] = total;
+            for (int w = 0; w < threadCount; w++) {
+                size_t count = job.cursors[(size_t)w * tileCount + tile];
+                job.cursors[(size_t)w * tileCount + tile] = total;
+                total += count;
+            }
+        }
+        job.binStart[tileCount] = total;
+
+        job.binLines = malloc(total * sizeof(uint32_t) + 1);
+        result = job.binLines != NULL;
+    }
+
+    if (result) {
+        runWorkers(workers, sizeof(RenderWorker), threadCount, placeWorker);
+        pthread_mutex_init(&job.lock, NULL);
+        runWorkers(workers, sizeof(RenderWorker), threadCount, drawWorker);
+        pthread_mutex_destroy(&job.lock);
+    } else {
+        fprintf(stderr, "Memory allocation failed\n");
+    }
+
+    free(workers);
+    free(job.binLines);
+    free(job.binStart);
+    free(job.cursors);
+    free(job.lineTile);
+    return result;
+}
+
+// Function to save the image as a PNG file.
+void saveImageAsPNG(const char *filename, Image *image) {
     FILE *file = fopen(filename, "wb");
     if (!file) {
         fprintf(stderr, "Failed to open output PNG file.\n");
@@ -489,37 +626,179 @@ void saveImageAsPNG(const char *filename, RGB image[WIDTH][HEIGHT]) {
     }
 
     // Write the PPM header (for simplicity, we'll use PPM format).
-    fprintf(file, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+    fprintf(file, "P6\n%zu %zu\n255\n", image->width, image->height);
 
-    // Write the pixel data.
-    for (int y = 0; y < HEIGHT; y++) {
-        for (int x = 0; x < WIDTH; x++) {
-            fwrite(&image[x][y], sizeof(RGB), 1, file);
-        }
+    // Write the pixel data row by row, leaving out the padding.
+    for (size_t row = 0; row < image->height; row++) {
+        fwrite(IMAGE_ROW(image, row), sizeof(RGB), image->width, file);
     }
 
     fclose(file);
 }
 
-int main(void) {
-    const char *jsonFilename = "/Users/barbalet/github/ds-canterbury1940/lines.json";
-    const char *outputImageFilename = "/Users/barbalet/github/ds-canterbury1940/reconstructed_image.ppm";
+// Function to fill a strip of a span file on the image.
+void drawSpan(Image *image, SpanRecord span) {
+    RGB color = {{span.r, span.g, span.b}};
+    for (int y = span.startY; y <= span.endY; y++) {
+        RGB *row = IMAGE_ROW(image, y);
+        for (int x = span.startX; x <= span.endX; x++) {
+            row[x] = color;
+        }
+    }
+}
 
-    // Initialize the image array with white pixels.
-    RGB image[WIDTH][HEIGHT];
-    for (int x = 0; x < WIDTH; x++) {
-        for (int y = 0; y < HEIGHT; y++) {
-            image[x][y] = (RGB){255, 255, 255}; // White background.
+// Function to rebuild a map from a span file. The strips cover every pixel that is not white.
+int reconstructSpans(const char *spansFilename, const char *outputImageFilename) {
+    LineView view;
+    if (!openSpanView(spansFilename, &view)) {
+        return 1;
+    }
+
+    Arena arena;
+    Image image;
+    if (!arenaInit(&arena, imageArenaSize(view.width, view.height)) ||
+        !imageAllocate(&image, &arena, view.width, view.height)) {
+        fprintf(stderr, "Memory allocation failed\n");
+        arenaFree(&arena);
+        closeLineView(&view);
+        return 1;
+    }
+
+    imageFill(&image, (RGB){{255, 255, 255}}); // White background.
+    for (size_t i = 0; i < view.count; i++) {
+        SpanRecord span = lineViewAt(&view, i);
+        if (span.startX < 0 || span.startY < 0 || span.endX < span.startX || span.endY < span.startY ||
+            (uint32_t)span.endX >= view.width || (uint32_t)span.endY >= view.height) {
+            fprintf(stderr, "Strip %zu lies outside the image\n", i);
+            continue;
         }
+        drawSpan(&image, span);
     }
 
-    // Parse the JSON file and draw the lines on the image.
-    parseJSONFile(jsonFilename, image);
+    saveImageAsPNG(outputImageFilename, &image);
+    printf("Image reconstructed from %zu strips and saved to %s\n", view.count, outputImageFilename);
+
+    arenaFree(&arena);
+    closeLineView(&view);
+    return 0;
+}
+
+// Function to draw a map from the level of a line pyramid that suits the given number of image pixels per
+// output pixel. Only the tiles the tile index finds in the view are read.
+int reconstructPyramid(const char *pyramidFilename, const char *outputImageFilename, double scale, int threadCount) {
+    PyramidView view;
+    if (!openPyramidView(pyramidFilename, &view)) {
+        return 1;
+    }
+
+    uint32_t level = pyramidLevelForScale(&view, scale);
+    const PyramidLevelView *levelView = &view.levels[level];
+    size_t width = (view.width + levelView->scale - 1) / levelView->scale;
+    size_t height = (view.height + levelView->scale - 1) / levelView->scale;
+    size_t tileCount = (size_t)levelView->tilesAcross * levelView->tilesDown;
+    uint32_t *tiles = malloc((tileCount + 1) * sizeof(uint32_t));
+    LineInfo *lines = malloc(((size_t)levelView->lineCount + 1) * sizeof(LineInfo));
+
+    Arena arena = {NULL, 0, 0};
+    Image image;
+    if (!tiles || !lines || !arenaInit(&arena, imageArenaSize(width, height)) || !imageAllocate(&image, &arena, width, height)) {
+        fprintf(stderr, "Memory allocation failed\n");
+        arenaFree(&arena);
+        free(lines);
+        free(tiles);
+        closePyramidView(&view);
+        return 1;
+    }
+
+    size_t found = pyramidTilesInView(&view, level, 0, 0, (int32_t)width - 1, (int32_t)height - 1, tiles, tileCount);
+    size_t lineCount = 0;
+    for (size_t t = 0; t < found; t++) {
+        PyramidTile tile = pyramidTileAt(&view, level, tiles[t]);
+        for (uint32_t i = tile.first; i < tile.first + tile.count; i++) {
+            LineRecord line;
+            if (!pyramidLineAt(&view, level, i, &line) || line.startX < 0 || line.startY < 0 || line.endX < 0 || line.endY < 0 ||
+                (size_t)line.startX >= width || (size_t)line.endX >= width || (size_t)line.startY >= height || (size_t)line.endY >= height) {
+                fprintf(stderr, "Line %u of level %u lies outside the image\n", i, level);
+                continue;
+            }
+            lines[lineCount++] = (LineInfo){line.startX, line.startY, line.endX, line.endY, {{line.r, line.g, line.b}}};
+        }
+    }
+
+    if (!renderLines(&image, lines, lineCount, threadCount)) {
+        imageFill(&image, (RGB){{255, 255, 255}}); // White background.
+        for (size_t i = 0; i < lineCount; i++) {
+            drawLine(&image, lines[i]);
+        }
+    }
+
+    saveImageAsPNG(outputImageFilename, &image);
+    printf("Image reconstructed from %zu lines of %zu tiles at 1/%u and saved to %s\n", lineCount, found, levelView->scale,
+           outputImageFilename);
+
+    arenaFree(&arena);
+    free(lines);
+    free(tiles);
+    closePyramidView(&view);
+    return 0;
+}
+
+int main(int argc, const char *argv[]) {
+    const char *linesFilename = (argc > 1) ? argv[1] : "/Users/barbalet/github/ds-canterbury1940/lines.json";
+    const char *outputImageFilename = (argc > 2) ? argv[2] : "/Users/barbalet/github/ds-canterbury1940/reconstructed_image.ppm";
+    int threadCount = (argc > 3) ? atoi(argv[3]) : 0; // Render threads, 0 for one per core.
+
+    if (isSpanFile(linesFilename)) {
+        return reconstructSpans(linesFilename, outputImageFilename);
+    }
+    if (isPyramidFile(linesFilename)) {
+        double scale = (argc > 4) ? atof(argv[4]) : 1.0; // Image pixels per output pixel, for picking the level.
+        return reconstructPyramid(linesFilename, outputImageFilename, scale, threadCount);
+    }
+
+    // Read the line file (binary or JSON).
+    size_t lineCount;
+    LineInfo *lines = readLines(linesFilename, &lineCount);
+
+    // Size the image from the extent of the lines.
+    size_t width = 1, height = 1;
+    for (size_t i = 0; i < lineCount; i++) {
+        int maxX = lines[i].startX > lines[i].endX ? lines[i].startX : lines[i].endX;
+        int maxY = lines[i].startY > lines[i].endY ? lines[i].startY : lines[i].endY;
+        if (maxX >= (int)width) width = (size_t)maxX + 1;
+        if (maxY >= (int)height) height = (size_t)maxY + 1;
+    }
+
+    Arena arena;
+    Image image;
+    if (!arenaInit(&arena, imageArenaSize(width, height)) ||
+        !imageAllocate(&image, &arena, width, height)) {
+        fprintf(stderr, "Memory allocation failed\n");
+        arenaFree(&arena);
+        free(lines);
+        return 1;
+    }
+
+    // Initialize the image with white pixels and draw the lines on it, one by one if they can not be binned.
+    // The file may hold lines that leave the image, so those are clipped to it.
+    if (!renderLines(&image, lines, lineCount, threadCount)) {
+        imageFill(&image, (RGB){{255, 255, 255}}); // White background.
+        for (size_t i = 0; i < lineCount; i++) {
+            if (lineOnImage(&image, lines[i])) {
+                drawLine(&image, lines[i]);
+            } else {
+                drawLineInTile(&image, lines[i], 0, 0, (int)image.width, (int)image.height);
+            }
+        }
+    }
 
     // Save the reconstructed image as a PNG file.
-    saveImageAsPNG(outputImageFilename, image);
+    saveImageAsPNG(outputImageFilename, &image);
 
     printf("Image reconstructed and saved to %s\n", outputImageFilename);
+
+    arenaFree(&arena);
+    free(lines);
     return 0;
 }
 
@@ -35,6 +35,7 @@
 
 #include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -44,21 +45,17 @@
 #ifndef canterbury_h
 #define canterbury_h
 
-#undef NEW1600
+#include "linefile.h"
 
-#ifdef NEW1600
+#define TOPCOLORENTRIES 32
 
-#define WIDTH 1600
-#define HEIGHT 1600
+#define TOLERANCE_VALUE (20)
 
-#else
+#define EXTRACT_TILE_SIZE 128 // Side of the tiles used by the parallel line extraction
 
-#define WIDTH 400
-#define HEIGHT 400
-
-#endif
-
-#define TOPCOLORENTRIES 32
+#define PYRAMID_LEVELS 5         // Levels of a line pyramid, from full resolution down to 1/16
+#define PYRAMID_TILE_SIZE 256    // Side of the tiles of each pyramid level, in level pixels
+#define PYRAMID_MERGE_ERROR 1.0  // Error allowed when merging the lines of a reduced level, in level pixels
 
 typedef union
 {
@@ -77,11 +74,224 @@ typedef struct {
     int col;
 } Location;
 
-void gatherCalculations(void);
+// Structure to store line information. X is the image column and Y the row.
+typedef struct {
+    int startX, startY;
+    int endX, endY;
+    RGB color;
+} LineInfo;
+
+// A growable array of lines.
+typedef struct {
+    LineInfo *lines;
+    size_t count;
+    size_t capacity;
+} LineBuffer;
+
+// A rectangle of one color from the span extraction, covering columns left to right and rows top to
+// bottom inclusive.
+typedef struct {
+    int left, top;
+    int right, bottom;
+    RGB color;
+} SpanInfo;
+
+// A growable array of strips.
+typedef struct {
+    SpanInfo *spans;
+    size_t count;
+    size_t capacity;
+} SpanBuffer;
+
+#define LINEINDEX_NODE_SIZE 16 // Children of each node of a line index
+#define LINEINDEX_MAX_LEVELS 8 // Node levels of a line index, enough for 2^32 lines
+
+// A packed Hilbert R-tree over lines, built once from a whole set. The lines are sorted along a Hilbert
+// curve through their centres and grouped LINEINDEX_NODE_SIZE at a time, level by level, until a level
+// fits in one group. Each node keeps the box around its lines and a mask of the colors among them.
+// Sibling nodes, and the lines under one node, are stored as a block of boxes a column at a time, so a
+// whole block is tested in one pass.
+typedef struct {
+    size_t count;
+    int32_t *lineBoxes;   // Blocks of lines in curve order: every minX, then minY, maxX and maxY.
+    uint32_t *reversed;   // For each block of lines, a bit for each that runs from maxY at minX to minY at maxX.
+    uint32_t *colors;     // Packed color of each line, in curve order.
+    uint32_t *ids;        // Where each line was in the array the index was built from.
+    int32_t *boxes;       // Blocks of sibling nodes: every minX, then minY, maxX and maxY.
+    uint64_t *colorMasks; // One bit per color hash, for each node.
+    size_t levelStart[LINEINDEX_MAX_LEVELS + 1]; // First node of each level, counted in whole blocks.
+    size_t levelNodes[LINEINDEX_MAX_LEVELS];     // Nodes on each level, leaving out the empty slots of its last block.
+    int levelCount;
+} LineIndex;
+
+// Options for a run of the extractor.
+typedef struct {
+    const char *mapLocation;
+    const char *linesLocation; // Output lines, binary if it ends in LINEFILE_EXTENSION and JSON otherwise.
+                               // A SPANFILE_EXTENSION name extracts strips with the span encoding instead.
+    bool parallel;   // Extract in tiles across threads instead of the serial quadrant scan.
+    int threadCount; // Worker threads for the parallel extraction, 0 for one per core.
+    int pngLevel;    // zlib level for the output PNG, 0 to 9 or -1 for the default.
+    const char *previousMapLocation;   // Map the previous lines were extracted from, for an incremental update.
+    const char *previousLinesLocation; // Lines of a tiled extraction of the previous map.
+    const char *statsLocation; // Extraction counters as JSON, when built with CANTERBURY_STATS.
+    bool compactJSON; // Write JSON lines one object per row rather than indented.
+    bool versionedJSON; // Write JSON lines in the versioned layout, with X the column, rather than a bare array.
+    bool merge;        // Merge the lines before writing them.
+    double mergeError; // Pixels the merged polylines may be simplified by, negative to only join collinear lines.
+    const char *pyramidLocation; // Level of detail pyramid of the lines, PYRAMIDFILE_EXTENSION, when set.
+} CanterburyOptions;
+
+// A block of heap memory handed out in aligned pieces and released all at once.
+typedef struct {
+    unsigned char *base;
+    size_t size;
+    size_t used;
+} Arena;
+
+#define IMAGE_ROW_ALIGNMENT 64 // Rows are padded to a multiple of this many pixels, so each starts on a cache line
+
+// A packed RGB image sized at runtime, stored row by row with stride pixels from one row to the next.
+typedef struct {
+    size_t width;
+    size_t height;
+    size_t stride;
+    RGB *pixels;
+} Image;
+
+#define IMAGE_ROW(image, row) ((image)->pixels + (size_t)(row) * (image)->stride)
+#define IMAGE_AT(image, row, col) ((image)->pixels[(size_t)(row) * (image)->stride + (size_t)(col)])
+
+#define LABEL_WHITE 0xFE // White or already removed pixels
+#define LABEL_NOISE 0xFF // Pixels that are not one of the top colors
+
+// One byte per pixel of an Image: the index of its exact top color, LABEL_NOISE or LABEL_WHITE.
+// Laid out with the same stride as the image.
+typedef struct {
+    size_t width;
+    size_t height;
+    size_t stride;
+    uint8_t *labels;
+} LabelImage;
+
+#define LABEL_AT(labelImage, row, col) ((labelImage)->labels[(size_t)(row) * (labelImage)->stride + (size_t)(col)])
+
+#define STATS_RUN_BUCKETS 16 // Run lengths are counted in powers of two; the last bucket takes longer runs
+
+// Counters and timers of the extraction hot paths. They are compiled in only with -DCANTERBURY_STATS,
+// kept per thread while a pass runs and added to the totals at the end of it, then written as JSON.
+typedef struct {
+    uint64_t pixelsVisited;    // Pixels stepped over by the scans.
+    uint64_t seedsScanned;     // Pixels whose eight directions were probed.
+    uint64_t directionProbes;  // Neighbours tested as the start of a run.
+    uint64_t runsMeasured;     // Runs measured with colorRunLength.
+    uint64_t runLengths[STATS_RUN_BUCKETS]; // Bucket n counts lengths from 2^n up to 2^(n+1) - 1.
+    uint64_t similarCalls;     // Calls of isColorSimilar.
+    uint64_t linesByLabel[TOPCOLORENTRIES + 1]; // Lines found for each top color, the last for other colors.
+    uint64_t distinctColors;   // Colors counted by findTopColors.
+    double quadrantSeconds[4]; // Serial extraction time in each quadrant, over every pass.
+    double tileSeconds;        // Tiled extraction time summed over the tiles.
+    double stitchSeconds;      // Joining lines cut by tile seams.
+    double topColorSeconds;    // findTopColors.
+} ExtractStats;
+
+#ifdef CANTERBURY_STATS
+extern _Thread_local ExtractStats threadStats;
+#define STATS_ADD(field, amount) (threadStats.field += (amount))
+#define STATS_RUN(length) (threadStats.runLengths[statsBucket(length)]++)
+#define STATS_START(name) double name = statsSeconds()
+#define STATS_TIME(field, start) (threadStats.field += statsSeconds() - (start))
+#define STATS_MERGE() statsMerge()
+#else
+#define STATS_ADD(field, amount) ((void)0)
+#define STATS_RUN(length) ((void)0)
+#define STATS_START(name) ((void)0)
+#define STATS_TIME(field, start) ((void)0)
+#define STATS_MERGE() ((void)0)
+#endif
+
+bool arenaInit(Arena *arena, size_t size);
+
+void *arenaAlloc(Arena *arena, size_t size);
+
+void arenaFree(Arena *arena);
+
+size_t imageStride(size_t width);
+
+size_t imageArenaSize(size_t width, size_t height);
+
+bool imageAllocate(Image *image, Arena *arena, size_t width, size_t height);
+
+void imageFill(Image *image, RGB color);
+
+void imageFromPacked(Image *image, const uint8_t *packed);
+
+void imageToPacked(const Image *image, uint8_t *packed);
+
+size_t labelImageArenaSize(size_t width, size_t height);
+
+bool labelImageBuild(LabelImage *labelImage, Arena *arena, const Image *image, const uint32_t topColors[TOPCOLORENTRIES]);
+
+void gatherCalculations(const CanterburyOptions *options);
+
+void findTopColors(uint8_t *image, size_t width, size_t height, uint32_t topColors[TOPCOLORENTRIES], uint32_t pixelCounts[TOPCOLORENTRIES]);
+
+void findImageTopColors(const Image *image, uint32_t topColors[TOPCOLORENTRIES], uint32_t pixelCounts[TOPCOLORENTRIES]);
+
+bool isColorSimilar(RGB color1, RGB color2, int tolerance);
+
+size_t colorRunLength(const RGB *start, ptrdiff_t step, size_t maxSteps, RGB seed, int tolerance);
+
+bool lineBufferPush(LineBuffer *buffer, LineInfo line);
+
+void lineBufferFree(LineBuffer *buffer);
+
+bool writeLinesToJSON(const char *filename, const LineInfo *lines, size_t lineCount, bool compact, bool versioned);
+
+bool writeLines(const char *filename, const LineInfo *lines, size_t lineCount, const uint32_t topColors[TOPCOLORENTRIES], bool compactJSON,
+                bool versionedJSON);
+
+LineInfo *readLines(const char *filename, size_t *lineCount);
+
+void runWorkers(void *workers, size_t workerSize, int workerCount, void *(*step)(void *));
+
+void removeLines(Image *image, LabelImage *labelImage, LineBuffer *lines);
+
+void removeLinesParallel(Image *image, LabelImage *labelImage, LineBuffer *lines, int threadCount);
+
+int removeLinesIncremental(Image *image, LabelImage *labelImage, const Image *previous,
+                           const LineInfo *previousLines, size_t previousCount, LineBuffer *lines, int threadCount);
+
+bool mergeLines(LineBuffer *lines, double maxError);
+
+bool writeLinePyramid(const char *filename, const LineInfo *lines, size_t lineCount, size_t width, size_t height,
+                      const uint32_t topColors[TOPCOLORENTRIES]);
+
+bool lineIndexBuild(LineIndex *index, const LineInfo *lines, size_t lineCount);
+
+void lineIndexFree(LineIndex *index);
+
+size_t lineIndexSearch(const LineIndex *index, int left, int top, int right, int bottom, const RGB *color,
+                       size_t *results, size_t capacity);
+
+bool lineIndexNearest(const LineIndex *index, double x, double y, const RGB *color, size_t *result, double *distance);
+
+bool spanBufferPush(SpanBuffer *buffer, SpanInfo span);
+
+void spanBufferFree(SpanBuffer *buffer);
+
+bool extractSpans(Image *image, LabelImage *labelImage, SpanBuffer *spans);
+
+bool writeSpans(const char *filename, const SpanInfo *spans, size_t spanCount, const uint32_t topColors[TOPCOLORENTRIES],
+                size_t width, size_t height);
+
+double statsSeconds(void);
+
+int statsBucket(size_t length);
 
-void findTopColors(uint8_t *image, size_t width, size_t height, uint32_t topColors[32], uint32_t pixelCounts[32]);
+void statsMerge(void);
 
-void removeLine(RGB image[HEIGHT][WIDTH], RGB outv[HEIGHT][WIDTH], int startX, int startY, int dx, int dy, double threshold);
+bool statsWrite(const char *filename, const uint32_t topColors[TOPCOLORENTRIES]);
 
 bool colorDistance(int r1, int g1, int b1, int r2, int g2, int b2, double threshold);
 
@@ -0,0 +1,55 @@
+/****************************************************************
+
+    colorrun.c - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include "canterbury.h"
+
+// Count how many pixels after start, stepping by step pixels for at most maxSteps, stay within
+// tolerance of the seed color, as isColorSimilar would. The caller works out maxSteps once from the
+// bounds, so the loop tests only the color.
+size_t colorRunLength(const RGB *start, ptrdiff_t step, size_t maxSteps, RGB seed, int tolerance) {
+    const RGB *pixel = start;
+    size_t length = 0;
+
+    while (length < maxSteps) {
+        pixel += step;
+        if (abs((int)pixel->r - (int)seed.r) > tolerance ||
+            abs((int)pixel->g - (int)seed.g) > tolerance ||
+            abs((int)pixel->b - (int)seed.b) > tolerance) {
+            break;
+        }
+        length++;
+    }
+    return length;
+}
@@ -0,0 +1,693 @@
+/****************************************************************
+
+    extract.c - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include "canterbury.h"
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// A half-open rectangle of the image. X runs over image columns and Y over rows.
+typedef struct {
+    int startX, startY;
+    int endX, endY;
+} Region;
+
+// Check if two RGB colors are similar within a tolerance.
+bool isColorSimilar(RGB color1, RGB color2, int tolerance) {
+    STATS_ADD(similarCalls, 1);
+    return abs((int)color1.r - (int)color2.r) <= tolerance &&
+           abs((int)color1.g - (int)color2.g) <= tolerance &&
+           abs((int)color1.b - (int)color2.b) <= tolerance;
+}
+
+// Function to erase a line from the image and its labels.
+static void eraseLine(Image *image, LabelImage *labelImage, int startX, int startY, int endX, int endY) {
+    int dx = abs(endX - startX);
+    int dy = abs(endY - startY);
+    int sx = (startX < endX) ? 1 : -1;
+    int sy = (startY < endY) ? 1 : -1;
+    int err = dx - dy;
+
+    while (1) {
+        IMAGE_AT(image, startY, startX) = (RGB){{255, 255, 255}};
+        LABEL_AT(labelImage, startY, startX) = LABEL_WHITE;
+
+        if (startX == endX && startY == endY) break;
+
+        int e2 = 2 * err;
+        if (e2 > -dy) {
+            err -= dy;
+            startX += sx;
+        }
+        if (e2 < dx) {
+            err += dx;
+            startY += sy;
+        }
+    }
+}
+
+// Scan a region once, detecting lines from every unprocessed pixel and removing them from the image.
+// Lines may run anywhere inside bounds. Returns true if any line was found.
+static bool scanRegion(Image *image, LabelImage *labelImage, Region scan, Region bounds,
+                       bool processedColors[TOPCOLORENTRIES], LineBuffer *buffer, bool *allColorsProcessed) {
+    bool lineFound = false;
+
+    for (int y = scan.startY; y < scan.endY; y++) {
+        STATS_ADD(pixelsVisited, scan.endX - scan.startX);
+        for (int x = scan.startX; x < scan.endX; x++) {
+            uint8_t label = LABEL_AT(labelImage, y, x);
+            if (label == LABEL_WHITE) { // Skip white pixels.
+                continue;
+            }
+
+            // Check if the color has been processed.
+            if (label != LABEL_NOISE && processedColors[label]) {
+                continue;
+            }
+            *allColorsProcessed = false;
+            RGB color = IMAGE_AT(image, y, x);
+            STATS_ADD(seedsScanned, 1);
+
+            // Check lines in all directions using real-number gradients.
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    if (dx == 0 && dy == 0) continue; // Skip the current pixel.
+
+                    // Most directions end at the first neighbour, so test it before measuring the run.
+                    int nextX = x + dx, nextY = y + dy;
+                    STATS_ADD(directionProbes, 1);
+                    if (nextX < bounds.startX || nextX >= bounds.endX || nextY < bounds.startY || nextY >= bounds.endY ||
+                        !isColorSimilar(IMAGE_AT(image, nextY, nextX), color, TOLERANCE_VALUE)) {
+                        continue;
+                    }
+
+                    // Move in the direction until the color changes or the bounds are reached.
+                    int maxSteps = INT_MAX;
+                    if (dx != 0) maxSteps = (dx > 0) ? bounds.endX - 1 - nextX : nextX - bounds.startX;
+                    if (dy != 0) {
+                        int stepsY = (dy > 0) ? bounds.endY - 1 - nextY : nextY - bounds.startY;
+                        if (stepsY < maxSteps) maxSteps = stepsY;
+                    }
+                    ptrdiff_t step = (ptrdiff_t)dy * (ptrdiff_t)image->stride + dx;
+                    int length = 1 + (int)colorRunLength(&IMAGE_AT(image, nextY, nextX), step, (size_t)maxSteps, color, TOLERANCE_VALUE);
+                    STATS_ADD(runsMeasured, 1);
+                    STATS_RUN((size_t)length);
+
+                    int endXLine = x + dx * length;
+                    int endYLine = y + dy * length;
+
+                    // If a line is detected, record it and remove it from the image.
+                    if (endXLine != x || endYLine != y) {
+                        lineBufferPush(buffer, (LineInfo){x, y, endXLine, endYLine, color});
+                        STATS_ADD(linesByLabel[(label == LABEL_NOISE) ? TOPCOLORENTRIES : label], 1);
+                        eraseLine(image, labelImage, x, y, endXLine, endYLine);
+                        lineFound = true;
+                    }
+                }
+            }
+
+            // Mark the color as processed.
+            if (label != LABEL_NOISE) {
+                processedColors[label] = true;
+            }
+        }
+    }
+
+    return lineFound;
+}
+
+// Function to detect and remove lines of the same color in all four quadrants.
+void removeLines(Image *image, LabelImage *labelImage, LineBuffer *lines) {
+    int rows = (int)image->height;
+    int cols = (int)image->width;
+    Region bounds = {0, 0, cols, rows};
+    Region quadrants[4] = {
+        {0, 0, cols / 2, rows / 2},             // Top-left quadrant
+        {0, rows / 2, cols / 2, rows},          // Bottom-left quadrant
+        {cols / 2, 0, cols, rows / 2},          // Top-right quadrant
+        {cols / 2, rows / 2, cols, rows}        // Bottom-right quadrant
+    };
+
+    // Array to keep track of processed colors.
+    bool processedColors[TOPCOLORENTRIES] = {false};
+
+    // Loop until all colors are processed.
+    while (1) {
+        bool allColorsProcessed = true;
+        bool lineFound = false;
+
+        // Iterate through all four quadrants of the image.
+        for (int quadrant = 0; quadrant < 4; quadrant++) {
+            STATS_START(quadrantStart);
+            if (scanRegion(image, labelImage, quadrants[quadrant], bounds, processedColors, lines, &allColorsProcessed)) {
+                lineFound = true;
+            }
+            STATS_TIME(quadrantSeconds[quadrant], quadrantStart);
+        }
+
+        // If no lines were found in this iteration, or all colors have been processed, stop.
+        if (!lineFound || allColorsProcessed) {
+            break;
+        }
+    }
+    STATS_MERGE();
+}
+
+// Run the serial extraction loop confined to one tile, so tiles never touch each other's pixels.
+static void extractTile(Image *image, LabelImage *labelImage, Region tile, LineBuffer *buffer) {
+    bool processedColors[TOPCOLORENTRIES] = {false};
+
+    while (1) {
+        bool allColorsProcessed = true;
+        bool lineFound = scanRegion(image, labelImage, tile, tile, processedColors, buffer, &allColorsProcessed);
+
+        if (!lineFound || allColorsProcessed) {
+            break;
+        }
+    }
+}
+
+// Tiles still to be run by one worker. The owner pops from the head, thieves take from the tail.
+typedef struct {
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+} TileQueue;
+
+typedef struct {
+    Image *image;
+    LabelImage *labelImage;
+    int tilesAcross;
+    int tilesDown;
+    const int *tiles;      // Tiles to extract in queue order, NULL for all of them.
+    LineBuffer *tileLines; // One buffer per tile.
+    TileQueue *queues;     // One queue per worker.
+    int workerCount;
+} ExtractJob;
+
+typedef struct {
+    ExtractJob *job;
+    int worker;
+} ExtractWorker;
+
+static Region tileRegion(const ExtractJob *job, int tile) {
+    int tileRow = tile / job->tilesAcross;
+    int tileCol = tile % job->tilesAcross;
+    Region region = {tileCol * EXTRACT_TILE_SIZE, tileRow * EXTRACT_TILE_SIZE,
+                     (tileCol + 1) * EXTRACT_TILE_SIZE, (tileRow + 1) * EXTRACT_TILE_SIZE};
+    if (region.endX > (int)job->image->width) region.endX = (int)job->image->width;
+    if (region.endY > (int)job->image->height) region.endY = (int)job->image->height;
+    return region;
+}
+
+// Take the next tile for a worker: its own queue first, then steal from the others.
+static int nextTile(ExtractJob *job, int worker) {
+    for (int i = 0; i < job->workerCount; i++) {
+        TileQueue *queue = &job->queues[(worker + i) % job->workerCount];
+        int tile = -1;
+
+        pthread_mutex_lock(&queue->lock);
+        if (queue->head < queue->tail) {
+            tile = (i == 0) ? queue->head++ : --queue->tail;
+        }
+        pthread_mutex_unlock(&queue->lock);
+
+        if (tile >= 0) {
+            return tile;
+        }
+    }
+    return -1;
+}
+
+static void *extractWorker(void *argument) {
+    ExtractWorker *worker = argument;
+    ExtractJob *job = worker->job;
+    int tile;
+
+    while ((tile = nextTile(job, worker->worker)) >= 0) {
+        if (job->tiles) {
+            tile = job->tiles[tile];
+        }
+        STATS_START(tileStart);
+        extractTile(job->image, job->labelImage, tileRegion(job, tile), &job->tileLines[tile]);
+        STATS_TIME(tileSeconds, tileStart);
+    }
+    STATS_MERGE();
+    return NULL;
+}
+
+// Step from the start of a line to its end, one of the eight directions.
+static void lineDirection(const LineInfo *line, int *dx, int *dy) {
+    *dx = (line->endX > line->startX) - (line->endX < line->startX);
+    *dy = (line->endY > line->startY) - (line->endY < line->startY);
+}
+
+// A line turned to run in a positive direction, so both halves of a cut line agree.
+typedef struct {
+    int startX, startY;
+    int endX, endY;
+    int dx, dy;
+    int index;
+} SeamLine;
+
+static SeamLine seamLine(const LineInfo *line, int index) {
+    SeamLine seam = {line->startX, line->startY, line->endX, line->endY, 0, 0, index};
+    lineDirection(line, &seam.dx, &seam.dy);
+    if (seam.dy < 0 || (seam.dy == 0 && seam.dx < 0)) {
+        seam = (SeamLine){line->endX, line->endY, line->startX, line->startY, -seam.dx, -seam.dy, index};
+    }
+    return seam;
+}
+
+static int compareSeamStart(const void *a, const void *b) {
+    const SeamLine *s1 = (const SeamLine *)a;
+    const SeamLine *s2 = (const SeamLine *)b;
+    if (s1->startY != s2->startY) return (s1->startY < s2->startY) ? -1 : 1;
+    if (s1->startX != s2->startX) return (s1->startX < s2->startX) ? -1 : 1;
+    if (s1->dy != s2->dy) return (s1->dy < s2->dy) ? -1 : 1;
+    if (s1->dx != s2->dx) return (s1->dx < s2->dx) ? -1 : 1;
+    return (s1->index < s2->index) ? -1 : (s1->index > s2->index);
+}
+
+static int tileOf(int x, int y, int tilesAcross) {
+    return (y / EXTRACT_TILE_SIZE) * tilesAcross + x / EXTRACT_TILE_SIZE;
+}
+
+// Join lines that were cut where they crossed a tile seam. A line whose next pixel lies in another
+// tile is joined to the line of a similar color starting there in the same direction.
+static void stitchSeams(const ExtractJob *job, LineBuffer *merged, LineBuffer *stitched) {
+    size_t count = merged->count;
+    LineInfo *lines = merged->lines;
+    int rows = (int)job->image->height;
+    int cols = (int)job->image->width;
+
+    SeamLine *seams = malloc(count * sizeof(SeamLine) + 1);
+    SeamLine *starts = malloc(count * sizeof(SeamLine) + 1);
+    int *next = malloc(count * sizeof(int) + 1);
+    bool *joined = calloc(count + 1, sizeof(bool));
+    if (!seams || !starts || !next || !joined) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(seams);
+        free(starts);
+        free(next);
+        free(joined);
+        for (size_t i = 0; i < count; i++) {
+            lineBufferPush(stitched, lines[i]);
+        }
+        return;
+    }
+
+    // Collect the lines that begin right after a seam.
+    size_t startCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        seams[i] = seamLine(&lines[i], (int)i);
+        next[i] = -1;
+        int previousX = seams[i].startX - seams[i].dx;
+        int previousY = seams[i].startY - seams[i].dy;
+        if (previousX >= 0 && previousX < cols && previousY >= 0 && previousY < rows &&
+            tileOf(previousX, previousY, job->tilesAcross) != tileOf(seams[i].startX, seams[i].startY, job->tilesAcross)) {
+            starts[startCount++] = seams[i];
+        }
+    }
+    qsort(starts, startCount, sizeof(SeamLine), compareSeamStart);
+
+    // Link every line that runs into a seam to the first unused continuation.
+    for (size_t i = 0; i < count; i++) {
+        SeamLine probe = seams[i];
+        probe.startX = seams[i].endX + seams[i].dx;
+        probe.startY = seams[i].endY + seams[i].dy;
+        probe.index = -1;
+        if (probe.startX < 0 || probe.startX >= cols || probe.startY < 0 || probe.startY >= rows ||
+            tileOf(probe.startX, probe.startY, job->tilesAcross) == tileOf(seams[i].endX, seams[i].endY, job->tilesAcross)) {
+            continue;
+        }
+
+        // Binary search for the first candidate with this start and direction.
+        size_t low = 0, high = startCount;
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (compareSeamStart(&starts[middle], &probe) < 0) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        for (size_t k = low; k < startCount; k++) {
+            SeamLine *candidate = &starts[k];
+            if (candidate->startX != probe.startX || candidate->startY != probe.startY ||
+                candidate->dx != probe.dx || candidate->dy != probe.dy) {
+                break;
+            }
+            if (!joined[candidate->index] && isColorSimilar(lines[candidate->index].color, lines[i].color, TOLERANCE_VALUE)) {
+                joined[candidate->index] = true;
+                next[i] = candidate->index;
+                break;
+            }
+        }
+    }
+
+    // Emit each chain once, from its first line, in the merged order.
+    for (size_t i = 0; i < count; i++) {
+        if (joined[i]) {
+            continue;
+        }
+        if (next[i] < 0) {
+            lineBufferPush(stitched, lines[i]);
+            continue;
+        }
+        int last = (int)i;
+        while (next[last] >= 0) {
+            last = next[last];
+        }
+        lineBufferPush(stitched, (LineInfo){seams[i].startX, seams[i].startY, seams[last].endX, seams[last].endY, lines[i].color});
+    }
+
+    free(seams);
+    free(starts);
+    free(next);
+    free(joined);
+}
+
+// Function to run step on each of workerCount workers, an array of workerSize byte records, with the
+// calling thread as worker zero. A worker whose thread can not be started is run on the calling thread
+// once the others are done.
+void runWorkers(void *workers, size_t workerSize, int workerCount, void *(*step)(void *)) {
+    unsigned char *worker = workers;
+    pthread_t *threads = NULL;
+    bool *started = NULL;
+    if (workerCount > 1) {
+        threads = malloc((size_t)workerCount * sizeof(pthread_t));
+        started = calloc((size_t)workerCount, sizeof(bool));
+    }
+
+    if (threads && started) {
+        for (int w = 1; w < workerCount; w++) {
+            started[w] = pthread_create(&threads[w], NULL, step, worker + (size_t)w * workerSize) == 0;
+        }
+    }
+    step(worker);
+    for (int w = 1; w < workerCount; w++) {
+        if (started && started[w]) {
+            pthread_join(threads[w], NULL);
+        } else {
+            step(worker + (size_t)w * workerSize);
+        }
+    }
+
+    free(started);
+    free(threads);
+}
+
+// Extract tileCount tiles on up to threadCount threads, 0 for one per core, each into its own
+// buffer in job->tileLines. Returns false if the workers could not be set up.
+static bool extractTiles(ExtractJob *job, int tileCount, int threadCount) {
+    if (threadCount <= 0) {
+        threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threadCount < 1) {
+        threadCount = 1;
+    }
+    if (threadCount > tileCount) {
+        threadCount = tileCount > 0 ? tileCount : 1;
+    }
+    job->workerCount = threadCount;
+
+    job->queues = calloc(threadCount, sizeof(TileQueue));
+    ExtractWorker *workers = calloc(threadCount, sizeof(ExtractWorker));
+    if (!job->queues || !workers) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(job->queues);
+        free(workers);
+        return false;
+    }
+
+    // Deal the tiles out in contiguous runs, one run per worker.
+    for (int w = 0; w < threadCount; w++) {
+        pthread_mutex_init(&job->queues[w].lock, NULL);
+        job->queues[w].head = (int)((long)tileCount * w / threadCount);
+        job->queues[w].tail = (int)((long)tileCount * (w + 1) / threadCount);
+        workers[w] = (ExtractWorker){job, w};
+    }
+
+    runWorkers(workers, sizeof(ExtractWorker), threadCount, extractWorker);
+
+    for (int w = 0; w < threadCount; w++) {
+        pthread_mutex_destroy(&job->queues[w].lock);
+    }
+    free(workers);
+    free(job->queues);
+    job->queues = NULL;
+    return true;
+}
+
+// Merge the tile buffers in tile order and stitch the lines cut by the seams into lines.
+static void mergeTiles(ExtractJob *job, LineBuffer *lines) {
+    int tileCount = job->tilesAcross * job->tilesDown;
+    LineBuffer merged = {NULL, 0, 0};
+    for (int tile = 0; tile < tileCount; tile++) {
+        for (size_t i = 0; i < job->tileLines[tile].count; i++) {
+            lineBufferPush(&merged, job->tileLines[tile].lines[i]);
+        }
+        lineBufferFree(&job->tileLines[tile]);
+    }
+
+    STATS_START(stitchStart);
+    stitchSeams(job, &merged, lines);
+    STATS_TIME(stitchSeconds, stitchStart);
+    STATS_MERGE();
+    lineBufferFree(&merged);
+}
+
+static void extractJobInit(ExtractJob *job, Image *image, LabelImage *labelImage) {
+    job->image = image;
+    job->labelImage = labelImage;
+    job->tilesAcross = (int)((image->width + EXTRACT_TILE_SIZE - 1) / EXTRACT_TILE_SIZE);
+    job->tilesDown = (int)((image->height + EXTRACT_TILE_SIZE - 1) / EXTRACT_TILE_SIZE);
+    job->tiles = NULL;
+    job->tileLines = NULL;
+    job->queues = NULL;
+    job->workerCount = 0;
+}
+
+// Function to detect and remove lines using tiles extracted in parallel. Each tile runs the
+// extraction on its own pixels into its own buffer; the buffers are merged in tile order and
+// lines cut by the seams are stitched, so the output does not depend on the thread count.
+void removeLinesParallel(Image *image, LabelImage *labelImage, LineBuffer *lines, int threadCount) {
+    ExtractJob job;
+    extractJobInit(&job, image, labelImage);
+
+    int tileCount = job.tilesAcross * job.tilesDown;
+    job.tileLines = calloc(tileCount + 1, sizeof(LineBuffer));
+    if (!job.tileLines) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return;
+    }
+
+    if (extractTiles(&job, tileCount, threadCount)) {
+        mergeTiles(&job, lines);
+    }
+    free(job.tileLines);
+}
+
+// Mark the tiles whose pixels differ between the two images, which must be the same size.
+static int markChangedTiles(const ExtractJob *job, const Image *previous, bool *dirty) {
+    int changed = 0;
+    for (int tile = 0; tile < job->tilesAcross * job->tilesDown; tile++) {
+        Region region = tileRegion(job, tile);
+        size_t rowBytes = (size_t)(region.endX - region.startX) * sizeof(RGB);
+        dirty[tile] = false;
+        for (int y = region.startY; y < region.endY && !dirty[tile]; y++) {
+            dirty[tile] = memcmp(&IMAGE_AT(previous, y, region.startX), &IMAGE_AT(job->image, y, region.startX), rowBytes) != 0;
+        }
+        changed += dirty[tile];
+    }
+    return changed;
+}
+
+// Whiten the pixels of a previous line that is kept, as its extraction did. Its labels are left,
+// since only the tiles that changed are scanned again and they never read another tile's labels.
+static void whitenLine(Image *image, LabelImage *labelImage, LineInfo line) {
+    int dx, dy;
+    lineDirection(&line, &dx, &dy);
+    int spanX = abs(line.endX - line.startX), spanY = abs(line.endY - line.startY);
+    if (spanX != 0 && spanY != 0 && spanX != spanY) {
+        eraseLine(image, labelImage, line.startX, line.startY, line.endX, line.endY); // Not from the extraction.
+        return;
+    }
+
+    for (int x = line.startX, y = line.startY;; x += dx, y += dy) {
+        IMAGE_AT(image, y, x) = (RGB){{255, 255, 255}};
+        if (x == line.endX && y == line.endY) break;
+    }
+}
+
+// Check whether a previous line is in a tile that changed, or ends right beside one, where the
+// line it was stitched to or could now be stitched to may differ. Such lines are cut and stitched again.
+static bool touchesChangedTile(const ExtractJob *job, const bool *dirty, LineInfo line) {
+    int rows = (int)job->image->height;
+    int cols = (int)job->image->width;
+    int dx, dy;
+    lineDirection(&line, &dx, &dy);
+
+    int beforeX = line.startX - dx, beforeY = line.startY - dy;
+    int afterX = line.endX + dx, afterY = line.endY + dy;
+    if ((beforeX >= 0 && beforeX < cols && beforeY >= 0 && beforeY < rows && dirty[tileOf(beforeX, beforeY, job->tilesAcross)]) ||
+        (afterX >= 0 && afterX < cols && afterY >= 0 && afterY < rows && dirty[tileOf(afterX, afterY, job->tilesAcross)])) {
+        return true;
+    }
+
+    int tile = tileOf(line.startX, line.startY, job->tilesAcross);
+    int endTile = tileOf(line.endX, line.endY, job->tilesAcross);
+    int spanX = abs(line.endX - line.startX), spanY = abs(line.endY - line.startY);
+    if (tile == endTile || (spanX != 0 && spanY != 0 && spanX != spanY)) {
+        return dirty[tile] || dirty[endTile];
+    }
+
+    // A line cut by seams: every tile it passes through.
+    for (int x = line.startX, y = line.startY;; x += dx, y += dy) {
+        if (dirty[tileOf(x, y, job->tilesAcross)]) return true;
+        if (x == line.endX && y == line.endY) return false;
+    }
+}
+
+// Hand a piece of a previous line to the buffer of the tile it lies in, unless that tile changed.
+static void keepPiece(ExtractJob *job, const bool *dirty, LineInfo piece) {
+    int tile = tileOf(piece.startX, piece.startY, job->tilesAcross);
+    if (!dirty[tile]) {
+        lineBufferPush(&job->tileLines[tile], piece);
+        whitenLine(job->image, job->labelImage, piece);
+    }
+}
+
+// Cut a previous line back into the pieces the tiles extracted, where it crosses the seams.
+static void splitAtSeams(ExtractJob *job, const bool *dirty, LineInfo line) {
+    int dx, dy;
+    lineDirection(&line, &dx, &dy);
+
+    // Lines off the eight directions were not made by the extraction; keep them whole if both ends are clean.
+    int spanX = abs(line.endX - line.startX), spanY = abs(line.endY - line.startY);
+    if (spanX != 0 && spanY != 0 && spanX != spanY) {
+        if (!dirty[tileOf(line.endX, line.endY, job->tilesAcross)]) {
+            keepPiece(job, dirty, line);
+        }
+        return;
+    }
+
+    // Tiles are rectangles, so a line ending in the tile it starts in never leaves it.
+    int tile = tileOf(line.startX, line.startY, job->tilesAcross);
+    if (tileOf(line.endX, line.endY, job->tilesAcross) == tile) {
+        keepPiece(job, dirty, line);
+        return;
+    }
+
+    LineInfo piece = line;
+    int x = line.startX, y = line.startY;
+    while (x != line.endX || y != line.endY) {
+        int nextTile = tileOf(x + dx, y + dy, job->tilesAcross);
+        if (nextTile != tile) {
+            piece.endX = x;
+            piece.endY = y;
+            keepPiece(job, dirty, piece);
+            piece.startX = x + dx;
+            piece.startY = y + dy;
+            tile = nextTile;
+        }
+        x += dx;
+        y += dy;
+    }
+    piece.endX = line.endX;
+    piece.endY = line.endY;
+    keepPiece(job, dirty, piece);
+}
+
+// Function to update the lines of a previous tiled extraction after the map was edited. Only the
+// tiles whose pixels differ from the previous map are extracted again. Previous lines clear of
+// them are kept as they are, in their previous order, and whitened in the image; those in or
+// beside a changed tile are cut at the seams, their pieces in unchanged tiles are stitched with
+// the new lines as removeLinesParallel would, and the result follows the kept lines. The previous
+// map must be the same size and have the same top colors, as the palette decides the lines of
+// every tile. Returns the number of tiles extracted.
+int removeLinesIncremental(Image *image, LabelImage *labelImage, const Image *previous,
+                           const LineInfo *previousLines, size_t previousCount, LineBuffer *lines, int threadCount) {
+    ExtractJob job;
+    extractJobInit(&job, image, labelImage);
+
+    int tileCount = job.tilesAcross * job.tilesDown;
+    job.tileLines = calloc(tileCount + 1, sizeof(LineBuffer));
+    bool *dirty = calloc(tileCount + 1, sizeof(bool));
+    int *tiles = malloc((tileCount + 1) * sizeof(int));
+    if (!job.tileLines || !dirty || !tiles) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(job.tileLines);
+        free(dirty);
+        free(tiles);
+        return 0;
+    }
+
+    int changed = markChangedTiles(&job, previous, dirty);
+    for (int tile = 0, queued = 0; tile < tileCount; tile++) {
+        if (dirty[tile]) {
+            tiles[queued++] = tile;
+        }
+    }
+
+    for (size_t i = 0; i < previousCount; i++) {
+        LineInfo line = previousLines[i];
+        if (line.startX < 0 || line.startX >= (int)image->width || line.startY < 0 || line.startY >= (int)image->height ||
+            line.endX < 0 || line.endX >= (int)image->width || line.endY < 0 || line.endY >= (int)image->height) {
+            continue;
+        }
+        if (changed == 0 || !touchesChangedTile(&job, dirty, line)) {
+            lineBufferPush(lines, line);
+            whitenLine(image, labelImage, line);
+        } else {
+            splitAtSeams(&job, dirty, line);
+        }
+    }
+
+    job.tiles = tiles;
+    if (changed == 0 || extractTiles(&job, changed, threadCount)) {
+        mergeTiles(&job, lines);
+    } else {
+        for (int tile = 0; tile < tileCount; tile++) {
+            lineBufferFree(&job.tileLines[tile]);
+        }
+    }
+
+    free(tiles);
+    free(dirty);
+    free(job.tileLines);
+    return changed;
+}
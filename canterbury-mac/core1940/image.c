@@ -0,0 +1,167 @@
+/****************************************************************
+
+    image.c - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include "canterbury.h"
+
+#define ARENA_ALIGNMENT 64
+
+#define LABEL_TABLE_BITS 6 // Color to label table of 64 slots, twice TOPCOLORENTRIES
+
+// Reserve a single heap block for an arena.
+bool arenaInit(Arena *arena, size_t size) {
+    arena->base = malloc(size);
+    arena->size = arena->base ? size : 0;
+    arena->used = 0;
+    return arena->base != NULL;
+}
+
+// Hand out a cache-line aligned piece of the arena, or NULL if it is exhausted.
+void *arenaAlloc(Arena *arena, size_t size) {
+    size_t start = (arena->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (start > arena->size || size > arena->size - start) {
+        return NULL;
+    }
+    arena->used = start + size;
+    return arena->base + start;
+}
+
+// Release everything allocated from the arena.
+void arenaFree(Arena *arena) {
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+// Pixels from one row to the next for an image of the given width.
+size_t imageStride(size_t width) {
+    return (width + IMAGE_ROW_ALIGNMENT - 1) / IMAGE_ROW_ALIGNMENT * IMAGE_ROW_ALIGNMENT;
+}
+
+// Arena space needed to hold an image of the given dimensions.
+size_t imageArenaSize(size_t width, size_t height) {
+    return imageStride(width) * height * sizeof(RGB) + ARENA_ALIGNMENT;
+}
+
+// Allocate the pixels of an image from an arena.
+bool imageAllocate(Image *image, Arena *arena, size_t width, size_t height) {
+    image->width = width;
+    image->height = height;
+    image->stride = imageStride(width);
+    image->pixels = arenaAlloc(arena, image->stride * height * sizeof(RGB));
+    return image->pixels != NULL;
+}
+
+// Set every pixel of an image to one color.
+void imageFill(Image *image, RGB color) {
+    for (size_t row = 0; row < image->height; row++) {
+        RGB *pixels = IMAGE_ROW(image, row);
+        for (size_t col = 0; col < image->width; col++) {
+            pixels[col] = color;
+        }
+    }
+}
+
+// Copy tightly packed RGB rows, as decoded from a PNG, into an image.
+void imageFromPacked(Image *image, const uint8_t *packed) {
+    for (size_t row = 0; row < image->height; row++) {
+        memcpy(IMAGE_ROW(image, row), packed + row * image->width * sizeof(RGB), image->width * sizeof(RGB));
+    }
+}
+
+// Copy an image into tightly packed RGB rows, as written to a PNG.
+void imageToPacked(const Image *image, uint8_t *packed) {
+    for (size_t row = 0; row < image->height; row++) {
+        memcpy(packed + row * image->width * sizeof(RGB), IMAGE_ROW(image, row), image->width * sizeof(RGB));
+    }
+}
+
+// Arena space needed to hold the labels of an image of the given dimensions.
+size_t labelImageArenaSize(size_t width, size_t height) {
+    return imageStride(width) * height + ARENA_ALIGNMENT;
+}
+
+// Label every pixel of an image once with the index of its top color, so extraction can
+// look up a pixel's color state directly instead of searching the top colors for it.
+// A color listed more than once takes its first index.
+bool labelImageBuild(LabelImage *labelImage, Arena *arena, const Image *image, const uint32_t topColors[TOPCOLORENTRIES]) {
+    labelImage->width = image->width;
+    labelImage->height = image->height;
+    labelImage->stride = image->stride;
+    labelImage->labels = arenaAlloc(arena, image->stride * image->height);
+    if (!labelImage->labels) {
+        return false;
+    }
+
+    // Small open-addressed table from color to label.
+    uint32_t keys[1 << LABEL_TABLE_BITS];
+    uint8_t values[1 << LABEL_TABLE_BITS];
+    memset(values, LABEL_NOISE, sizeof(values));
+    for (int i = 0; i < TOPCOLORENTRIES; i++) {
+        uint32_t slot = (topColors[i] * 2654435761u) >> (32 - LABEL_TABLE_BITS);
+        while (values[slot] != LABEL_NOISE && keys[slot] != topColors[i]) {
+            slot = (slot + 1) & ((1 << LABEL_TABLE_BITS) - 1);
+        }
+        if (values[slot] == LABEL_NOISE) {
+            keys[slot] = topColors[i];
+            values[slot] = (uint8_t)i;
+        }
+    }
+
+    uint32_t lastKey = 0xFFFFFFFF;
+    uint8_t lastLabel = LABEL_NOISE;
+    for (size_t row = 0; row < image->height; row++) {
+        const RGB *pixels = IMAGE_ROW(image, row);
+        uint8_t *labels = &LABEL_AT(labelImage, row, 0);
+        for (size_t col = 0; col < image->width; col++) {
+            RGB pixel = pixels[col];
+            uint32_t colorKey = (pixel.r << 16) | (pixel.g << 8) | pixel.b;
+            if (colorKey != lastKey) {
+                lastKey = colorKey;
+                if (colorKey == 0xFFFFFF) {
+                    lastLabel = LABEL_WHITE;
+                } else {
+                    uint32_t slot = (colorKey * 2654435761u) >> (32 - LABEL_TABLE_BITS);
+                    while (values[slot] != LABEL_NOISE && keys[slot] != colorKey) {
+                        slot = (slot + 1) & ((1 << LABEL_TABLE_BITS) - 1);
+                    }
+                    lastLabel = values[slot];
+                }
+            }
+            labels[col] = lastLabel;
+        }
+    }
+    return true;
+}
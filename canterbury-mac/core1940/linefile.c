@@ -0,0 +1,1530 @@
+/****************************************************************
+
+    linefile.c - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include "linefile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PALETTE_EMPTY 0xFFFFFFFF // Never a 24-bit color, marks a free slot in the palette map.
+
+static void putUint32(unsigned char *out, uint32_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+static uint32_t getUint32(const unsigned char *in) {
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static bool hasExtension(const char *filename, const char *extension) {
+    size_t length = strlen(filename);
+    size_t extensionLength = strlen(extension);
+    return length >= extensionLength && strcmp(filename + length - extensionLength, extension) == 0;
+}
+
+static bool hasMagic(const char *filename, const char *expected) {
+    char magic[4];
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return false;
+    }
+    bool result = fread(magic, 1, 4, file) == 4 && memcmp(magic, expected, 4) == 0;
+    fclose(file);
+    return result;
+}
+
+// Check whether a file name asks for the binary line format.
+bool isLineFileName(const char *filename) {
+    return hasExtension(filename, LINEFILE_EXTENSION);
+}
+
+// Check whether a file starts with the binary line file magic.
+bool isLineFile(const char *filename) {
+    return hasMagic(filename, LINEFILE_MAGIC);
+}
+
+// Check whether a file name asks for a span file.
+bool isSpanFileName(const char *filename) {
+    return hasExtension(filename, SPANFILE_EXTENSION);
+}
+
+// Check whether a file starts with the span file magic.
+bool isSpanFile(const char *filename) {
+    return hasMagic(filename, SPANFILE_MAGIC);
+}
+
+// Maps packed colors to palette indices while the palette is built.
+typedef struct {
+    uint32_t *colors;
+    uint32_t *indices;
+    uint32_t mask;
+    uint32_t count;
+} PaletteMap;
+
+static uint32_t paletteSlot(const PaletteMap *map, uint32_t color) {
+    uint32_t slot = (color * 0x9E3779B1u >> 7) & map->mask;
+    while (map->colors[slot] != color && map->colors[slot] != PALETTE_EMPTY) {
+        slot = (slot + 1) & map->mask;
+    }
+    return slot;
+}
+
+// Write records as the columns of a line or span file, after a header with the given magic and version
+// and a palette seeded from the given colors. The image size goes in the header of span files.
+static bool writeRecordFile(const char *filename, const char *magic, uint32_t version, const LineRecord *lines, size_t lineCount,
+                            const uint32_t *seedColors, size_t seedCount, uint32_t imageWidth, uint32_t imageHeight) {
+    const char *kind = (memcmp(magic, SPANFILE_MAGIC, 4) == 0) ? "span" : "line";
+    if (seedCount + lineCount > 0x3FFFFFFF) {
+        fprintf(stderr, "Too many %ss for a %s file.\n", kind, kind);
+        return false;
+    }
+
+    // At most one palette entry per seed and per line; keep the map at most half full.
+    uint32_t capacity = 16;
+    while (capacity < (seedCount + lineCount) * 2) {
+        capacity <<= 1;
+    }
+    PaletteMap map = {malloc(capacity * sizeof(uint32_t)), malloc(capacity * sizeof(uint32_t)), capacity - 1, 0};
+    uint32_t *palette = malloc((seedCount + lineCount + 1) * sizeof(uint32_t));
+    uint32_t *colorIndex = malloc((lineCount + 1) * sizeof(uint32_t));
+    FILE *file = (map.colors && map.indices && palette && colorIndex) ? fopen(filename, "wb") : NULL;
+
+    if (!file) {
+        fprintf(stderr, "Failed to open %s file for writing.\n", kind);
+        free(colorIndex);
+        free(palette);
+        free(map.indices);
+        free(map.colors);
+        return false;
+    }
+    memset(map.colors, 0xFF, capacity * sizeof(uint32_t));
+
+    for (size_t i = 0; i < seedCount + lineCount; i++) {
+        uint32_t color = (i < seedCount) ? (seedColors[i] & 0xFFFFFF)
+                                         : ((uint32_t)lines[i - seedCount].r << 16) | ((uint32_t)lines[i - seedCount].g << 8) | lines[i - seedCount].b;
+        uint32_t slot = paletteSlot(&map, color);
+        if (map.colors[slot] == PALETTE_EMPTY) {
+            map.colors[slot] = color;
+            map.indices[slot] = map.count;
+            palette[map.count++] = color;
+        }
+        if (i >= seedCount) {
+            colorIndex[i - seedCount] = map.indices[slot];
+        }
+    }
+
+    uint32_t indexBytes = (map.count <= 0x100) ? 1 : (map.count <= 0x10000) ? 2 : 4;
+
+    unsigned char header[LINEFILE_HEADER_SIZE] = {0};
+    memcpy(header, magic, 4);
+    putUint32(header + 4, version);
+    putUint32(header + 8, (uint32_t)lineCount);
+    putUint32(header + 12, map.count);
+    putUint32(header + 16, indexBytes);
+    putUint32(header + 20, imageWidth);
+    putUint32(header + 24, imageHeight);
+    fwrite(header, 1, sizeof(header), file);
+
+    for (uint32_t i = 0; i < map.count; i++) {
+        unsigned char entry[4] = {(palette[i] >> 16) & 0xFF, (palette[i] >> 8) & 0xFF, palette[i] & 0xFF, 0};
+        fwrite(entry, 1, 4, file);
+    }
+
+    // Write the coordinate columns through a small staging buffer.
+    unsigned char staging[4096];
+    for (int column = 0; column < 5; column++) {
+        size_t width = (column < 4) ? 4 : indexBytes;
+        size_t used = 0;
+        for (size_t i = 0; i < lineCount; i++) {
+            uint32_t value;
+            switch (column) {
+                case 0: value = (uint32_t)lines[i].startX; break;
+                case 1: value = (uint32_t)lines[i].startY; break;
+                case 2: value = (uint32_t)lines[i].endX; break;
+                case 3: value = (uint32_t)lines[i].endY; break;
+                default: value = colorIndex[i]; break;
+            }
+            unsigned char bytes[4];
+            putUint32(bytes, value);
+            memcpy(staging + used, bytes, width);
+            used += width;
+            if (used + 4 > sizeof(staging)) {
+                fwrite(staging, 1, used, file);
+                used = 0;
+            }
+        }
+        fwrite(staging, 1, used, file);
+    }
+
+    bool result = ferror(file) == 0;
+    if (fclose(file) != 0) {
+        result = false;
+    }
+
+    free(colorIndex);
+    free(palette);
+    free(map.indices);
+    free(map.colors);
+    return result;
+}
+
+// Function to write lines as a binary line file with a palette seeded from the given colors.
+bool writeLineFile(const char *filename, const LineRecord *lines, size_t lineCount, const uint32_t *seedColors, size_t seedCount) {
+    return writeRecordFile(filename, LINEFILE_MAGIC, LINEFILE_VERSION, lines, lineCount, seedColors, seedCount, 0, 0);
+}
+
+// Function to write the strips of a span extraction as a span file, with the size of the image they cover.
+bool writeSpanFile(const char *filename, const SpanRecord *spans, size_t spanCount, const uint32_t *seedColors, size_t seedCount,
+                   uint32_t width, uint32_t height) {
+    return writeRecordFile(filename, SPANFILE_MAGIC, SPANFILE_VERSION, spans, spanCount, seedColors, seedCount, width, height);
+}
+
+// Find or add the palette index of a color, doubling the palette map when it is half full.
+static uint32_t lineFilePaletteIndex(LineFileWriter *writer, uint32_t color) {
+    if ((writer->paletteCount + 1) * 2 > writer->mapMask + 1) {
+        uint32_t capacity = (writer->mapMask + 1) * 2;
+        PaletteMap map = {malloc(capacity * sizeof(uint32_t)), malloc(capacity * sizeof(uint32_t)), capacity - 1, 0};
+        uint32_t *palette = realloc(writer->palette, capacity * sizeof(uint32_t));
+        if (!map.colors || !map.indices || !palette) {
+            free(map.colors);
+            free(map.indices);
+            if (palette) {
+                writer->palette = palette;
+            }
+            writer->failed = true;
+            return 0;
+        }
+        writer->palette = palette;
+        memset(map.colors, 0xFF, capacity * sizeof(uint32_t));
+        for (uint32_t i = 0; i < writer->paletteCount; i++) {
+            uint32_t slot = paletteSlot(&map, palette[i]);
+            map.colors[slot] = palette[i];
+            map.indices[slot] = i;
+        }
+        free(writer->mapColors);
+        free(writer->mapIndices);
+        writer->mapColors = map.colors;
+        writer->mapIndices = map.indices;
+        writer->mapMask = map.mask;
+    }
+
+    PaletteMap map = {writer->mapColors, writer->mapIndices, writer->mapMask, writer->paletteCount};
+    uint32_t slot = paletteSlot(&map, color);
+    if (writer->mapColors[slot] == PALETTE_EMPTY) {
+        writer->mapColors[slot] = color;
+        writer->mapIndices[slot] = writer->paletteCount;
+        writer->palette[writer->paletteCount++] = color;
+    }
+    return writer->mapIndices[slot];
+}
+
+// Function to start a binary line file that lines are appended to, with a palette seeded from the given colors.
+bool openLineFile(LineFileWriter *writer, const char *filename, const uint32_t *seedColors, size_t seedCount) {
+    uint32_t capacity = 256;
+    memset(writer, 0, sizeof(LineFileWriter));
+    writer->mapColors = malloc(capacity * sizeof(uint32_t));
+    writer->mapIndices = malloc(capacity * sizeof(uint32_t));
+    writer->palette = malloc(capacity * sizeof(uint32_t));
+    writer->staged = malloc(5 * LINEFILE_SPOOL_LINES * sizeof(uint32_t));
+    writer->mapMask = capacity - 1;
+    bool result = writer->mapColors && writer->mapIndices && writer->palette && writer->staged;
+    for (int column = 0; result && column < 5; column++) {
+        writer->columns[column] = tmpfile();
+        result = writer->columns[column] != NULL;
+    }
+    writer->file = result ? fopen(filename, "wb") : NULL;
+
+    if (!writer->file) {
+        fprintf(stderr, "Failed to open line file for writing.\n");
+        for (int column = 0; column < 5; column++) {
+            if (writer->columns[column]) {
+                fclose(writer->columns[column]);
+            }
+        }
+        free(writer->staged);
+        free(writer->palette);
+        free(writer->mapIndices);
+        free(writer->mapColors);
+        memset(writer, 0, sizeof(LineFileWriter));
+        return false;
+    }
+    memset(writer->mapColors, 0xFF, capacity * sizeof(uint32_t));
+
+    for (size_t i = 0; i < seedCount; i++) {
+        lineFilePaletteIndex(writer, seedColors[i] & 0xFFFFFF);
+    }
+    return true;
+}
+
+// Hand the staged block of each column to its spool file.
+static void spoolLineFile(LineFileWriter *writer) {
+    for (int column = 0; column < 5 && writer->stagedCount; column++) {
+        if (fwrite(writer->staged + column * LINEFILE_SPOOL_LINES, sizeof(uint32_t), writer->stagedCount, writer->columns[column]) != writer->stagedCount) {
+            writer->failed = true;
+        }
+    }
+    writer->stagedCount = 0;
+}
+
+// Function to add a line to the staged columns.
+void appendLineFile(LineFileWriter *writer, LineRecord line) {
+    if (writer->failed) {
+        return;
+    }
+    if (writer->count + writer->paletteCount >= 0x3FFFFFFF) {
+        fprintf(stderr, "Too many lines for a line file.\n");
+        writer->failed = true;
+        return;
+    }
+
+    uint32_t values[5] = {(uint32_t)line.startX, (uint32_t)line.startY, (uint32_t)line.endX, (uint32_t)line.endY,
+                          lineFilePaletteIndex(writer, ((uint32_t)line.r << 16) | ((uint32_t)line.g << 8) | line.b)};
+    for (int column = 0; column < 5; column++) {
+        putUint32((unsigned char *)(writer->staged + column * LINEFILE_SPOOL_LINES + writer->stagedCount), values[column]);
+    }
+    writer->count++;
+    if (++writer->stagedCount == LINEFILE_SPOOL_LINES) {
+        spoolLineFile(writer);
+    }
+}
+
+// Function to write the header and palette, copy the spooled columns in behind them and close the file.
+// The color indices are narrowed to the fewest bytes the palette allows. Returns false if any output failed.
+bool closeLineFile(LineFileWriter *writer) {
+    if (!writer->file) {
+        return false;
+    }
+
+    spoolLineFile(writer);
+    bool result = !writer->failed;
+    uint32_t indexBytes = (writer->paletteCount <= 0x100) ? 1 : (writer->paletteCount <= 0x10000) ? 2 : 4;
+
+    unsigned char header[LINEFILE_HEADER_SIZE] = {0};
+    memcpy(header, LINEFILE_MAGIC, 4);
+    putUint32(header + 4, LINEFILE_VERSION);
+    putUint32(header + 8, (uint32_t)writer->count);
+    putUint32(header + 12, writer->paletteCount);
+    putUint32(header + 16, indexBytes);
+    fwrite(header, 1, sizeof(header), writer->file);
+
+    for (uint32_t i = 0; result && i < writer->paletteCount; i++) {
+        uint32_t color = writer->palette[i];
+        unsigned char entry[4] = {(color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF, 0};
+        fwrite(entry, 1, 4, writer->file);
+    }
+
+    unsigned char staging[4096];
+    for (int column = 0; column < 5; column++) {
+        FILE *spool = writer->columns[column];
+        if (result && fflush(spool) == 0 && fseek(spool, 0, SEEK_SET) == 0) {
+            size_t got;
+            while ((got = fread(staging, 1, sizeof(staging), spool)) > 0) {
+                // Spooled indices are four bytes; keep the low ones.
+                size_t used = got;
+                if (column == 4 && indexBytes < 4) {
+                    used = 0;
+                    for (size_t i = 0; i < got; i += 4) {
+                        memmove(staging + used, staging + i, indexBytes);
+                        used += indexBytes;
+                    }
+                }
+                fwrite(staging, 1, used, writer->file);
+            }
+            result = ferror(spool) == 0;
+        } else {
+            result = false;
+        }
+        fclose(spool);
+    }
+
+    if (ferror(writer->file) != 0) {
+        result = false;
+    }
+    if (fclose(writer->file) != 0) {
+        result = false;
+    }
+    if (!result) {
+        fprintf(stderr, "Failed to write line file.\n");
+    }
+    free(writer->staged);
+    free(writer->palette);
+    free(writer->mapIndices);
+    free(writer->mapColors);
+    memset(writer, 0, sizeof(LineFileWriter));
+    return result;
+}
+
+static bool isLittleEndian(void) {
+    uint16_t probe = 1;
+    return *(uint8_t *)&probe == 1;
+}
+
+static uint32_t colorIndexAt(const LineView *view, size_t index) {
+    switch (view->indexBytes) {
+        case 1: return view->colorIndex[index];
+        case 2: return view->colorIndex[2 * index] | ((uint32_t)view->colorIndex[2 * index + 1] << 8);
+        default: return getUint32(view->colorIndex + 4 * index);
+    }
+}
+
+// Point the view at the columns of a mapped binary line or span file, checking every size and index.
+static bool viewBinary(LineView *view, const char *filename, bool spans) {
+    const unsigned char *data = view->mapping;
+
+    uint32_t version = (view->mappingSize < LINEFILE_HEADER_SIZE) ? 0 : getUint32(data + 4);
+    bool known = spans ? (version == SPANFILE_VERSION) : (version == LINEFILE_VERSION || version == LINEFILE_ROW_FIRST_VERSION);
+    if (!known) {
+        fprintf(stderr, "Not a %s file: %s\n", spans ? "span" : "line", filename);
+        return false;
+    }
+
+    size_t count = getUint32(data + 8);
+    view->paletteCount = getUint32(data + 12);
+    view->indexBytes = getUint32(data + 16);
+    if (spans) {
+        view->width = getUint32(data + 20);
+        view->height = getUint32(data + 24);
+    }
+    if (view->indexBytes != 1 && view->indexBytes != 2 && view->indexBytes != 4) {
+        fprintf(stderr, "Not a line file: %s\n", filename);
+        return false;
+    }
+    if (view->mappingSize < LINEFILE_HEADER_SIZE + (size_t)view->paletteCount * 4 + count * (16 + view->indexBytes)) {
+        fprintf(stderr, "Truncated line file: %s\n", filename);
+        return false;
+    }
+
+    const unsigned char *columns = data + LINEFILE_HEADER_SIZE + (size_t)view->paletteCount * 4;
+    // Older files list the row columns first; swapping the column order reads them as columns and rows.
+    size_t xColumn = (!spans && version == LINEFILE_ROW_FIRST_VERSION) ? 1 : 0;
+    size_t yColumn = 1 - xColumn;
+    view->palette = data + LINEFILE_HEADER_SIZE;
+    view->colorIndex = columns + 16 * count;
+    view->count = count;
+
+    for (size_t i = 0; i < count; i++) {
+        if (colorIndexAt(view, i) >= view->paletteCount) {
+            fprintf(stderr, "Bad color index in line file %s\n", filename);
+            return false;
+        }
+    }
+
+    // The columns are 4-byte aligned in the page-aligned mapping, so they can be used in place.
+    if (isLittleEndian()) {
+        view->startX = (const int32_t *)columns + xColumn * count;
+        view->startY = (const int32_t *)columns + yColumn * count;
+        view->endX = (const int32_t *)columns + (2 + xColumn) * count;
+        view->endY = (const int32_t *)columns + (2 + yColumn) * count;
+        return true;
+    }
+
+    view->records = malloc(count * sizeof(LineRecord) + 1);
+    if (!view->records) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint32_t index = colorIndexAt(view, i);
+        view->records[i] = (LineRecord){(int32_t)getUint32(columns + 4 * (xColumn * count + i)), (int32_t)getUint32(columns + 4 * (yColumn * count + i)),
+                                        (int32_t)getUint32(columns + 4 * ((2 + xColumn) * count + i)), (int32_t)getUint32(columns + 4 * ((2 + yColumn) * count + i)),
+                                        view->palette[4 * index], view->palette[4 * index + 1], view->palette[4 * index + 2]};
+    }
+    return true;
+}
+
+// Parse an integer value, skipping any fraction or exponent. Returns the position after the number.
+static const char *parseNumber(const char *p, const char *end, int32_t *value) {
+    bool negative = false;
+    int64_t result = 0;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (result < INT32_MAX) {
+            result = result * 10 + (*p - '0');
+        }
+        p++;
+    }
+    while (p < end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '-' || *p == '+')) {
+        p++;
+    }
+
+    if (result > INT32_MAX) {
+        result = INT32_MAX;
+    }
+    *value = (int32_t)(negative ? -result : result);
+    return p;
+}
+
+// Tokenize a JSON file of line objects, versioned or a bare array. Only the structure is used, not the
+// layout: keys may come in any order with any whitespace, and unknown keys are ignored.
+static bool viewJSON(LineView *view, const char *filename) {
+    const char *p = view->mapping;
+    const char *end = p + view->mappingSize;
+    size_t capacity = 0;
+    int depth = 0;
+    LineRecord current = {0};
+
+    // A versioned file is an object around the array of lines; a bare array has no version.
+    const char *first = p;
+    while (first < end && (*first == ' ' || *first == '\t' || *first == '\r' || *first == '\n')) first++;
+    int lineDepth = (first < end && *first == '{') ? 3 : 2;
+    int32_t version = 0;
+
+    view->count = 0;
+
+    while (p < end) {
+        char c = *p++;
+
+        if (c == '{') {
+            if (++depth == lineDepth) {
+                current = (LineRecord){0};
+            }
+        } else if (c == '}') {
+            // Closing a line object, which sits inside the array of lines.
+            if (depth-- == lineDepth) {
+                if (view->count == capacity) {
+                    capacity = capacity ? capacity * 2 : 4096;
+                    LineRecord *grown = realloc(view->records, capacity * sizeof(LineRecord));
+                    if (!grown) {
+                        fprintf(stderr, "Memory allocation failed\n");
+                        return false;
+                    }
+                    view->records = grown;
+                }
+                view->records[view->count++] = current;
+            }
+        } else if (c == '[') {
+            depth++;
+        } else if (c == ']') {
+            depth--;
+        } else if (c == '"') {
+            const char *key = p;
+            while (p < end && *p != '"') {
+                p += (*p == '\\') ? 2 : 1;
+            }
+            size_t keyLength = (size_t)((p < end ? p : end) - key);
+            p++;
+
+            // A string followed by a colon is a key; only numeric values are of interest.
+            const char *value = p;
+            while (value < end && (*value == ' ' || *value == '\t' || *value == '\r' || *value == '\n')) value++;
+            if (value >= end || *value != ':') continue;
+            value++;
+            while (value < end && (*value == ' ' || *value == '\t' || *value == '\r' || *value == '\n')) value++;
+            if (value >= end || !(*value == '-' || (*value >= '0' && *value <= '9'))) {
+                p = value;
+                continue;
+            }
+
+            int32_t number;
+            p = parseNumber(value, end, &number);
+
+            if (depth == 1 && lineDepth == 3) {
+                if (keyLength == 7 && memcmp(key, "version", 7) == 0) version = number;
+            } else if (keyLength == 6 && memcmp(key, "startX", 6) == 0) current.startX = number;
+            else if (keyLength == 6 && memcmp(key, "startY", 6) == 0) current.startY = number;
+            else if (keyLength == 4 && memcmp(key, "endX", 4) == 0) current.endX = number;
+            else if (keyLength == 4 && memcmp(key, "endY", 4) == 0) current.endY = number;
+            else if (keyLength == 1 && key[0] == 'r') current.r = (uint8_t)number;
+            else if (keyLength == 1 && key[0] == 'g') current.g = (uint8_t)number;
+            else if (keyLength == 1 && key[0] == 'b') current.b = (uint8_t)number;
+        }
+    }
+
+    if (version != 0 && version != LINEFILE_VERSION && version != LINEFILE_ROW_FIRST_VERSION) {
+        fprintf(stderr, "Not a line file: %s\n", filename);
+        return false;
+    }
+    // Unversioned and version 1 files hold the row in X.
+    if (version != LINEFILE_VERSION) {
+        for (size_t i = 0; i < view->count; i++) {
+            LineRecord *line = &view->records[i];
+            *line = (LineRecord){line->startY, line->startX, line->endY, line->endX, line->r, line->g, line->b};
+        }
+    }
+
+    // A file cut short, say by a writer that stopped, still gives the lines that were finished.
+    if (depth != 0) {
+        fprintf(stderr, "Truncated JSON line file %s, reading its %zu complete lines\n", filename, view->count);
+    }
+    return true;
+}
+
+// Map a whole file into the view. An empty file is left unmapped.
+static bool mapFile(const char *filename, LineView *view) {
+    memset(view, 0, sizeof(LineView));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open line file %s\n", filename);
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        fprintf(stderr, "Failed to open line file %s\n", filename);
+        close(fd);
+        return false;
+    }
+    if (status.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    view->mappingSize = (size_t)status.st_size;
+    view->mapping = mmap(NULL, view->mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view->mapping == MAP_FAILED) {
+        fprintf(stderr, "Failed to map line file %s\n", filename);
+        view->mapping = NULL;
+        return false;
+    }
+    return true;
+}
+
+// Function to map a line file, binary or JSON, and make its lines available without copying the file.
+bool openLineView(const char *filename, LineView *view) {
+    if (!mapFile(filename, view)) {
+        return false;
+    }
+    if (!view->mapping) {
+        return true; // An empty file holds no lines.
+    }
+
+    bool result;
+    if (view->mappingSize >= 4 && memcmp(view->mapping, LINEFILE_MAGIC, 4) == 0) {
+        result = viewBinary(view, filename, false);
+    } else {
+        madvise(view->mapping, view->mappingSize, MADV_SEQUENTIAL);
+        result = viewJSON(view, filename);
+    }
+
+    if (!result) {
+        closeLineView(view);
+    }
+    return result;
+}
+
+// Function to map a span file and make its strips available, as records, without copying the file.
+bool openSpanView(const char *filename, LineView *view) {
+    if (!mapFile(filename, view)) {
+        return false;
+    }
+
+    bool result = view->mappingSize >= 4 && memcmp(view->mapping, SPANFILE_MAGIC, 4) == 0;
+    if (!result) {
+        fprintf(stderr, "Not a span file: %s\n", filename);
+    } else {
+        result = viewBinary(view, filename, true);
+    }
+
+    if (!result) {
+        closeLineView(view);
+    }
+    return result;
+}
+
+// Function to get a line from a view.
+LineRecord lineViewAt(const LineView *view, size_t index) {
+    if (view->records) {
+        return view->records[index];
+    }
+
+    uint32_t color = colorIndexAt(view, index);
+    return (LineRecord){view->startX[index], view->startY[index], view->endX[index], view->endY[index],
+                        view->palette[4 * color], view->palette[4 * color + 1], view->palette[4 * color + 2]};
+}
+
+// Function to release a view and its mapping.
+void closeLineView(LineView *view) {
+    if (view->mapping) {
+        munmap(view->mapping, view->mappingSize);
+    }
+    free(view->records);
+    memset(view, 0, sizeof(LineView));
+}
+
+// Function to read a line file, binary or JSON, into a heap array of lines.
+LineRecord *readLineFile(const char *filename, size_t *lineCount) {
+    LineView view;
+    *lineCount = 0;
+
+    if (!openLineView(filename, &view)) {
+        return NULL;
+    }
+
+    LineRecord *lines = malloc(view.count * sizeof(LineRecord) + 1);
+    if (!lines) {
+        fprintf(stderr, "Memory allocation failed\n");
+        closeLineView(&view);
+        return NULL;
+    }
+    for (size_t i = 0; i < view.count; i++) {
+        lines[i] = lineViewAt(&view, i);
+    }
+
+    *lineCount = view.count;
+    closeLineView(&view);
+    return lines;
+}
+
+// Check whether a file name asks for a line pyramid.
+bool isPyramidFileName(const char *filename) {
+    return hasExtension(filename, PYRAMIDFILE_EXTENSION);
+}
+
+// Check whether a file starts with the line pyramid magic.
+bool isPyramidFile(const char *filename) {
+    return hasMagic(filename, PYRAMIDFILE_MAGIC);
+}
+
+static void putUint64(unsigned char *out, uint64_t value) {
+    putUint32(out, (uint32_t)value);
+    putUint32(out + 4, (uint32_t)(value >> 32));
+}
+
+static uint64_t getUint64(const unsigned char *in) {
+    return getUint32(in) | ((uint64_t)getUint32(in + 4) << 32);
+}
+
+// Tiles of a level of the given scale along an image side.
+static uint32_t pyramidTiles(uint32_t side, uint32_t scale, uint32_t tileSize) {
+    uint32_t levelSide = (side + scale - 1) / scale;
+    return (levelSide + tileSize - 1) / tileSize;
+}
+
+// The tile along one side holding a midpoint, clamped to the level.
+static uint32_t pyramidTileOf(int32_t start, int32_t end, uint32_t tileSize, uint32_t tiles) {
+    int64_t middle = ((int64_t)start + end) >> 1;
+    if (middle < 0) {
+        return 0;
+    }
+    uint64_t tile = (uint64_t)middle / tileSize;
+    return (tile >= tiles) ? tiles - 1 : (uint32_t)tile;
+}
+
+// Function to write the levels of a line pyramid, each sorted into tiles of tileSize level pixels by the
+// midpoints of its lines, with one palette seeded from the given colors. Width and height are in image pixels.
+bool writePyramidFile(const char *filename, const PyramidLevel *levels, uint32_t levelCount, uint32_t tileSize,
+                      uint32_t width, uint32_t height, const uint32_t *seedColors, size_t seedCount) {
+    size_t total = seedCount;
+    size_t mostTiles = 0, mostLines = 0;
+    for (uint32_t level = 0; level < levelCount; level++) {
+        size_t tiles = (size_t)pyramidTiles(width, levels[level].scale, tileSize) * pyramidTiles(height, levels[level].scale, tileSize);
+        if (levels[level].scale == 0 || levels[level].count > 0xFFFFFFFF || tiles > 0xFFFFFFFF) {
+            fprintf(stderr, "Bad level for a pyramid file.\n");
+            return false;
+        }
+        total += levels[level].count;
+        mostTiles = (tiles > mostTiles) ? tiles : mostTiles;
+        mostLines = (levels[level].count > mostLines) ? levels[level].count : mostLines;
+    }
+    if (total > 0x3FFFFFFF || tileSize == 0 || width == 0 || height == 0) {
+        fprintf(stderr, "Too many lines for a pyramid file.\n");
+        return false;
+    }
+
+    uint32_t capacity = 16;
+    while (capacity < total * 2) {
+        capacity <<= 1;
+    }
+    PaletteMap map = {malloc(capacity * sizeof(uint32_t)), malloc(capacity * sizeof(uint32_t)), capacity - 1, 0};
+    uint32_t *palette = malloc((total + 1) * sizeof(uint32_t));
+    uint32_t *tileStart = malloc((mostTiles + 1) * sizeof(uint32_t));
+    int32_t *bounds = malloc((mostTiles + 1) * 4 * sizeof(int32_t));
+    uint32_t *order = malloc((mostLines + 1) * sizeof(uint32_t));
+    uint32_t *lineTile = malloc((mostLines + 1) * sizeof(uint32_t));
+    FILE *file = (map.colors && map.indices && palette && tileStart && bounds && order && lineTile) ? fopen(filename, "wb") : NULL;
+
+    if (!file) {
+        fprintf(stderr, "Failed to open pyramid file for writing.\n");
+        free(lineTile);
+        free(order);
+        free(bounds);
+        free(tileStart);
+        free(palette);
+        free(map.indices);
+        free(map.colors);
+        return false;
+    }
+    memset(map.colors, 0xFF, capacity * sizeof(uint32_t));
+
+    // One palette for every level, so a color keeps its index from level to level.
+    for (size_t i = 0; i < total; i++) {
+        uint32_t color = (i < seedCount) ? (seedColors[i] & 0xFFFFFF) : 0;
+        if (i >= seedCount) {
+            size_t index = i - seedCount;
+            uint32_t level = 0;
+            while (index >= levels[level].count) {
+                index -= levels[level++].count;
+            }
+            const LineRecord *line = &levels[level].lines[index];
+            color = ((uint32_t)line->r << 16) | ((uint32_t)line->g << 8) | line->b;
+        }
+        uint32_t slot = paletteSlot(&map, color);
+        if (map.colors[slot] == PALETTE_EMPTY) {
+            map.colors[slot] = color;
+            map.indices[slot] = map.count;
+            palette[map.count++] = color;
+        }
+    }
+
+    unsigned char header[LINEFILE_HEADER_SIZE] = {0};
+    memcpy(header, PYRAMIDFILE_MAGIC, 4);
+    putUint32(header + 4, PYRAMIDFILE_VERSION);
+    putUint32(header + 8, levelCount);
+    putUint32(header + 12, tileSize);
+    putUint32(header + 16, width);
+    putUint32(header + 20, height);
+    putUint32(header + 24, map.count);
+    fwrite(header, 1, sizeof(header), file);
+
+    for (uint32_t i = 0; i < map.count; i++) {
+        unsigned char entry[4] = {(palette[i] >> 16) & 0xFF, (palette[i] >> 8) & 0xFF, palette[i] & 0xFF, 0};
+        fwrite(entry, 1, 4, file);
+    }
+
+    // Lay the levels out one after another behind the level table.
+    uint64_t offset = LINEFILE_HEADER_SIZE + (uint64_t)map.count * 4 + (uint64_t)levelCount * PYRAMIDFILE_LEVEL_SIZE;
+    for (uint32_t level = 0; level < levelCount; level++) {
+        uint32_t across = pyramidTiles(width, levels[level].scale, tileSize);
+        uint32_t down = pyramidTiles(height, levels[level].scale, tileSize);
+        unsigned char entry[PYRAMIDFILE_LEVEL_SIZE] = {0};
+        putUint32(entry, levels[level].scale);
+        putUint32(entry + 4, (uint32_t)levels[level].count);
+        putUint32(entry + 8, across);
+        putUint32(entry + 12, down);
+        putUint64(entry + 24, offset);
+        offset += (uint64_t)across * down * PYRAMIDFILE_TILE_SIZE;
+        putUint64(entry + 32, offset);
+        offset += (uint64_t)levels[level].count * PYRAMIDFILE_LINE_SIZE;
+
+        // The reach is filled in once the level's tiles are known.
+        uint32_t reach = 0;
+        const LineRecord *lines = levels[level].lines;
+        for (size_t i = 0; i < levels[level].count; i++) {
+            uint32_t tileX = pyramidTileOf(lines[i].startX, lines[i].endX, tileSize, across);
+            uint32_t tileY = pyramidTileOf(lines[i].startY, lines[i].endY, tileSize, down);
+            int64_t left = (int64_t)tileX * tileSize, top = (int64_t)tileY * tileSize;
+            int64_t lowX = (lines[i].startX < lines[i].endX) ? lines[i].startX : lines[i].endX;
+            int64_t lowY = (lines[i].startY < lines[i].endY) ? lines[i].startY : lines[i].endY;
+            int64_t highX = (lines[i].startX > lines[i].endX) ? lines[i].startX : lines[i].endX;
+            int64_t highY = (lines[i].startY > lines[i].endY) ? lines[i].startY : lines[i].endY;
+            int64_t spill = left - lowX;
+            spill = (top - lowY > spill) ? top - lowY : spill;
+            spill = (highX - (left + tileSize - 1) > spill) ? highX - (left + tileSize - 1) : spill;
+            spill = (highY - (top + tileSize - 1) > spill) ? highY - (top + tileSize - 1) : spill;
+            if (spill > (int64_t)reach) {
+                reach = (spill > 0x7FFFFFFF) ? 0x7FFFFFFF : (uint32_t)spill;
+            }
+        }
+        putUint32(entry + 16, reach);
+        fwrite(entry, 1, sizeof(entry), file);
+    }
+
+    for (uint32_t level = 0; level < levelCount; level++) {
+        uint32_t across = pyramidTiles(width, levels[level].scale, tileSize);
+        size_t tileCount = (size_t)across * pyramidTiles(height, levels[level].scale, tileSize);
+        const LineRecord *lines = levels[level].lines;
+        size_t count = levels[level].count;
+
+        // Counting sort of the lines by tile, keeping their order within a tile.
+        memset(tileStart, 0, (tileCount + 1) * sizeof(uint32_t));
+        for (size_t i = 0; i < count; i++) {
+            lineTile[i] = pyramidTileOf(lines[i].startY, lines[i].endY, tileSize, (uint32_t)(tileCount / across)) * across +
+                          pyramidTileOf(lines[i].startX, lines[i].endX, tileSize, across);
+            tileStart[lineTile[i] + 1]++;
+        }
+        for (size_t t = 0; t < tileCount; t++) {
+            tileStart[t + 1] += tileStart[t];
+            bounds[4 * t] = bounds[4 * t + 1] = INT32_MAX;
+            bounds[4 * t + 2] = bounds[4 * t + 3] = INT32_MIN;
+        }
+        for (size_t i = 0; i < count; i++) {
+            uint32_t t = lineTile[i];
+            order[tileStart[t]++] = (uint32_t)i;
+            int32_t *box = bounds + 4 * t;
+            box[0] = (lines[i].startX < box[0]) ? lines[i].startX : box[0];
+            box[0] = (lines[i].endX < box[0]) ? lines[i].endX : box[0];
+            box[1] = (lines[i].startY < box[1]) ? lines[i].startY : box[1];
+            box[1] = (lines[i].endY < box[1]) ? lines[i].endY : box[1];
+            box[2] = (lines[i].startX > box[2]) ? lines[i].startX : box[2];
+            box[2] = (lines[i].endX > box[2]) ? lines[i].endX : box[2];
+            box[3] = (lines[i].startY > box[3]) ? lines[i].startY : box[3];
+            box[3] = (lines[i].endY > box[3]) ? lines[i].endY : box[3];
+        }
+
+        // Placing moved each start to the next tile's; an empty tile has empty bounds.
+        for (size_t t = 0; t < tileCount; t++) {
+            uint32_t first = (t == 0) ? 0 : tileStart[t - 1];
+            unsigned char entry[PYRAMIDFILE_TILE_SIZE];
+            putUint32(entry, first);
+            putUint32(entry + 4, tileStart[t] - first);
+            for (int k = 0; k < 4; k++) {
+                putUint32(entry + 8 + 4 * k, (uint32_t)((tileStart[t] == first) ? 0 : bounds[4 * t + k]));
+            }
+            fwrite(entry, 1, sizeof(entry), file);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            const LineRecord *line = &lines[order[i]];
+            unsigned char record[PYRAMIDFILE_LINE_SIZE];
+            putUint32(record, (uint32_t)line->startX);
+            putUint32(record + 4, (uint32_t)line->startY);
+            putUint32(record + 8, (uint32_t)line->endX);
+            putUint32(record + 12, (uint32_t)line->endY);
+            putUint32(record + 16, map.indices[paletteSlot(&map, ((uint32_t)line->r << 16) | ((uint32_t)line->g << 8) | line->b)]);
+            fwrite(record, 1, sizeof(record), file);
+        }
+    }
+
+    bool result = ferror(file) == 0;
+    if (fclose(file) != 0) {
+        result = false;
+    }
+
+    free(lineTile);
+    free(order);
+    free(bounds);
+    free(tileStart);
+    free(palette);
+    free(map.indices);
+    free(map.colors);
+    return result;
+}
+
+// Function to map a line pyramid, checking its header, level table and tile tables. The lines themselves
+// are only read as they are asked for.
+bool openPyramidView(const char *filename, PyramidView *view) {
+    LineView mapped;
+    memset(view, 0, sizeof(PyramidView));
+    if (!mapFile(filename, &mapped)) {
+        return false;
+    }
+    view->mapping = mapped.mapping;
+    view->mappingSize = mapped.mappingSize;
+
+    const unsigned char *data = view->mapping;
+    bool result = view->mappingSize >= LINEFILE_HEADER_SIZE && memcmp(data, PYRAMIDFILE_MAGIC, 4) == 0 &&
+                  getUint32(data + 4) == PYRAMIDFILE_VERSION;
+    if (result) {
+        view->levelCount = getUint32(data + 8);
+        view->tileSize = getUint32(data + 12);
+        view->width = getUint32(data + 16);
+        view->height = getUint32(data + 20);
+        view->paletteCount = getUint32(data + 24);
+        view->palette = data + LINEFILE_HEADER_SIZE;
+        result = view->tileSize > 0 && view->width > 0 && view->height > 0 && view->levelCount <= 32 &&
+                 view->mappingSize >= LINEFILE_HEADER_SIZE + (uint64_t)view->paletteCount * 4 + (uint64_t)view->levelCount * PYRAMIDFILE_LEVEL_SIZE;
+    }
+    if (!result) {
+        fprintf(stderr, "Not a pyramid file: %s\n", filename);
+        closePyramidView(view);
+        return false;
+    }
+
+    view->levels = calloc(view->levelCount + 1, sizeof(PyramidLevelView));
+    if (!view->levels) {
+        fprintf(stderr, "Memory allocation failed\n");
+        closePyramidView(view);
+        return false;
+    }
+
+    const unsigned char *table = view->palette + (size_t)view->paletteCount * 4;
+    for (uint32_t level = 0; result && level < view->levelCount; level++) {
+        const unsigned char *entry = table + (size_t)level * PYRAMIDFILE_LEVEL_SIZE;
+        PyramidLevelView *levelView = &view->levels[level];
+        levelView->scale = getUint32(entry);
+        levelView->lineCount = getUint32(entry + 4);
+        levelView->tilesAcross = getUint32(entry + 8);
+        levelView->tilesDown = getUint32(entry + 12);
+        levelView->reach = getUint32(entry + 16);
+        uint64_t tileOffset = getUint64(entry + 24);
+        uint64_t lineOffset = getUint64(entry + 32);
+        uint64_t tileCount = (uint64_t)levelView->tilesAcross * levelView->tilesDown;
+
+        result = levelView->scale > 0 && levelView->tilesAcross == pyramidTiles(view->width, levelView->scale, view->tileSize) &&
+                 levelView->tilesDown == pyramidTiles(view->height, levelView->scale, view->tileSize) &&
+                 tileOffset <= view->mappingSize && tileCount * PYRAMIDFILE_TILE_SIZE <= view->mappingSize - tileOffset &&
+                 lineOffset <= view->mappingSize && (uint64_t)levelView->lineCount * PYRAMIDFILE_LINE_SIZE <= view->mappingSize - lineOffset;
+        if (!result) {
+            break;
+        }
+        levelView->tiles = data + tileOffset;
+        levelView->lines = data + lineOffset;
+
+        // Every tile's run of lines must lie within the level.
+        for (uint64_t t = 0; result && t < tileCount; t++) {
+            const unsigned char *tile = levelView->tiles + t * PYRAMIDFILE_TILE_SIZE;
+            result = (uint64_t)getUint32(tile) + getUint32(tile + 4) <= levelView->lineCount;
+        }
+    }
+    if (!result) {
+        fprintf(stderr, "Corrupt pyramid file: %s\n", filename);
+        closePyramidView(view);
+    }
+    return result;
+}
+
+// Function to pick the coarsest level whose scale is no more than the given number of image pixels per
+// screen pixel, so a viewport never gets fewer lines than it has pixels to show them.
+uint32_t pyramidLevelForScale(const PyramidView *view, double scale) {
+    uint32_t best = 0;
+    for (uint32_t level = 0; level < view->levelCount; level++) {
+        if (view->levels[level].scale <= scale && view->levels[level].scale >= view->levels[best].scale) {
+            best = level;
+        }
+    }
+    return best;
+}
+
+// Function to get a tile of a level by its row-major index.
+PyramidTile pyramidTileAt(const PyramidView *view, uint32_t level, uint32_t tile) {
+    const unsigned char *entry = view->levels[level].tiles + (size_t)tile * PYRAMIDFILE_TILE_SIZE;
+    return (PyramidTile){getUint32(entry), getUint32(entry + 4), (int32_t)getUint32(entry + 8), (int32_t)getUint32(entry + 12),
+                         (int32_t)getUint32(entry + 16), (int32_t)getUint32(entry + 20)};
+}
+
+// Function to find the tiles of a level with lines inside a rectangle of level pixels, inclusive. Only the tiles
+// within the level's reach of the rectangle are looked at. Up to capacity tile indices are stored; the number
+// of tiles found is returned.
+size_t pyramidTilesInView(const PyramidView *view, uint32_t level, int32_t left, int32_t top, int32_t right, int32_t bottom,
+                          uint32_t *tiles, size_t capacity) {
+    const PyramidLevelView *levelView = &view->levels[level];
+    int64_t reach = levelView->reach;
+    int64_t size = view->tileSize;
+    int64_t firstX = ((int64_t)left - reach) / size, lastX = ((int64_t)right + reach) / size;
+    int64_t firstY = ((int64_t)top - reach) / size, lastY = ((int64_t)bottom + reach) / size;
+    firstX = (firstX < 0) ? 0 : firstX;
+    firstY = (firstY < 0) ? 0 : firstY;
+    lastX = (lastX >= levelView->tilesAcross) ? (int64_t)levelView->tilesAcross - 1 : lastX;
+    lastY = (lastY >= levelView->tilesDown) ? (int64_t)levelView->tilesDown - 1 : lastY;
+
+    size_t found = 0;
+    for (int64_t tileY = firstY; tileY <= lastY; tileY++) {
+        for (int64_t tileX = firstX; tileX <= lastX; tileX++) {
+            uint32_t index = (uint32_t)(tileY * levelView->tilesAcross + tileX);
+            PyramidTile tile = pyramidTileAt(view, level, index);
+            if (tile.count == 0 || tile.maxX < left || tile.minX > right || tile.maxY < top || tile.minY > bottom) {
+                continue;
+            }
+            if (found < capacity) {
+                tiles[found] = index;
+            }
+            found++;
+        }
+    }
+    return found;
+}
+
+// Function to get a line of a level. Returns false if its color is not in the palette.
+bool pyramidLineAt(const PyramidView *view, uint32_t level, uint32_t index, LineRecord *line) {
+    const unsigned char *record = view->levels[level].lines + (size_t)index * PYRAMIDFILE_LINE_SIZE;
+    uint32_t color = getUint32(record + 16);
+    if (color >= view->paletteCount) {
+        return false;
+    }
+    *line = (LineRecord){(int32_t)getUint32(record), (int32_t)getUint32(record + 4), (int32_t)getUint32(record + 8),
+                         (int32_t)getUint32(record + 12), view->palette[4 * color], view->palette[4 * color + 1], view->palette[4 * color + 2]};
+    return true;
+}
+
+// Function to release a pyramid view and its mapping.
+void closePyramidView(PyramidView *view) {
+    if (view->mapping) {
+        munmap(view->mapping, view->mappingSize);
+    }
+    free(view->levels);
+    memset(view, 0, sizeof(PyramidView));
+}
+
+// Read the next chunk of a column, or of the JSON text. Returns false at the end of it or on an error.
+static bool refillChunk(LineReader *reader, int column) {
+    uint64_t remaining = reader->ends[column] - reader->offsets[column];
+    if (remaining == 0 || reader->failed) {
+        return false;
+    }
+
+    size_t size = (remaining < LINEREADER_CHUNK_SIZE) ? (size_t)remaining : LINEREADER_CHUNK_SIZE;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = pread(reader->fd, reader->chunks[column] + done, size - done, (off_t)(reader->offsets[column] + done));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            fprintf(stderr, "Failed to read line file.\n");
+            reader->failed = true;
+            return false;
+        }
+        done += (size_t)got;
+    }
+    reader->offsets[column] += size;
+    reader->used[column] = 0;
+    reader->filled[column] = size;
+    return true;
+}
+
+// Take the next value of a binary column. Chunks hold whole values, as they start at multiples of their width.
+static uint32_t nextColumnValue(LineReader *reader, int column, uint32_t width) {
+    if (reader->used[column] == reader->filled[column] && !refillChunk(reader, column)) {
+        reader->failed = true;
+        return 0;
+    }
+    const unsigned char *in = reader->chunks[column] + reader->used[column];
+    reader->used[column] += width;
+    switch (width) {
+        case 1: return in[0];
+        case 2: return in[0] | ((uint32_t)in[1] << 8);
+        default: return getUint32(in);
+    }
+}
+
+// Take the next byte of JSON text, or -1 at the end. The byte just taken can be put back by stepping used back.
+static int nextJSONByte(LineReader *reader) {
+    if (reader->used[0] == reader->filled[0] && !refillChunk(reader, 0)) {
+        return -1;
+    }
+    return reader->chunks[0][reader->used[0]++];
+}
+
+static bool isJSONSpace(int c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Tokenize JSON text up to the end of the next line object, the way viewJSON does for a whole mapping.
+static bool readJSONRecord(LineReader *reader, LineRecord *line) {
+    LineRecord current = {0};
+    int c;
+
+    // Until a version says otherwise the lines hold the row in X, as in a bare array.
+    if (reader->lineDepth == 0) {
+        while (isJSONSpace(c = nextJSONByte(reader))) {
+        }
+        reader->used[0] -= (c >= 0);
+        reader->lineDepth = (c == '{') ? 3 : 2;
+        reader->xColumn = 1;
+    }
+
+    while ((c = nextJSONByte(reader)) >= 0) {
+        if (c == '{') {
+            if (++reader->depth == reader->lineDepth) {
+                current = (LineRecord){0};
+            }
+        } else if (c == '}') {
+            // Closing a line object, which sits inside the array of lines.
+            if (reader->depth-- == reader->lineDepth) {
+                *line = reader->xColumn ? (LineRecord){current.startY, current.startX, current.endY, current.endX,
+                                                       current.r, current.g, current.b}
+                                        : current;
+                return true;
+            }
+        } else if (c == '[') {
+            reader->depth++;
+        } else if (c == ']') {
+            reader->depth--;
+        } else if (c == '"') {
+            char key[8];
+            size_t keyLength = 0;
+            while ((c = nextJSONByte(reader)) >= 0 && c != '"') {
+                if (keyLength < sizeof(key)) {
+                    key[keyLength] = (char)c;
+                }
+                keyLength++;
+                if (c == '\\' && nextJSONByte(reader) >= 0) {
+                    keyLength++;
+                }
+            }
+
+            // A string followed by a colon is a key; only numeric values are of interest.
+            while (isJSONSpace(c = nextJSONByte(reader))) {
+            }
+            if (c != ':') {
+                reader->used[0] -= (c >= 0);
+                continue;
+            }
+            while (isJSONSpace(c = nextJSONByte(reader))) {
+            }
+            if (c != '-' && !(c >= '0' && c <= '9')) {
+                reader->used[0] -= (c >= 0);
+                continue;
+            }
+
+            bool negative = (c == '-');
+            int64_t result = 0;
+            if (negative) {
+                c = nextJSONByte(reader);
+            }
+            for (; c >= '0' && c <= '9'; c = nextJSONByte(reader)) {
+                if (result < INT32_MAX) {
+                    result = result * 10 + (c - '0');
+                }
+            }
+            while ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '-' || c == '+') {
+                c = nextJSONByte(reader);
+            }
+            reader->used[0] -= (c >= 0);
+
+            if (result > INT32_MAX) {
+                result = INT32_MAX;
+            }
+            int32_t number = (int32_t)(negative ? -result : result);
+
+            if (reader->depth == 1 && reader->lineDepth == 3) {
+                if (keyLength == 7 && memcmp(key, "version", 7) == 0) {
+                    if (number != LINEFILE_VERSION && number != LINEFILE_ROW_FIRST_VERSION) {
+                        fprintf(stderr, "Not a line file: unknown JSON version %d\n", (int)number);
+                        reader->failed = true;
+                        return false;
+                    }
+                    reader->xColumn = (number == LINEFILE_ROW_FIRST_VERSION) ? 1 : 0;
+                }
+            } else if (keyLength == 6 && memcmp(key, "startX", 6) == 0) current.startX = number;
+            else if (keyLength == 6 && memcmp(key, "startY", 6) == 0) current.startY = number;
+            else if (keyLength == 4 && memcmp(key, "endX", 4) == 0) current.endX = number;
+            else if (keyLength == 4 && memcmp(key, "endY", 4) == 0) current.endY = number;
+            else if (keyLength == 1 && key[0] == 'r') current.r = (uint8_t)number;
+            else if (keyLength == 1 && key[0] == 'g') current.g = (uint8_t)number;
+            else if (keyLength == 1 && key[0] == 'b') current.b = (uint8_t)number;
+        }
+    }
+
+    return false;
+}
+
+// Function to open a line file, binary or JSON, for reading one line at a time.
+bool openLineReader(LineReader *reader, const char *filename) {
+    memset(reader, 0, sizeof(LineReader));
+    reader->fd = open(filename, O_RDONLY);
+    struct stat status;
+    if (reader->fd < 0 || fstat(reader->fd, &status) != 0) {
+        fprintf(stderr, "Failed to open line file %s\n", filename);
+        if (reader->fd >= 0) {
+            close(reader->fd);
+        }
+        return false;
+    }
+
+    uint64_t size = (uint64_t)status.st_size;
+    unsigned char header[LINEFILE_HEADER_SIZE];
+    reader->json = size < 4 || pread(reader->fd, header, 4, 0) != 4 || memcmp(header, LINEFILE_MAGIC, 4) != 0;
+
+    if (reader->json) {
+        reader->chunks[0] = malloc(LINEREADER_CHUNK_SIZE);
+        reader->ends[0] = size;
+        if (!reader->chunks[0]) {
+            fprintf(stderr, "Memory allocation failed\n");
+            closeLineReader(reader);
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t version = (size < LINEFILE_HEADER_SIZE || pread(reader->fd, header, LINEFILE_HEADER_SIZE, 0) != LINEFILE_HEADER_SIZE)
+                           ? 0 : getUint32(header + 4);
+    reader->count = (version == 0) ? 0 : getUint32(header + 8);
+    reader->paletteCount = (version == 0) ? 0 : getUint32(header + 12);
+    reader->indexBytes = (version == 0) ? 0 : getUint32(header + 16);
+    if ((version != LINEFILE_VERSION && version != LINEFILE_ROW_FIRST_VERSION) ||
+        (reader->indexBytes != 1 && reader->indexBytes != 2 && reader->indexBytes != 4)) {
+        fprintf(stderr, "Not a line file: %s\n", filename);
+        closeLineReader(reader);
+        return false;
+    }
+    uint64_t columns = LINEFILE_HEADER_SIZE + (uint64_t)reader->paletteCount * 4;
+    if (size < columns + (uint64_t)reader->count * (16 + reader->indexBytes)) {
+        fprintf(stderr, "Truncated line file: %s\n", filename);
+        closeLineReader(reader);
+        return false;
+    }
+
+    // Older files list the row columns first.
+    reader->xColumn = (version == LINEFILE_ROW_FIRST_VERSION) ? 1 : 0;
+    reader->palette = malloc((size_t)reader->paletteCount * 4 + 1);
+    bool result = reader->palette && pread(reader->fd, reader->palette, (size_t)reader->paletteCount * 4, LINEFILE_HEADER_SIZE) ==
+                                         (ssize_t)reader->paletteCount * 4;
+    for (int column = 0; column < 5; column++) {
+        uint64_t width = (column < 4) ? 4 : reader->indexBytes;
+        reader->offsets[column] = columns + 4 * (uint64_t)column * reader->count;
+        reader->ends[column] = reader->offsets[column] + width * reader->count;
+        reader->chunks[column] = malloc(LINEREADER_CHUNK_SIZE);
+        result = result && reader->chunks[column];
+    }
+    if (!result) {
+        fprintf(stderr, "Failed to read line file %s\n", filename);
+        closeLineReader(reader);
+    }
+    return result;
+}
+
+// Function to read the next line. Returns false after the last line, or on an error, which sets failed.
+bool readLineRecord(LineReader *reader, LineRecord *line) {
+    if (reader->failed) {
+        return false;
+    }
+    if (reader->json) {
+        bool result = readJSONRecord(reader, line);
+        reader->read += result;
+        return result;
+    }
+    if (reader->read == reader->count) {
+        return false;
+    }
+
+    uint32_t values[4];
+    for (int column = 0; column < 4; column++) {
+        values[column] = nextColumnValue(reader, column, 4);
+    }
+    uint32_t index = nextColumnValue(reader, 4, reader->indexBytes);
+    if (reader->failed) {
+        return false;
+    }
+    if (index >= reader->paletteCount) {
+        fprintf(stderr, "Bad color index in line file\n");
+        reader->failed = true;
+        return false;
+    }
+
+    int x = reader->xColumn;
+    int y = 1 - x;
+    *line = (LineRecord){(int32_t)values[x], (int32_t)values[y], (int32_t)values[2 + x], (int32_t)values[2 + y],
+                         reader->palette[4 * index], reader->palette[4 * index + 1], reader->palette[4 * index + 2]};
+    reader->read++;
+    return true;
+}
+
+// Function to close a line reader.
+void closeLineReader(LineReader *reader) {
+    if (reader->fd >= 0) {
+        close(reader->fd);
+    }
+    for (int column = 0; column < 5; column++) {
+        free(reader->chunks[column]);
+    }
+    free(reader->palette);
+    memset(reader, 0, sizeof(LineReader));
+    reader->fd = -1;
+}
+
+// Room for the longest line object in either layout, with its separator.
+#define LINEJSON_RECORD_MAX 256
+
+#define PUT_LITERAL(out, text) (memcpy((out), (text), sizeof(text) - 1), (out) + sizeof(text) - 1)
+
+static const char digitPairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Format a decimal integer in place, two digits at a time. Returns the position after the last digit.
+static char *putInt(char *out, int32_t value) {
+    uint32_t magnitude = (uint32_t)value;
+    if (value < 0) {
+        *out++ = '-';
+        magnitude = 0u - magnitude;
+    }
+
+    int length = 1;
+    for (uint32_t bound = 10; length < 10 && magnitude >= bound; bound *= 10) {
+        length++;
+    }
+
+    char *p = out + length;
+    while (magnitude >= 100) {
+        uint32_t pair = magnitude % 100;
+        magnitude /= 100;
+        p -= 2;
+        p[0] = digitPairs[2 * pair];
+        p[1] = digitPairs[2 * pair + 1];
+    }
+    if (magnitude >= 10) {
+        p[-2] = digitPairs[2 * magnitude];
+        p[-1] = digitPairs[2 * magnitude + 1];
+    } else {
+        p[-1] = (char)('0' + magnitude);
+    }
+    return out + length;
+}
+
+// Format a color channel, which is never more than three digits.
+static char *putByte(char *out, uint8_t value) {
+    if (value >= 100) {
+        out[0] = (char)('0' + value / 100);
+        out[1] = digitPairs[2 * (value % 100)];
+        out[2] = digitPairs[2 * (value % 100) + 1];
+        return out + 3;
+    }
+    if (value >= 10) {
+        out[0] = digitPairs[2 * value];
+        out[1] = digitPairs[2 * value + 1];
+        return out + 2;
+    }
+    out[0] = (char)('0' + value);
+    return out + 1;
+}
+
+// Hand the buffered text to the file.
+static void flushLineJSON(LineJSONWriter *writer) {
+    if (writer->used && fwrite(writer->buffer, 1, writer->used, writer->file) != writer->used) {
+        writer->failed = true;
+    }
+    writer->used = 0;
+}
+
+// Function to start a JSON array of lines in a new file, bare or in the versioned wrapper.
+bool openLineJSON(LineJSONWriter *writer, const char *filename, bool compact, bool versioned) {
+    memset(writer, 0, sizeof(LineJSONWriter));
+    writer->compact = compact;
+    writer->versioned = versioned;
+    writer->buffer = malloc(LINEJSON_BUFFER_SIZE);
+    writer->file = writer->buffer ? fopen(filename, "w") : NULL;
+    if (!writer->file) {
+        fprintf(stderr, "Failed to open JSON file for writing.\n");
+        free(writer->buffer);
+        writer->buffer = NULL;
+        return false;
+    }
+
+    char *out = writer->buffer;
+    if (versioned) {
+        out = PUT_LITERAL(out, "{\"version\": ");
+        out = putInt(out, LINEFILE_VERSION);
+        out = PUT_LITERAL(out, ", \"lines\": ");
+    }
+    out = PUT_LITERAL(out, "[\n");
+    writer->used = (size_t)(out - writer->buffer);
+    return true;
+}
+
+// Function to add a line to the array, flushing the buffer to the file when it is full.
+void appendLineJSON(LineJSONWriter *writer, LineRecord line) {
+    if (writer->used + LINEJSON_RECORD_MAX > LINEJSON_BUFFER_SIZE) {
+        flushLineJSON(writer);
+    }
+
+    // A bare array holds the row in X.
+    if (!writer->versioned) {
+        line = (LineRecord){line.startY, line.startX, line.endY, line.endX, line.r, line.g, line.b};
+    }
+
+    char *out = writer->buffer + writer->used;
+    if (writer->count++ > 0) {
+        out = PUT_LITERAL(out, ",\n");
+    }
+
+    if (writer->compact) {
+        out = PUT_LITERAL(out, "{\"startX\":");
+        out = putInt(out, line.startX);
+        out = PUT_LITERAL(out, ",\"startY\":");
+        out = putInt(out, line.startY);
+        out = PUT_LITERAL(out, ",\"endX\":");
+        out = putInt(out, line.endX);
+        out = PUT_LITERAL(out, ",\"endY\":");
+        out = putInt(out, line.endY);
+        out = PUT_LITERAL(out, ",\"color\":{\"r\":");
+        out = putByte(out, line.r);
+        out = PUT_LITERAL(out, ",\"g\":");
+        out = putByte(out, line.g);
+        out = PUT_LITERAL(out, ",\"b\":");
+        out = putByte(out, line.b);
+        out = PUT_LITERAL(out, "}}");
+    } else {
+        out = PUT_LITERAL(out, "  {\n    \"startX\": ");
+        out = putInt(out, line.startX);
+        out = PUT_LITERAL(out, ",\n    \"startY\": ");
+        out = putInt(out, line.startY);
+        out = PUT_LITERAL(out, ",\n    \"endX\": ");
+        out = putInt(out, line.endX);
+        out = PUT_LITERAL(out, ",\n    \"endY\": ");
+        out = putInt(out, line.endY);
+        out = PUT_LITERAL(out, ",\n    \"color\": {\"r\": ");
+        out = putByte(out, line.r);
+        out = PUT_LITERAL(out, ", \"g\": ");
+        out = putByte(out, line.g);
+        out = PUT_LITERAL(out, ", \"b\": ");
+        out = putByte(out, line.b);
+        out = PUT_LITERAL(out, "}\n  }");
+    }
+    writer->used = (size_t)(out - writer->buffer);
+}
+
+// Function to end the array, and the wrapper of a versioned file, and close the file. Returns false if any of the output failed.
+bool closeLineJSON(LineJSONWriter *writer) {
+    if (!writer->file) {
+        return false;
+    }
+
+    char *out = writer->buffer + writer->used;
+    if (writer->count > 0) {
+        out = PUT_LITERAL(out, "\n");
+    }
+    out = writer->versioned ? PUT_LITERAL(out, "]}\n") : PUT_LITERAL(out, "]\n");
+    writer->used = (size_t)(out - writer->buffer);
+    flushLineJSON(writer);
+
+    bool result = !writer->failed;
+    if (fclose(writer->file) != 0) {
+        result = false;
+    }
+    if (!result) {
+        fprintf(stderr, "Failed to write JSON file.\n");
+    }
+    free(writer->buffer);
+    memset(writer, 0, sizeof(LineJSONWriter));
+    return result;
+}
+
+// Function to write an array of lines to a JSON file.
+bool writeLineJSON(const char *filename, const LineRecord *lines, size_t lineCount, bool compact, bool versioned) {
+    LineJSONWriter writer;
+    if (!openLineJSON(&writer, filename, compact, versioned)) {
+        return false;
+    }
+    for (size_t i = 0; i < lineCount; i++) {
+        appendLineJSON(&writer, lines[i]);
+    }
+    return closeLineJSON(&writer);
+}
@@ -0,0 +1,299 @@
+/****************************************************************
+
+    linefile.h - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef linefile_h
+#define linefile_h
+
+/*
+ Binary line file, all values little-endian:
+
+   header   "CLIN", version, line count, palette count, index bytes, reserved (32 bytes)
+   palette  palette count entries of r, g, b, 0
+   columns  startX[count], startY[count], endX[count], endY[count] as int32
+            colorIndex[count] as 1, 2 or 4 byte palette indices
+
+ The palette is seeded with the top colors of the map, so the color column is usually one byte.
+ X is the image column and Y the row. Version 1 files held the row in X and are read swapped.
+ */
+
+#define LINEFILE_MAGIC "CLIN"
+#define LINEFILE_VERSION 2
+#define LINEFILE_ROW_FIRST_VERSION 1 // Last version that stored the row in X
+#define LINEFILE_HEADER_SIZE 32
+#define LINEFILE_EXTENSION ".lines"
+
+/*
+ JSON line file, written pretty or compact, as a bare array of line objects with the row in X:
+
+   [
+     {"startX": 4, "startY": 10, "endX": 4, "endY": 18, "color": {"r": 0, "g": 0, "b": 255}},
+     ...
+   ]
+
+ This is the layout the tools have always exported, so other readers of it keep working; the lines
+ are swapped on the way out and back in. The versioned layout, written on request, wraps the array
+ and holds the column in X as the binary file does:
+
+   {"version": 2, "lines": [
+     {"startX": 10, "startY": 4, "endX": 18, "endY": 4, "color": {"r": 0, "g": 0, "b": 255}},
+     ...
+   ]}
+
+ The version is the binary one and comes before the lines, so a streaming reader knows the axis order
+ before the first line. Version 1 is read with the row in X, like a bare array.
+ */
+
+/*
+ Binary span file, written by the span extraction, in the same layout as a line file except:
+
+   header   "CSPN", version, strip count, palette count, index bytes, image width, image height, reserved
+   columns  left[count], top[count], right[count], bottom[count] as int32, then the color indices
+
+ Each strip is a rectangle of one color with inclusive corners, so every non-white pixel of the map
+ is covered by exactly one strip and the rest of the image is white.
+ */
+
+#define SPANFILE_MAGIC "CSPN"
+#define SPANFILE_VERSION 1
+#define SPANFILE_EXTENSION ".spans"
+
+// A line as stored in a line file.
+typedef struct {
+    int32_t startX, startY;
+    int32_t endX, endY;
+    uint8_t r, g, b;
+} LineRecord;
+
+// A strip as stored in a span file: the start is its top-left pixel and the end its bottom-right.
+typedef LineRecord SpanRecord;
+
+// A read-only view of a line file, binary or JSON, or of a span file, mapped into memory.
+// Binary columns are used in place; JSON is tokenized once into records.
+typedef struct {
+    void *mapping;
+    size_t mappingSize;
+    size_t count;
+    const int32_t *startX, *startY; // Binary columns, on little-endian hosts.
+    const int32_t *endX, *endY;
+    const uint8_t *colorIndex;
+    uint32_t indexBytes;
+    const uint8_t *palette;
+    uint32_t paletteCount;
+    LineRecord *records;            // Parsed lines, for JSON and big-endian hosts.
+    uint32_t width, height;         // Image size, for span files.
+} LineView;
+
+bool openLineView(const char *filename, LineView *view);
+
+LineRecord lineViewAt(const LineView *view, size_t index);
+
+void closeLineView(LineView *view);
+
+bool isLineFileName(const char *filename);
+
+bool isLineFile(const char *filename);
+
+bool writeLineFile(const char *filename, const LineRecord *lines, size_t lineCount, const uint32_t *seedColors, size_t seedCount);
+
+LineRecord *readLineFile(const char *filename, size_t *lineCount);
+
+bool isSpanFileName(const char *filename);
+
+bool isSpanFile(const char *filename);
+
+bool writeSpanFile(const char *filename, const SpanRecord *spans, size_t spanCount, const uint32_t *seedColors, size_t seedCount,
+                   uint32_t width, uint32_t height);
+
+bool openSpanView(const char *filename, LineView *view);
+
+/*
+ Line pyramid file, a set of progressively simplified line sets with a tile index for each:
+
+   header   "CLOD", version, level count, tile size, image width, image height, palette count, reserved
+   palette  palette count entries of r, g, b, 0
+   levels   level count entries of scale, line count, tiles across, tiles down, reach, reserved,
+            tile table offset and line offset as 64-bit values (40 bytes)
+   then for each level
+   tiles    tiles across * tiles down entries of first line, line count, minX, minY, maxX, maxY (24 bytes)
+   lines    line count records of startX, startY, endX, endY as int32 and a 32-bit palette index
+
+ Level coordinates are image pixels divided by the level's scale. Each line belongs to the tile, in
+ row-major order, that holds its midpoint, and the lines of a tile are stored together. A tile's bounds
+ cover all of its lines, so they may reach past the tile by up to the level's reach, in pixels.
+ */
+
+#define PYRAMIDFILE_MAGIC "CLOD"
+#define PYRAMIDFILE_VERSION 1
+#define PYRAMIDFILE_EXTENSION ".lod"
+#define PYRAMIDFILE_LEVEL_SIZE 40
+#define PYRAMIDFILE_TILE_SIZE 24
+#define PYRAMIDFILE_LINE_SIZE 20
+
+// A level handed to writePyramidFile, in level coordinates.
+typedef struct {
+    uint32_t scale;
+    const LineRecord *lines;
+    size_t count;
+} PyramidLevel;
+
+// A level as read from a pyramid file.
+typedef struct {
+    uint32_t scale;
+    uint32_t lineCount;
+    uint32_t tilesAcross, tilesDown;
+    uint32_t reach;
+    const uint8_t *tiles;
+    const uint8_t *lines;
+} PyramidLevelView;
+
+// A tile of a level: its run of lines and the bounds they cover, inclusive.
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+    int32_t minX, minY, maxX, maxY;
+} PyramidTile;
+
+// A read-only view of a pyramid file, mapped into memory so that only the tiles used are read.
+typedef struct {
+    void *mapping;
+    size_t mappingSize;
+    uint32_t levelCount;
+    uint32_t tileSize;
+    uint32_t width, height;
+    uint32_t paletteCount;
+    const uint8_t *palette;
+    PyramidLevelView *levels;
+} PyramidView;
+
+bool isPyramidFileName(const char *filename);
+
+bool isPyramidFile(const char *filename);
+
+bool writePyramidFile(const char *filename, const PyramidLevel *levels, uint32_t levelCount, uint32_t tileSize,
+                      uint32_t width, uint32_t height, const uint32_t *seedColors, size_t seedCount);
+
+bool openPyramidView(const char *filename, PyramidView *view);
+
+uint32_t pyramidLevelForScale(const PyramidView *view, double scale);
+
+PyramidTile pyramidTileAt(const PyramidView *view, uint32_t level, uint32_t tile);
+
+size_t pyramidTilesInView(const PyramidView *view, uint32_t level, int32_t left, int32_t top, int32_t right, int32_t bottom,
+                          uint32_t *tiles, size_t capacity);
+
+bool pyramidLineAt(const PyramidView *view, uint32_t level, uint32_t index, LineRecord *line);
+
+void closePyramidView(PyramidView *view);
+
+// Sequential reading of a line file, binary or JSON, one line at a time in constant memory.
+// Each binary column is read through its own chunk of the file; JSON is tokenized as it arrives.
+#define LINEREADER_CHUNK_SIZE (64 << 10)
+
+typedef struct {
+    int fd;
+    bool json;
+    bool failed;
+    size_t count;                   // Lines in a binary file.
+    size_t read;                    // Lines read so far.
+    uint32_t indexBytes;
+    uint32_t paletteCount;
+    uint8_t *palette;
+    int xColumn;                    // 1 for files that store the row first.
+    int depth;                      // JSON nesting depth.
+    int lineDepth;                  // Depth of the JSON line objects, 3 in a versioned file and 2 in a bare array.
+    unsigned char *chunks[5];       // Chunks of the binary columns, or of the JSON text in the first.
+    size_t used[5], filled[5];
+    uint64_t offsets[5], ends[5];   // Next and end file offsets of each column.
+} LineReader;
+
+bool openLineReader(LineReader *reader, const char *filename);
+
+bool readLineRecord(LineReader *reader, LineRecord *line);
+
+void closeLineReader(LineReader *reader);
+
+// Appending lines to a binary line file one at a time, in constant memory. The columns are spooled
+// to temporary files, a block of lines at a time, and copied in behind the header and palette when
+// the writer is closed.
+#define LINEFILE_SPOOL_LINES 4096
+
+typedef struct {
+    FILE *file;
+    FILE *columns[5];
+    uint32_t *staged;               // LINEFILE_SPOOL_LINES values for each column, little-endian.
+    size_t stagedCount;
+    uint32_t *mapColors, *mapIndices;
+    uint32_t mapMask;
+    uint32_t *palette;
+    uint32_t paletteCount;
+    size_t count;
+    bool failed;
+} LineFileWriter;
+
+bool openLineFile(LineFileWriter *writer, const char *filename, const uint32_t *seedColors, size_t seedCount);
+
+void appendLineFile(LineFileWriter *writer, LineRecord line);
+
+bool closeLineFile(LineFileWriter *writer);
+
+// Buffered JSON output of lines. Each line is formatted by hand into a large buffer that goes to the
+// file in one write when full or closed, instead of through a run of fprintf calls. Pretty output
+// indents each line object over several rows; compact output puts each on one row.
+#define LINEJSON_BUFFER_SIZE (8 << 20)
+
+typedef struct {
+    FILE *file;
+    char *buffer;
+    size_t used;
+    size_t count;
+    bool compact;
+    bool versioned;
+    bool failed;
+} LineJSONWriter;
+
+bool openLineJSON(LineJSONWriter *writer, const char *filename, bool compact, bool versioned);
+
+void appendLineJSON(LineJSONWriter *writer, LineRecord line);
+
+bool closeLineJSON(LineJSONWriter *writer);
+
+bool writeLineJSON(const char *filename, const LineRecord *lines, size_t lineCount, bool compact, bool versioned);
+
+#endif /* linefile_h */
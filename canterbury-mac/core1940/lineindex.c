@@ -0,0 +1,434 @@
+/****************************************************************
+
+    lineindex.c - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include "canterbury.h"
+
+#define BLOCK LINEINDEX_NODE_SIZE
+
+// The bit of each place in a block, so tests across a block reduce to a mask the compiler can vectorize.
+static const uint32_t blockBits[BLOCK] = {1u << 0, 1u << 1, 1u << 2,  1u << 3,  1u << 4,  1u << 5,  1u << 6,  1u << 7,
+                                          1u << 8, 1u << 9, 1u << 10, 1u << 11, 1u << 12, 1u << 13, 1u << 14, 1u << 15};
+
+static uint32_t packColor(RGB color) {
+    return ((uint32_t)color.r << 16) | ((uint32_t)color.g << 8) | color.b;
+}
+
+// The bit of a node's color mask standing for a color.
+static uint64_t colorBit(uint32_t color) {
+    return 1ull << ((color * 0x9E3779B1u) >> 26);
+}
+
+// Distance along a Hilbert curve filling a 65536 by 65536 grid.
+static uint32_t hilbertIndex(uint32_t x, uint32_t y) {
+    uint32_t d = 0;
+    for (uint32_t s = 1u << 15; s > 0; s >>= 1) {
+        uint32_t rx = (x & s) ? 1 : 0;
+        uint32_t ry = (y & s) ? 1 : 0;
+        d += s * s * ((3 * rx) ^ ry);
+
+        // Turn the quadrant so the curve inside it starts and ends where the next level needs.
+        if (ry == 0) {
+            if (rx == 1) {
+                x = 0xFFFF - x;
+                y = 0xFFFF - y;
+            }
+            uint32_t swap = x;
+            x = y;
+            y = swap;
+        }
+    }
+    return d;
+}
+
+// Function to sort keys by their upper 32 bits, eight bits a pass, keeping ties in order.
+static void sortByUpperHalf(uint64_t *keys, uint64_t *scratch, size_t count) {
+    for (int shift = 32; shift < 64; shift += 8) {
+        size_t offsets[257] = {0};
+        for (size_t i = 0; i < count; i++) {
+            offsets[((keys[i] >> shift) & 0xFF) + 1]++;
+        }
+        for (int digit = 0; digit < 256; digit++) {
+            offsets[digit + 1] += offsets[digit];
+        }
+        for (size_t i = 0; i < count; i++) {
+            scratch[offsets[(keys[i] >> shift) & 0xFF]++] = keys[i];
+        }
+        uint64_t *swap = keys;
+        keys = scratch;
+        scratch = swap;
+    }
+}
+
+// Function to store a box at a slot of a run of blocks.
+static void putBox(int32_t *blocks, size_t slot, const int32_t box[4]) {
+    int32_t *block = blocks + 4 * (slot - slot % BLOCK) + slot % BLOCK;
+    for (int k = 0; k < 4; k++) {
+        block[k * BLOCK] = box[k];
+    }
+}
+
+// Function to fill a run of blocks with empty boxes. They are never searched, as the slots past the end of
+// a level are masked off, but keep the boxes of the nodes above them tight.
+static void clearBoxes(int32_t *blocks, size_t slots) {
+    for (size_t slot = 0; slot < slots; slot++) {
+        int32_t box[4] = {INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN};
+        putBox(blocks, slot, box);
+    }
+}
+
+// A bit for each slot of the block starting at first that holds one of the count boxes of its level.
+static uint32_t filledSlots(size_t count, size_t first) {
+    size_t filled = count - first;
+    return (filled >= BLOCK) ? (uint32_t)((1ull << BLOCK) - 1) : (uint32_t)((1ull << filled) - 1);
+}
+
+// A bit for each box of a block that overlaps a rectangle.
+static uint32_t overlappingBoxes(const int32_t *block, int left, int top, int right, int bottom) {
+    uint32_t hits = 0;
+    for (int k = 0; k < BLOCK; k++) {
+        hits |= blockBits[k] & -(uint32_t)((block[k] <= right) & (block[BLOCK + k] <= bottom) &
+                                           (block[2 * BLOCK + k] >= left) & (block[3 * BLOCK + k] >= top));
+    }
+    return hits;
+}
+
+// Function to bulk load an index over lines. The lines are copied, so the array can be freed afterwards.
+bool lineIndexBuild(LineIndex *index, const LineInfo *lines, size_t lineCount) {
+    memset(index, 0, sizeof(LineIndex));
+    if (lineCount > UINT32_MAX) {
+        fprintf(stderr, "Too many lines for a line index.\n");
+        return false;
+    }
+
+    size_t lineSlots = (lineCount + BLOCK - 1) / BLOCK * BLOCK;
+    size_t nodeSlots = 0;
+    size_t levelSize = lineSlots / BLOCK;
+    while (levelSize > 0) {
+        index->levelNodes[index->levelCount] = levelSize;
+        index->levelStart[index->levelCount++] = nodeSlots;
+        nodeSlots += (levelSize + BLOCK - 1) / BLOCK * BLOCK;
+        levelSize = (levelSize > BLOCK) ? (levelSize + BLOCK - 1) / BLOCK : 0;
+    }
+    index->levelStart[index->levelCount] = nodeSlots;
+
+    index->count = lineCount;
+    index->lineBoxes = malloc(lineSlots * 4 * sizeof(int32_t) + 1);
+    index->reversed = calloc(lineSlots / BLOCK + 1, sizeof(uint32_t));
+    index->colors = calloc(lineSlots + 1, sizeof(uint32_t));
+    index->ids = calloc(lineSlots + 1, sizeof(uint32_t));
+    index->boxes = malloc(nodeSlots * 4 * sizeof(int32_t) + 1);
+    index->colorMasks = calloc(nodeSlots + 1, sizeof(uint64_t));
+    uint64_t *keys = malloc(lineCount * sizeof(uint64_t) + 1);
+    uint64_t *scratch = malloc(lineCount * sizeof(uint64_t) + 1);
+    if (!index->lineBoxes || !index->reversed || !index->colors || !index->ids || !index->boxes || !index->colorMasks ||
+        !keys || !scratch) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(scratch);
+        free(keys);
+        lineIndexFree(index);
+        return false;
+    }
+
+    // Place each centre, doubled to stay whole, on the curve's grid across the extent of all of them.
+    int64_t minX = INT64_MAX, minY = INT64_MAX, maxX = INT64_MIN, maxY = INT64_MIN;
+    for (size_t i = 0; i < lineCount; i++) {
+        int64_t x = (int64_t)lines[i].startX + lines[i].endX;
+        int64_t y = (int64_t)lines[i].startY + lines[i].endY;
+        minX = (x < minX) ? x : minX;
+        minY = (y < minY) ? y : minY;
+        maxX = (x > maxX) ? x : maxX;
+        maxY = (y > maxY) ? y : maxY;
+    }
+    double scaleX = (maxX > minX) ? 65535.0 / (double)(maxX - minX) : 0.0;
+    double scaleY = (maxY > minY) ? 65535.0 / (double)(maxY - minY) : 0.0;
+    for (size_t i = 0; i < lineCount; i++) {
+        uint32_t x = (uint32_t)(((int64_t)lines[i].startX + lines[i].endX - minX) * scaleX);
+        uint32_t y = (uint32_t)(((int64_t)lines[i].startY + lines[i].endY - minY) * scaleY);
+        keys[i] = ((uint64_t)hilbertIndex(x, y) << 32) | i;
+    }
+    sortByUpperHalf(keys, scratch, lineCount);
+
+    clearBoxes(index->lineBoxes, lineSlots);
+    clearBoxes(index->boxes, nodeSlots);
+    for (size_t i = 0; i < lineCount; i++) {
+        const LineInfo *line = &lines[(uint32_t)keys[i]];
+        int32_t box[4] = {(line->startX < line->endX) ? line->startX : line->endX,
+                          (line->startY < line->endY) ? line->startY : line->endY,
+                          (line->startX > line->endX) ? line->startX : line->endX,
+                          (line->startY > line->endY) ? line->startY : line->endY};
+        putBox(index->lineBoxes, i, box);
+        if ((line->startX < line->endX) != (line->startY < line->endY) && line->startX != line->endX &&
+            line->startY != line->endY) {
+            index->reversed[i / BLOCK] |= blockBits[i % BLOCK];
+        }
+        index->colors[i] = packColor(line->color);
+        index->ids[i] = (uint32_t)keys[i];
+    }
+    free(scratch);
+    free(keys);
+
+    // Each node covers one block of the level below, whose slots past the end stay empty.
+    const int32_t *childBoxes = index->lineBoxes;
+    size_t childCount = lineCount;
+    for (int level = 0; level < index->levelCount; level++) {
+        for (size_t node = 0; node * BLOCK < childCount; node++) {
+            const int32_t *block = childBoxes + 4 * BLOCK * node;
+            int32_t box[4] = {INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN};
+            uint64_t mask = 0;
+            for (int k = 0; k < BLOCK && node * BLOCK + k < childCount; k++) {
+                box[0] = (block[k] < box[0]) ? block[k] : box[0];
+                box[1] = (block[BLOCK + k] < box[1]) ? block[BLOCK + k] : box[1];
+                box[2] = (block[2 * BLOCK + k] > box[2]) ? block[2 * BLOCK + k] : box[2];
+                box[3] = (block[3 * BLOCK + k] > box[3]) ? block[3 * BLOCK + k] : box[3];
+                mask |= (level == 0) ? colorBit(index->colors[node * BLOCK + k])
+                                     : index->colorMasks[index->levelStart[level - 1] + node * BLOCK + k];
+            }
+            putBox(index->boxes, index->levelStart[level] + node, box);
+            index->colorMasks[index->levelStart[level] + node] = mask;
+        }
+        childBoxes = index->boxes + 4 * index->levelStart[level];
+        childCount = (childCount + BLOCK - 1) / BLOCK;
+    }
+    return true;
+}
+
+// Function to release an index.
+void lineIndexFree(LineIndex *index) {
+    free(index->lineBoxes);
+    free(index->reversed);
+    free(index->colors);
+    free(index->ids);
+    free(index->boxes);
+    free(index->colorMasks);
+    memset(index, 0, sizeof(LineIndex));
+}
+
+// Check whether a diagonal line meets a rectangle that its box overlaps: it does unless the corners of
+// the rectangle all lie strictly to one side of it. Far apart coordinates can overflow 64 bits in the
+// products, so the cross products are worked out in 128.
+static bool diagonalMeetsRectangle(const int32_t *block, int k, bool reversed, int left, int top, int right,
+                                   int bottom) {
+    int64_t startX = block[k];
+    int64_t startY = reversed ? block[3 * BLOCK + k] : block[BLOCK + k];
+    int64_t dx = block[2 * BLOCK + k] - startX;
+    int64_t dy = (reversed ? block[BLOCK + k] : block[3 * BLOCK + k]) - startY;
+    int64_t corners[4][2] = {{left, top}, {right, top}, {left, bottom}, {right, bottom}};
+    int sides = 0;
+    for (int c = 0; c < 4; c++) {
+        __int128 cross = (__int128)dx * (corners[c][1] - startY) - (__int128)dy * (corners[c][0] - startX);
+        sides |= (cross > 0) ? 1 : (cross < 0) ? 2 : 3;
+    }
+    return sides == 3;
+}
+
+// Function to find the lines that meet a rectangle, inclusive of its edges, optionally of one color only.
+// Up to capacity of their positions in the array the index was built from are stored, in no particular
+// order; the number of lines found is returned.
+size_t lineIndexSearch(const LineIndex *index, int left, int top, int right, int bottom, const RGB *color,
+                       size_t *results, size_t capacity) {
+    if (index->count == 0 || left > right || top > bottom) {
+        return 0;
+    }
+
+    uint32_t wanted = color ? packColor(*color) : 0;
+    uint64_t colorMask = color ? colorBit(wanted) : ~0ull;
+    size_t found = 0;
+
+    // Blocks still to test, by level, with -1 for blocks of lines.
+    struct {
+        int level;
+        size_t block;
+    } stack[(LINEINDEX_MAX_LEVELS + 1) * BLOCK];
+    int depth = 1;
+    stack[0].level = index->levelCount - 1;
+    stack[0].block = 0;
+
+    while (depth > 0) {
+        depth--;
+        int level = stack[depth].level;
+        size_t first = stack[depth].block * BLOCK;
+
+        if (level < 0) {
+            const int32_t *block = index->lineBoxes + 4 * first;
+            uint32_t reversed = index->reversed[first / BLOCK];
+            uint32_t hits = overlappingBoxes(block, left, top, right, bottom) & filledSlots(index->count, first);
+            while (hits) {
+                int k = __builtin_ctz(hits);
+                hits &= hits - 1;
+                if (color && index->colors[first + k] != wanted) {
+                    continue;
+                }
+                if (block[k] != block[2 * BLOCK + k] && block[BLOCK + k] != block[3 * BLOCK + k] &&
+                    !diagonalMeetsRectangle(block, k, (reversed >> k) & 1, left, top, right, bottom)) {
+                    continue;
+                }
+                if (found < capacity) {
+                    results[found] = index->ids[first + k];
+                }
+                found++;
+            }
+            continue;
+        }
+
+        size_t slot = index->levelStart[level] + first;
+        uint32_t hits = overlappingBoxes(index->boxes + 4 * slot, left, top, right, bottom) &
+                        filledSlots(index->levelNodes[level], first);
+        while (hits) {
+            int k = __builtin_ctz(hits);
+            hits &= hits - 1;
+            if (index->colorMasks[slot + k] & colorMask) {
+                stack[depth].level = level - 1;
+                stack[depth].block = first + k;
+                depth++;
+            }
+        }
+    }
+    return found;
+}
+
+// The closest line found so far by a nearest search.
+typedef struct {
+    double x, y;
+    bool filtered;
+    uint32_t wanted;
+    uint64_t colorMask;
+    double bestSquared;
+    size_t best;
+} NearestSearch;
+
+// Function to search a block for lines closer than the best so far, visiting nodes nearest first and
+// skipping any whose box is already further away.
+static void nearestInBlock(const LineIndex *index, NearestSearch *search, int level, size_t first) {
+    const int32_t *block = (level < 0) ? index->lineBoxes + 4 * first : index->boxes + 4 * (index->levelStart[level] + first);
+    double x = search->x, y = search->y;
+    double distances[BLOCK];
+
+    if (level < 0) {
+        uint32_t candidates = filledSlots(index->count, first);
+        if (search->filtered) {
+            uint32_t matching = 0;
+            for (int k = 0; k < BLOCK; k++) {
+                matching |= blockBits[k] & -(uint32_t)(index->colors[first + k] == search->wanted);
+            }
+            candidates &= matching;
+            if (!candidates) {
+                return;
+            }
+        }
+
+        uint32_t reversed = index->reversed[first / BLOCK];
+        for (int k = 0; k < BLOCK; k++) {
+            int32_t flip = -(int32_t)((reversed & blockBits[k]) != 0);
+            int32_t swap = (block[BLOCK + k] ^ block[3 * BLOCK + k]) & flip;
+            double startY = block[BLOCK + k] ^ swap;
+            double dx = (double)block[2 * BLOCK + k] - block[k];
+            double dy = (block[3 * BLOCK + k] ^ swap) - startY;
+            double px = x - block[k];
+            double py = y - startY;
+            double lengthSquared = dx * dx + dy * dy;
+            double t = (px * dx + py * dy) / (lengthSquared > 0.0 ? lengthSquared : 1.0);
+            t = (t > 0.0) ? t : 0.0;
+            t = (t < 1.0) ? t : 1.0;
+            px -= t * dx;
+            py -= t * dy;
+            distances[k] = px * px + py * py;
+        }
+
+        for (; candidates; candidates &= candidates - 1) {
+            int k = __builtin_ctz(candidates);
+            if (distances[k] < search->bestSquared) {
+                search->bestSquared = distances[k];
+                search->best = first + k;
+            }
+        }
+        return;
+    }
+
+    uint32_t left = 0;
+    for (int k = 0; k < BLOCK; k++) {
+        double before = block[k] - x;
+        double after = x - block[2 * BLOCK + k];
+        double dx = (before > after) ? before : after;
+        dx = (dx > 0.0) ? dx : 0.0;
+        before = block[BLOCK + k] - y;
+        after = y - block[3 * BLOCK + k];
+        double dy = (before > after) ? before : after;
+        dy = (dy > 0.0) ? dy : 0.0;
+        distances[k] = dx * dx + dy * dy;
+        left |= blockBits[k] & -(uint32_t)(distances[k] < search->bestSquared);
+    }
+    left &= filledSlots(index->levelNodes[level], first);
+    if (search->filtered) {
+        const uint64_t *masks = index->colorMasks + index->levelStart[level] + first;
+        for (uint32_t rest = left; rest; rest &= rest - 1) {
+            int k = __builtin_ctz(rest);
+            left &= (masks[k] & search->colorMask) ? ~0u : ~blockBits[k];
+        }
+    }
+
+    // Visit the nodes in order of distance, picking the nearest left each time, until the rest are too far.
+    while (left) {
+        int nearest = __builtin_ctz(left);
+        for (uint32_t rest = left & (left - 1); rest; rest &= rest - 1) {
+            int k = __builtin_ctz(rest);
+            nearest = (distances[k] < distances[nearest]) ? k : nearest;
+        }
+        left &= ~blockBits[nearest];
+        if (distances[nearest] >= search->bestSquared) {
+            break;
+        }
+        nearestInBlock(index, search, level - 1, (first + nearest) * BLOCK);
+    }
+}
+
+// Function to find the line closest to a point, optionally of one color only. Returns false if there is
+// no such line; otherwise stores its position in the array the index was built from and its distance.
+bool lineIndexNearest(const LineIndex *index, double x, double y, const RGB *color, size_t *result, double *distance) {
+    if (index->count == 0) {
+        return false;
+    }
+
+    uint32_t wanted = color ? packColor(*color) : 0;
+    NearestSearch search = {x, y, color != NULL, wanted, color ? colorBit(wanted) : ~0ull, INFINITY, SIZE_MAX};
+    nearestInBlock(index, &search, index->levelCount - 1, 0);
+    if (search.best == SIZE_MAX) {
+        return false;
+    }
+    *result = index->ids[search.best];
+    if (distance) {
+        *distance = sqrt(search.bestSquared);
+    }
+    return true;
+}
@@ -0,0 +1,120 @@
+/****************************************************************
+
+    lineio.c - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include "canterbury.h"
+
+// Append a line to a buffer, growing it as needed.
+bool lineBufferPush(LineBuffer *buffer, LineInfo line) {
+    if (buffer->count == buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 1024;
+        LineInfo *grown = realloc(buffer->lines, capacity * sizeof(LineInfo));
+        if (!grown) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return false;
+        }
+        buffer->lines = grown;
+        buffer->capacity = capacity;
+    }
+    buffer->lines[buffer->count++] = line;
+    return true;
+}
+
+void lineBufferFree(LineBuffer *buffer) {
+    free(buffer->lines);
+    buffer->lines = NULL;
+    buffer->count = 0;
+    buffer->capacity = 0;
+}
+
+// Function to write lines as a JSON array, pretty or with one line object per row, and bare or in the
+// versioned wrapper.
+bool writeLinesToJSON(const char *filename, const LineInfo *lines, size_t lineCount, bool compact, bool versioned) {
+    LineJSONWriter writer;
+    if (!openLineJSON(&writer, filename, compact, versioned)) {
+        return false;
+    }
+    for (size_t i = 0; i < lineCount; i++) {
+        appendLineJSON(&writer, (LineRecord){lines[i].startX, lines[i].startY, lines[i].endX, lines[i].endY,
+                                             lines[i].color.r, lines[i].color.g, lines[i].color.b});
+    }
+    return closeLineJSON(&writer);
+}
+
+// Function to write lines to a file, as a binary line file if the name ends in LINEFILE_EXTENSION
+// and as JSON otherwise. The top colors seed the binary palette.
+bool writeLines(const char *filename, const LineInfo *lines, size_t lineCount, const uint32_t topColors[TOPCOLORENTRIES], bool compactJSON,
+                bool versionedJSON) {
+    if (isLineFileName(filename)) {
+        LineRecord *records = malloc(lineCount * sizeof(LineRecord) + 1);
+        if (!records) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return false;
+        }
+        for (size_t i = 0; i < lineCount; i++) {
+            records[i] = (LineRecord){lines[i].startX, lines[i].startY, lines[i].endX, lines[i].endY,
+                                      lines[i].color.r, lines[i].color.g, lines[i].color.b};
+        }
+        bool result = writeLineFile(filename, records, lineCount, topColors, topColors ? TOPCOLORENTRIES : 0);
+        free(records);
+        return result;
+    }
+
+    return writeLinesToJSON(filename, lines, lineCount, compactJSON, versionedJSON);
+}
+
+// Function to read lines from a binary line file or a JSON file into a heap array.
+LineInfo *readLines(const char *filename, size_t *lineCount) {
+    LineView view;
+    *lineCount = 0;
+
+    if (!openLineView(filename, &view)) {
+        return NULL;
+    }
+
+    LineInfo *lines = malloc(view.count * sizeof(LineInfo) + 1);
+    if (!lines) {
+        fprintf(stderr, "Memory allocation failed\n");
+        closeLineView(&view);
+        return NULL;
+    }
+    for (size_t i = 0; i < view.count; i++) {
+        LineRecord record = lineViewAt(&view, i);
+        lines[i] = (LineInfo){record.startX, record.startY, record.endX, record.endY, {{record.r, record.g, record.b}}};
+    }
+
+    *lineCount = view.count;
+    closeLineView(&view);
+    return lines;
+}
@@ -0,0 +1,501 @@
+/****************************************************************
+
+    merge.c - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include "canterbury.h"
+
+#define MERGE_NO_NODE UINT32_MAX
+
+// A line on one of the four carriers the extraction draws along: rows, columns and the two diagonals.
+// Position is where it lies across the carrier and start to end its extent along it, in pixels.
+typedef struct {
+    uint32_t color;
+    int direction; // 0 along a row, 1 down a column, 2 down and right, 3 up and right.
+    int position;
+    int start, end;
+} CarrierLine;
+
+static uint32_t packColor(RGB color) {
+    return ((uint32_t)color.r << 16) | ((uint32_t)color.g << 8) | color.b;
+}
+
+static RGB unpackColor(uint32_t color) {
+    return (RGB){{(color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF}};
+}
+
+// Put a line on its carrier, with the start at the lower coordinate. Returns false for lines in other directions.
+static bool carrierLine(LineInfo line, CarrierLine *carrier) {
+    int dx = line.endX - line.startX;
+    int dy = line.endY - line.startY;
+    if (dx < 0 || (dx == 0 && dy < 0)) {
+        dx = -dx;
+        dy = -dy;
+        int x = line.startX, y = line.startY;
+        line.startX = line.endX;
+        line.startY = line.endY;
+        line.endX = x;
+        line.endY = y;
+    }
+
+    carrier->color = packColor(line.color);
+    if (dy == 0) {
+        *carrier = (CarrierLine){carrier->color, 0, line.startY, line.startX, line.endX};
+    } else if (dx == 0) {
+        *carrier = (CarrierLine){carrier->color, 1, line.startX, line.startY, line.endY};
+    } else if (dx == dy) {
+        *carrier = (CarrierLine){carrier->color, 2, line.startX - line.startY, line.startX, line.endX};
+    } else if (dx == -dy) {
+        *carrier = (CarrierLine){carrier->color, 3, line.startX + line.startY, line.startX, line.endX};
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static LineInfo carrierToLine(CarrierLine carrier) {
+    RGB color = unpackColor(carrier.color);
+    switch (carrier.direction) {
+        case 0: return (LineInfo){carrier.start, carrier.position, carrier.end, carrier.position, color};
+        case 1: return (LineInfo){carrier.position, carrier.start, carrier.position, carrier.end, color};
+        case 2: return (LineInfo){carrier.start, carrier.start - carrier.position, carrier.end, carrier.end - carrier.position, color};
+        default: return (LineInfo){carrier.start, carrier.position - carrier.start, carrier.end, carrier.position - carrier.end, color};
+    }
+}
+
+static int compareCarrierLines(const void *a, const void *b) {
+    const CarrierLine *first = a;
+    const CarrierLine *second = b;
+    if (first->color != second->color) return (first->color > second->color) - (first->color < second->color);
+    if (first->direction != second->direction) return first->direction - second->direction;
+    if (first->position != second->position) return (first->position > second->position) - (first->position < second->position);
+    return (first->start > second->start) - (first->start < second->start);
+}
+
+// Function to join lines of one color that overlap or touch end to end on the same carrier into single
+// lines covering the same pixels. Lines off the four carriers are kept as they are, after the joined ones.
+static bool joinCollinearLines(LineBuffer *lines) {
+    CarrierLine *carriers = malloc(lines->count * sizeof(CarrierLine) + 1);
+    if (!carriers) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return false;
+    }
+
+    size_t carrierCount = 0, otherCount = 0;
+    for (size_t i = 0; i < lines->count; i++) {
+        if (carrierLine(lines->lines[i], &carriers[carrierCount])) {
+            carrierCount++;
+        } else {
+            lines->lines[otherCount++] = lines->lines[i];
+        }
+    }
+    qsort(carriers, carrierCount, sizeof(CarrierLine), compareCarrierLines);
+
+    // Sweep each carrier in order of start, growing the current line while the next one reaches it.
+    size_t joinedCount = 0;
+    for (size_t i = 0; i < carrierCount; i++) {
+        CarrierLine *last = joinedCount ? &carriers[joinedCount - 1] : NULL;
+        if (last && last->color == carriers[i].color && last->direction == carriers[i].direction &&
+            last->position == carriers[i].position && carriers[i].start <= last->end + 1) {
+            if (carriers[i].end > last->end) {
+                last->end = carriers[i].end;
+            }
+        } else {
+            carriers[joinedCount++] = carriers[i];
+        }
+    }
+
+    // The lines off the carriers move up behind the joined ones.
+    memmove(lines->lines + joinedCount, lines->lines, otherCount * sizeof(LineInfo));
+    for (size_t i = 0; i < joinedCount; i++) {
+        lines->lines[i] = carrierToLine(carriers[i]);
+    }
+    lines->count = joinedCount + otherCount;
+
+    free(carriers);
+    return true;
+}
+
+// A slot of the endpoint hash: a pixel and color with the node of the line ends there.
+typedef struct {
+    int32_t x, y;
+    uint32_t color;
+    uint32_t node; // MERGE_NO_NODE when the slot is free.
+} EndpointSlot;
+
+// Line ends of one color meeting at a pixel, found through a hash of the pixel and color.
+typedef struct {
+    EndpointSlot *slots;
+    uint32_t mask;
+    uint32_t nodeCount;
+} EndpointMap;
+
+static uint32_t endpointSlot(const EndpointMap *map, int x, int y, uint32_t color) {
+    uint64_t key = ((uint64_t)(uint32_t)x * 0x9E3779B97F4A7C15ull) ^ ((uint64_t)(uint32_t)y * 0xC2B2AE3D27D4EB4Full) ^ color;
+    uint32_t slot = (uint32_t)(key ^ (key >> 29)) & map->mask;
+    while (map->slots[slot].node != MERGE_NO_NODE &&
+           (map->slots[slot].x != x || map->slots[slot].y != y || map->slots[slot].color != color)) {
+        slot = (slot + 1) & map->mask;
+    }
+    return slot;
+}
+
+// Find or add the node of a pixel and color.
+static uint32_t endpointNode(EndpointMap *map, int x, int y, uint32_t color) {
+    EndpointSlot *slot = &map->slots[endpointSlot(map, x, y, color)];
+    if (slot->node == MERGE_NO_NODE) {
+        *slot = (EndpointSlot){x, y, color, map->nodeCount++};
+    }
+    return slot->node;
+}
+
+// Find the node of a pixel and color, or MERGE_NO_NODE if no line ends there.
+static uint32_t endpointFind(const EndpointMap *map, int x, int y, uint32_t color) {
+    return map->slots[endpointSlot(map, x, y, color)].node;
+}
+
+// The lines meeting at each node. A line end is the line index times two, plus one for its end point.
+typedef struct {
+    uint32_t *start; // nodeCount + 1 offsets into ends.
+    uint32_t *ends;  // Line ends at each node.
+    uint32_t *nodes; // Node of each line end.
+    bool *used;
+} EndpointGraph;
+
+// Among the unused lines of a color with an end at a pixel or one of its eight neighbours, take the one
+// that turns least from the direction arrived in, counting the step to its end.
+static bool nextLine(const EndpointGraph *graph, const EndpointMap *map, const LineInfo *lines,
+                     int x, int y, uint32_t color, int inX, int inY, uint32_t *end) {
+    double best = -2.0;
+    bool found = false;
+    for (int ny = y - 1; ny <= y + 1; ny++) {
+        for (int nx = x - 1; nx <= x + 1; nx++) {
+            uint32_t node = endpointFind(map, nx, ny, color);
+            if (node == MERGE_NO_NODE) {
+                continue;
+            }
+            for (uint32_t i = graph->start[node]; i < graph->start[node + 1]; i++) {
+                uint32_t candidate = graph->ends[i];
+                if (graph->used[candidate >> 1]) {
+                    continue;
+                }
+                const LineInfo *line = &lines[candidate >> 1];
+                int outX = ((candidate & 1) ? line->startX : line->endX) - x;
+                int outY = ((candidate & 1) ? line->startY : line->endY) - y;
+                double length = sqrt((double)outX * outX + (double)outY * outY) * sqrt((double)inX * inX + (double)inY * inY);
+                double straightness = (length > 0.0) ? (outX * (double)inX + outY * (double)inY) / length : 1.0;
+                // Lines that start right here come before those a step away.
+                if (nx == x && ny == y) {
+                    straightness += 4.0;
+                }
+                if (straightness > best) {
+                    best = straightness;
+                    *end = candidate;
+                    found = true;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+// A growable list of polyline points. A break before a point means it was reached by a step to a
+// neighbouring pixel rather than along a line, so no segment joins it to the point before.
+typedef struct {
+    int *x, *y;
+    bool *breakBefore;
+    size_t count, capacity;
+} Polyline;
+
+static bool polylinePush(Polyline *polyline, int x, int y, bool breakBefore) {
+    if (polyline->count == polyline->capacity) {
+        size_t capacity = polyline->capacity ? polyline->capacity * 2 : 256;
+        int *grownX = realloc(polyline->x, capacity * sizeof(int));
+        if (grownX) polyline->x = grownX;
+        int *grownY = realloc(polyline->y, capacity * sizeof(int));
+        if (grownY) polyline->y = grownY;
+        bool *grownBreaks = realloc(polyline->breakBefore, capacity * sizeof(bool));
+        if (grownBreaks) polyline->breakBefore = grownBreaks;
+        if (!grownX || !grownY || !grownBreaks) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return false;
+        }
+        polyline->capacity = capacity;
+    }
+    polyline->x[polyline->count] = x;
+    polyline->y[polyline->count] = y;
+    polyline->breakBefore[polyline->count] = breakBefore;
+    polyline->count++;
+    return true;
+}
+
+// Follow unused lines from a point, straightest first, adding the points of each to the polyline. The pixels
+// of a step to a line starting next to the point are already drawn, so that step is a break, not a segment.
+static bool extendPolyline(const EndpointGraph *graph, const EndpointMap *map, const LineInfo *lines, Polyline *polyline,
+                           int x, int y, uint32_t color, int inX, int inY) {
+    uint32_t end;
+    while (nextLine(graph, map, lines, x, y, color, inX, inY, &end)) {
+        const LineInfo *line = &lines[end >> 1];
+        graph->used[end >> 1] = true;
+        int nearX = (end & 1) ? line->endX : line->startX;
+        int nearY = (end & 1) ? line->endY : line->startY;
+        int farX = (end & 1) ? line->startX : line->endX;
+        int farY = (end & 1) ? line->startY : line->endY;
+        if ((nearX != x || nearY != y) && !polylinePush(polyline, nearX, nearY, true)) {
+            return false;
+        }
+        if (!polylinePush(polyline, farX, farY, false)) {
+            return false;
+        }
+        inX = farX - nearX;
+        inY = farY - nearY;
+        x = farX;
+        y = farY;
+    }
+    return true;
+}
+
+// Distance from a point to the segment between two others.
+static double segmentDistance(double x, double y, double x1, double y1, double x2, double y2) {
+    double dx = x2 - x1, dy = y2 - y1;
+    double lengthSquared = dx * dx + dy * dy;
+    double t = (lengthSquared > 0.0) ? ((x - x1) * dx + (y - y1) * dy) / lengthSquared : 0.0;
+    if (t < 0.0) t = 0.0;
+    if (t > 1.0) t = 1.0;
+    double px = x1 + t * dx - x, py = y1 + t * dy - y;
+    return sqrt(px * px + py * py);
+}
+
+// Function to simplify a polyline with Douglas-Peucker, marking the points kept so that no point dropped
+// lies further than maxError pixels from the simplified line. Only the points from first to last are
+// looked at, and marked in keep. Uses an explicit stack of point ranges.
+static void simplifyPolyline(const Polyline *polyline, size_t first, size_t last, double maxError, bool *keep,
+                             size_t *stack) {
+    size_t depth = 0;
+    memset(keep + first, 0, (last - first + 1) * sizeof(bool));
+    keep[first] = keep[last] = true;
+    stack[depth++] = first;
+    stack[depth++] = last;
+
+    while (depth > 0) {
+        size_t last = stack[--depth];
+        size_t first = stack[--depth];
+        double worst = -1.0;
+        size_t worstIndex = first;
+        for (size_t i = first + 1; i < last; i++) {
+            double distance = segmentDistance(polyline->x[i], polyline->y[i], polyline->x[first], polyline->y[first],
+                                              polyline->x[last], polyline->y[last]);
+            if (distance > worst) {
+                worst = distance;
+                worstIndex = i;
+            }
+        }
+        if (worst > maxError) {
+            keep[worstIndex] = true;
+            stack[depth++] = first;
+            stack[depth++] = worstIndex;
+            stack[depth++] = worstIndex;
+            stack[depth++] = last;
+        }
+    }
+}
+
+// Function to join the lines into polylines of one color through ends that meet or sit side by side, and simplify each
+// with Douglas-Peucker so that no original corner lies further than maxError pixels from the result.
+static bool chainLines(LineBuffer *lines, double maxError) {
+    size_t lineCount = lines->count;
+    if (lineCount == 0) {
+        return true;
+    }
+    if (lineCount > UINT32_MAX / 8) {
+        fprintf(stderr, "Too many lines to merge.\n");
+        return false;
+    }
+
+    // Two endpoints per line; keep the map at most half full. The bound above keeps it within 2^31 slots.
+    uint32_t capacity = 16;
+    while (capacity < lineCount * 4) {
+        capacity <<= 1;
+    }
+    EndpointMap map = {malloc(capacity * sizeof(EndpointSlot)), capacity - 1, 0};
+    EndpointGraph graph = {calloc(2 * lineCount + 1, sizeof(uint32_t)), malloc(2 * lineCount * sizeof(uint32_t)),
+                           malloc(2 * lineCount * sizeof(uint32_t)), calloc(lineCount, sizeof(bool))};
+    LineBuffer merged = {NULL, 0, 0};
+    Polyline polyline = {NULL, NULL, NULL, 0, 0};
+    bool *keep = NULL;
+    bool *breaks = NULL;
+    size_t *stack = NULL;
+    bool result = map.slots && graph.start && graph.ends && graph.nodes && graph.used;
+
+    if (result) {
+        memset(map.slots, 0xFF, capacity * sizeof(EndpointSlot));
+        for (size_t i = 0; i < lineCount; i++) {
+            uint32_t color = packColor(lines->lines[i].color);
+            graph.nodes[2 * i] = endpointNode(&map, lines->lines[i].startX, lines->lines[i].startY, color);
+            graph.nodes[2 * i + 1] = endpointNode(&map, lines->lines[i].endX, lines->lines[i].endY, color);
+        }
+
+        // List the line ends at each node, counting first and then placing them.
+        for (size_t i = 0; i < 2 * lineCount; i++) {
+            graph.start[graph.nodes[i] + 1]++;
+        }
+        for (uint32_t node = 0; node < map.nodeCount; node++) {
+            graph.start[node + 1] += graph.start[node];
+        }
+        uint32_t *fill = malloc((map.nodeCount + 1) * sizeof(uint32_t));
+        result = fill != NULL;
+        if (result) {
+            memcpy(fill, graph.start, (map.nodeCount + 1) * sizeof(uint32_t));
+            for (size_t i = 0; i < 2 * lineCount; i++) {
+                graph.ends[fill[graph.nodes[i]]++] = (uint32_t)i;
+            }
+            free(fill);
+        }
+    }
+
+    // Each unused line starts a polyline, grown from both of its ends.
+    for (size_t i = 0; i < lineCount && result; i++) {
+        if (graph.used[i]) {
+            continue;
+        }
+
+        // Grow the polyline from its first line forward, then backward from the start of that line.
+        const LineInfo *line = &lines->lines[i];
+        graph.used[i] = true;
+        polyline.count = 0;
+        uint32_t color = packColor(line->color);
+        result = polylinePush(&polyline, line->startX, line->startY, false) &&
+                 polylinePush(&polyline, line->endX, line->endY, false) &&
+                 extendPolyline(&graph, &map, lines->lines, &polyline, line->endX, line->endY, color,
+                                line->endX - line->startX, line->endY - line->startY);
+        size_t forward = polyline.count;
+        result = result && extendPolyline(&graph, &map, lines->lines, &polyline, line->startX, line->startY, color,
+                                          line->startX - line->endX, line->startY - line->endY);
+        if (!result) {
+            break;
+        }
+
+        // Put the backward points first, reversed, so the points run from one end to the other.
+        size_t backward = polyline.count - forward;
+        for (size_t k = 0; k < polyline.count / 2; k++) {
+            size_t other = polyline.count - 1 - k;
+            int x = polyline.x[k], y = polyline.y[k];
+            polyline.x[k] = polyline.x[other];
+            polyline.y[k] = polyline.y[other];
+            polyline.x[other] = x;
+            polyline.y[other] = y;
+        }
+        for (size_t k = 0; k < forward / 2; k++) {
+            size_t low = backward + k, high = polyline.count - 1 - k;
+            int x = polyline.x[low], y = polyline.y[low];
+            polyline.x[low] = polyline.x[high];
+            polyline.y[low] = polyline.y[high];
+            polyline.x[high] = x;
+            polyline.y[high] = y;
+        }
+
+        bool *grownKeep = realloc(keep, polyline.capacity * sizeof(bool));
+        if (grownKeep) keep = grownKeep;
+        bool *grownBreaks = realloc(breaks, polyline.capacity * sizeof(bool));
+        if (grownBreaks) breaks = grownBreaks;
+        size_t *grownStack = realloc(stack, 2 * polyline.capacity * sizeof(size_t));
+        if (grownStack) stack = grownStack;
+        if (!grownKeep || !grownBreaks || !grownStack) {
+            fprintf(stderr, "Memory allocation failed\n");
+            result = false;
+            break;
+        }
+
+        // Move the breaks with their points. A forward point keeps the point before it, while a backward
+        // point now comes before the one it was reached from.
+        breaks[0] = false;
+        for (size_t k = 0; k < forward; k++) {
+            breaks[backward + k] = polyline.breakBefore[k];
+        }
+        for (size_t k = 0; k < backward; k++) {
+            breaks[backward - k] = polyline.breakBefore[forward + k];
+        }
+
+        // Simplify and add each run of points between breaks on its own.
+        size_t runStart = 0;
+        for (size_t k = 1; k <= polyline.count && result; k++) {
+            if (k < polyline.count && !breaks[k]) {
+                continue;
+            }
+            simplifyPolyline(&polyline, runStart, k - 1, maxError, keep, stack);
+            size_t from = runStart;
+            for (size_t point = runStart + 1; point < k && result; point++) {
+                if (keep[point]) {
+                    result = lineBufferPush(&merged, (LineInfo){polyline.x[from], polyline.y[from], polyline.x[point],
+                                                                polyline.y[point], line->color});
+                    from = point;
+                }
+            }
+            runStart = k;
+        }
+    }
+
+    // Chaining is only worth keeping when it gives fewer lines; otherwise the joined lines stay as they are.
+    if (result && merged.count <= lineCount) {
+        lineBufferFree(lines);
+        *lines = merged;
+    } else {
+        lineBufferFree(&merged);
+    }
+    free(stack);
+    free(breaks);
+    free(keep);
+    free(polyline.breakBefore);
+    free(polyline.x);
+    free(polyline.y);
+    free(graph.used);
+    free(graph.ends);
+    free(graph.start);
+    free(graph.nodes);
+    free(map.slots);
+    return result;
+}
+
+// Function to merge extracted lines into fewer, longer ones. Lines of one color that overlap or touch on
+// the same row, column or diagonal are joined first, without changing the pixels they cover. The lines are
+// then chained through shared ends into polylines, which are simplified so that no pixel of a chain moves
+// more than maxError pixels. A negative maxError only does the joining.
+bool mergeLines(LineBuffer *lines, double maxError) {
+    if (!joinCollinearLines(lines)) {
+        return false;
+    }
+    if (maxError < 0.0) {
+        return true;
+    }
+    return chainLines(lines, maxError);
+}
@@ -0,0 +1,135 @@
+/****************************************************************
+
+    pyramid.c - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include "canterbury.h"
+
+static int compareLines(const void *a, const void *b) {
+    const LineInfo *first = a;
+    const LineInfo *second = b;
+    uint32_t color1 = ((uint32_t)first->color.r << 16) | ((uint32_t)first->color.g << 8) | first->color.b;
+    uint32_t color2 = ((uint32_t)second->color.r << 16) | ((uint32_t)second->color.g << 8) | second->color.b;
+    if (color1 != color2) return (color1 > color2) - (color1 < color2);
+    if (first->startY != second->startY) return (first->startY > second->startY) - (first->startY < second->startY);
+    if (first->startX != second->startX) return (first->startX > second->startX) - (first->startX < second->startX);
+    if (first->endY != second->endY) return (first->endY > second->endY) - (first->endY < second->endY);
+    return (first->endX > second->endX) - (first->endX < second->endX);
+}
+
+// Function to halve the resolution of a set of snapped lines in place. Each end moves to the pixel of the
+// next level that holds it, and the copies left where nearby lines fall onto the same pixels are dropped.
+// Snapping twice by one level is snapping once by two, so every level can be made from the one before.
+static void snapLines(LineBuffer *lines) {
+    for (size_t i = 0; i < lines->count; i++) {
+        LineInfo line = {lines->lines[i].startX >> 1, lines->lines[i].startY >> 1, lines->lines[i].endX >> 1,
+                         lines->lines[i].endY >> 1, lines->lines[i].color};
+
+        // Start from the upper end, so a line and its reverse snap to the same entry.
+        if (line.startY > line.endY || (line.startY == line.endY && line.startX > line.endX)) {
+            line = (LineInfo){line.endX, line.endY, line.startX, line.startY, line.color};
+        }
+        lines->lines[i] = line;
+    }
+
+    qsort(lines->lines, lines->count, sizeof(LineInfo), compareLines);
+    size_t unique = 0;
+    for (size_t i = 0; i < lines->count; i++) {
+        if (unique == 0 || compareLines(&lines->lines[unique - 1], &lines->lines[i]) != 0) {
+            lines->lines[unique++] = lines->lines[i];
+        }
+    }
+    lines->count = unique;
+}
+
+// Function to write a pyramid of PYRAMID_LEVELS line sets, each at half the resolution of the one before,
+// from the full lines down to one level pixel for every 2^(PYRAMID_LEVELS - 1) image pixels. Every level is
+// tiled in PYRAMID_TILE_SIZE level pixels so a viewer can read just the tiles it shows.
+bool writeLinePyramid(const char *filename, const LineInfo *lines, size_t lineCount, size_t width, size_t height,
+                      const uint32_t topColors[TOPCOLORENTRIES]) {
+    PyramidLevel levels[PYRAMID_LEVELS];
+    LineRecord *records[PYRAMID_LEVELS] = {NULL};
+    bool result = true;
+
+    LineBuffer snapped = {malloc(lineCount * sizeof(LineInfo) + 1), lineCount, lineCount};
+    result = snapped.lines != NULL;
+    if (result) {
+        memcpy(snapped.lines, lines, lineCount * sizeof(LineInfo));
+    }
+
+    for (int level = 0; level < PYRAMID_LEVELS && result; level++) {
+        // Reduced levels are the snapped lines merged into polylines within PYRAMID_MERGE_ERROR level pixels.
+        LineBuffer simplified = {NULL, 0, 0};
+        const LineInfo *levelLines = lines;
+        size_t levelCount = lineCount;
+        if (level > 0) {
+            snapLines(&snapped);
+            simplified = (LineBuffer){malloc(snapped.count * sizeof(LineInfo) + 1), snapped.count, snapped.count};
+            result = simplified.lines != NULL;
+            if (result) {
+                memcpy(simplified.lines, snapped.lines, snapped.count * sizeof(LineInfo));
+                result = mergeLines(&simplified, PYRAMID_MERGE_ERROR);
+            }
+            levelLines = simplified.lines;
+            levelCount = simplified.count;
+        }
+
+        records[level] = result ? malloc(levelCount * sizeof(LineRecord) + 1) : NULL;
+        if (records[level]) {
+            for (size_t i = 0; i < levelCount; i++) {
+                records[level][i] = (LineRecord){levelLines[i].startX, levelLines[i].startY, levelLines[i].endX, levelLines[i].endY,
+                                                 levelLines[i].color.r, levelLines[i].color.g, levelLines[i].color.b};
+            }
+            levels[level] = (PyramidLevel){1u << level, records[level], levelCount};
+        } else {
+            result = false;
+        }
+        lineBufferFree(&simplified);
+    }
+    lineBufferFree(&snapped);
+
+    if (!result) {
+        fprintf(stderr, "Memory allocation failed\n");
+    } else {
+        result = writePyramidFile(filename, levels, PYRAMID_LEVELS, PYRAMID_TILE_SIZE, (uint32_t)width, (uint32_t)height,
+                                  topColors, TOPCOLORENTRIES);
+        for (int level = 0; level < PYRAMID_LEVELS && result; level++) {
+            printf("Pyramid level 1/%u holds %zu lines\n", levels[level].scale, levels[level].count);
+        }
+    }
+
+    for (int level = 0; level < PYRAMID_LEVELS; level++) {
+        free(records[level]);
+    }
+    return result;
+}
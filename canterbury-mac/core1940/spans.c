@@ -0,0 +1,167 @@
+/****************************************************************
+
+    spans.c - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include "canterbury.h"
+
+// Append a strip to a buffer, growing it as needed.
+bool spanBufferPush(SpanBuffer *buffer, SpanInfo span) {
+    if (buffer->count == buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 1024;
+        SpanInfo *grown = realloc(buffer->spans, capacity * sizeof(SpanInfo));
+        if (!grown) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return false;
+        }
+        buffer->spans = grown;
+        buffer->capacity = capacity;
+    }
+    buffer->spans[buffer->count++] = span;
+    return true;
+}
+
+void spanBufferFree(SpanBuffer *buffer) {
+    free(buffer->spans);
+    buffer->spans = NULL;
+    buffer->count = 0;
+    buffer->capacity = 0;
+}
+
+// Function to encode every non-white pixel of the image in one pass down the rows, removing it as it goes.
+// Each row is cut into horizontal runs of pixels within tolerance of the first pixel of the run. A run that covers the same columns in the same color as a strip that reached the
+// row above extends that strip down, so filled areas become a few rectangles instead of many short lines.
+bool extractSpans(Image *image, LabelImage *labelImage, SpanBuffer *spans) {
+    int width = (int)image->width;
+    int height = (int)image->height;
+
+    // Strips that reached the row above, and those reaching the current row, in column order.
+    size_t *above = malloc(((size_t)width + 1) * sizeof(size_t));
+    size_t *current = malloc(((size_t)width + 1) * sizeof(size_t));
+    if (!above || !current) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(above);
+        free(current);
+        return false;
+    }
+    size_t aboveCount = 0;
+    bool result = true;
+
+    for (int y = 0; y < height && result; y++) {
+        RGB *row = IMAGE_ROW(image, y);
+        uint8_t *labels = &LABEL_AT(labelImage, y, 0);
+        size_t aboveIndex = 0;
+        size_t currentCount = 0;
+        STATS_ADD(pixelsVisited, width);
+
+        for (int x = 0; x < width;) {
+            uint8_t label = labels[x];
+            if (label == LABEL_WHITE) {
+                x++;
+                continue;
+            }
+
+            // Both lists are in column order, so a strip above starting here, if any, is found by walking forward.
+            while (aboveIndex < aboveCount && spans->spans[above[aboveIndex]].left < x) {
+                aboveIndex++;
+            }
+            SpanInfo *strip = (aboveIndex < aboveCount) ? &spans->spans[above[aboveIndex]] : NULL;
+            int end = x;
+
+            // Carry the strip down if all of its columns in this row are within tolerance of its color.
+            if (strip && strip->left == x) {
+                while (end <= strip->right && labels[end] != LABEL_WHITE && isColorSimilar(row[end], strip->color, TOLERANCE_VALUE)) {
+                    end++;
+                }
+                if (end == strip->right + 1) {
+                    strip->bottom = y;
+                    current[currentCount++] = above[aboveIndex];
+                } else {
+                    end = x;
+                }
+            }
+
+            // Otherwise start a strip, which like the line scan runs on over any pixel within tolerance
+            // of its first one.
+            if (end == x) {
+                RGB color = row[x];
+                end = x + 1;
+                while (end < width && labels[end] != LABEL_WHITE &&
+                       ((labels[end] == label && label != LABEL_NOISE) || isColorSimilar(row[end], color, TOLERANCE_VALUE))) {
+                    end++;
+                }
+                if (!spanBufferPush(spans, (SpanInfo){x, y, end - 1, y, color})) {
+                    result = false;
+                    break;
+                }
+                STATS_ADD(linesByLabel[(label == LABEL_NOISE) ? TOPCOLORENTRIES : label], 1);
+                current[currentCount++] = spans->count - 1;
+            }
+            STATS_RUN((size_t)(end - x));
+
+            for (int i = x; i < end; i++) {
+                row[i] = (RGB){{255, 255, 255}};
+                labels[i] = LABEL_WHITE;
+            }
+            x = end;
+        }
+
+        size_t *swap = above;
+        above = current;
+        current = swap;
+        aboveCount = currentCount;
+    }
+
+    free(above);
+    free(current);
+    STATS_MERGE();
+    return result;
+}
+
+// Function to write strips to a span file, with the top colors seeding its palette.
+bool writeSpans(const char *filename, const SpanInfo *spans, size_t spanCount, const uint32_t topColors[TOPCOLORENTRIES],
+                size_t width, size_t height) {
+    SpanRecord *records = malloc(spanCount * sizeof(SpanRecord) + 1);
+    if (!records) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return false;
+    }
+    for (size_t i = 0; i < spanCount; i++) {
+        records[i] = (SpanRecord){spans[i].left, spans[i].top, spans[i].right, spans[i].bottom,
+                                  spans[i].color.r, spans[i].color.g, spans[i].color.b};
+    }
+    bool result = writeSpanFile(filename, records, spanCount, topColors, topColors ? TOPCOLORENTRIES : 0,
+                                (uint32_t)width, (uint32_t)height);
+    free(records);
+    return result;
+}
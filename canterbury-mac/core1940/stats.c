@@ -0,0 +1,134 @@
+/****************************************************************
+
+    stats.c - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include "canterbury.h"
+
+#ifdef CANTERBURY_STATS
+
+#include <pthread.h>
+#include <time.h>
+
+_Thread_local ExtractStats threadStats;
+
+static ExtractStats totalStats;
+static pthread_mutex_t totalStatsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Read a monotonic clock in seconds.
+double statsSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+// The run length bucket of a length, the power of two at or below it.
+int statsBucket(size_t length) {
+    int bucket = 0;
+    while (length > 1 && bucket < STATS_RUN_BUCKETS - 1) {
+        length >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Add the counters of the calling thread to the totals and clear them.
+void statsMerge(void) {
+    pthread_mutex_lock(&totalStatsLock);
+    totalStats.pixelsVisited += threadStats.pixelsVisited;
+    totalStats.seedsScanned += threadStats.seedsScanned;
+    totalStats.directionProbes += threadStats.directionProbes;
+    totalStats.runsMeasured += threadStats.runsMeasured;
+    for (int i = 0; i < STATS_RUN_BUCKETS; i++) {
+        totalStats.runLengths[i] += threadStats.runLengths[i];
+    }
+    totalStats.similarCalls += threadStats.similarCalls;
+    for (int i = 0; i <= TOPCOLORENTRIES; i++) {
+        totalStats.linesByLabel[i] += threadStats.linesByLabel[i];
+    }
+    totalStats.distinctColors += threadStats.distinctColors;
+    for (int i = 0; i < 4; i++) {
+        totalStats.quadrantSeconds[i] += threadStats.quadrantSeconds[i];
+    }
+    totalStats.tileSeconds += threadStats.tileSeconds;
+    totalStats.stitchSeconds += threadStats.stitchSeconds;
+    totalStats.topColorSeconds += threadStats.topColorSeconds;
+    pthread_mutex_unlock(&totalStatsLock);
+
+    memset(&threadStats, 0, sizeof(threadStats));
+}
+
+static void writeCounts(FILE *file, const uint64_t *counts, int count) {
+    for (int i = 0; i < count; i++) {
+        fprintf(file, "%s%llu", i ? ", " : "", (unsigned long long)counts[i]);
+    }
+}
+
+// Write the totals as JSON, with the lines found for each top color listed by color.
+bool statsWrite(const char *filename, const uint32_t topColors[TOPCOLORENTRIES]) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s for writing.\n", filename);
+        return false;
+    }
+
+    pthread_mutex_lock(&totalStatsLock);
+    const ExtractStats *stats = &totalStats;
+    fprintf(file, "{\n");
+    fprintf(file, "  \"topColorSeconds\": %.6f,\n", stats->topColorSeconds);
+    fprintf(file, "  \"distinctColors\": %llu,\n", (unsigned long long)stats->distinctColors);
+    fprintf(file, "  \"pixelsVisited\": %llu,\n", (unsigned long long)stats->pixelsVisited);
+    fprintf(file, "  \"seedsScanned\": %llu,\n", (unsigned long long)stats->seedsScanned);
+    fprintf(file, "  \"directionProbes\": %llu,\n", (unsigned long long)stats->directionProbes);
+    fprintf(file, "  \"similarCalls\": %llu,\n", (unsigned long long)stats->similarCalls);
+    fprintf(file, "  \"runsMeasured\": %llu,\n", (unsigned long long)stats->runsMeasured);
+    fprintf(file, "  \"runLengthBuckets\": [");
+    writeCounts(file, stats->runLengths, STATS_RUN_BUCKETS);
+    fprintf(file, "],\n");
+    fprintf(file, "  \"quadrantSeconds\": [%.6f, %.6f, %.6f, %.6f],\n", stats->quadrantSeconds[0],
+            stats->quadrantSeconds[1], stats->quadrantSeconds[2], stats->quadrantSeconds[3]);
+    fprintf(file, "  \"tileSeconds\": %.6f,\n", stats->tileSeconds);
+    fprintf(file, "  \"stitchSeconds\": %.6f,\n", stats->stitchSeconds);
+    fprintf(file, "  \"linesByColor\": [\n");
+    for (int i = 0; i < TOPCOLORENTRIES; i++) {
+        fprintf(file, "    {\"r\": %u, \"g\": %u, \"b\": %u, \"lines\": %llu},\n", (topColors[i] >> 16) & 0xFF,
+                (topColors[i] >> 8) & 0xFF, topColors[i] & 0xFF, (unsigned long long)stats->linesByLabel[i]);
+    }
+    fprintf(file, "    {\"other\": true, \"lines\": %llu}\n", (unsigned long long)stats->linesByLabel[TOPCOLORENTRIES]);
+    fprintf(file, "  ]\n}\n");
+    pthread_mutex_unlock(&totalStatsLock);
+
+    return fclose(file) == 0;
+}
+
+#endif
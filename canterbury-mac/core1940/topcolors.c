@@ -0,0 +1,288 @@
+/****************************************************************
+
+    topcolors.c - Canterbury1940
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+#include "canterbury.h"
+
+// Define a structure to store RGB color frequencies.
+typedef struct {
+    uint32_t color; // 32-bit representation of the RGB color.
+    uint32_t count; // Frequency of the color.
+    float luminance; // Luminance of the color (darker colors have lower luminance).
+} ColorFreq;
+
+// Comparator function for sorting colors by frequency in descending order and luminance in ascending order.
+// Ties on both are broken by the color value so the order is always the same.
+int compareColorFreq(const void *a, const void *b) {
+    ColorFreq *cf1 = (ColorFreq *)a;
+    ColorFreq *cf2 = (ColorFreq *)b;
+    if (cf1->count == cf2->count) {
+        if (cf1->luminance == cf2->luminance) {
+            return (cf1->color < cf2->color) ? -1 : (cf1->color > cf2->color);
+        }
+        return (cf1->luminance < cf2->luminance) ? -1 : 1;
+    }
+    return (cf2->count > cf1->count) ? 1 : -1;
+}
+
+// Calculate the luminance of a color.
+float calculateLuminance(uint32_t color) {
+    uint8_t r = (color >> 16) & 0xFF;
+    uint8_t g = (color >> 8) & 0xFF;
+    uint8_t b = color & 0xFF;
+    return 0.2126 * r + 0.7152 * g + 0.0722 * b; // Standard luminance formula.
+}
+
+#define HISTOGRAM_SORT_LIMIT (1 << 18) // Images up to this many pixels are counted by sorting.
+#define HISTOGRAM_EMPTY 0xFFFFFFFF     // Never a 24-bit color, marks a free hash slot.
+
+// The best TOPCOLORENTRIES colors seen so far, kept as a heap with the worst at the root.
+typedef struct {
+    ColorFreq entries[TOPCOLORENTRIES];
+    size_t count;
+} TopColorHeap;
+
+static void topColorSiftDown(TopColorHeap *heap, size_t i) {
+    while (1) {
+        size_t worst = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < heap->count && compareColorFreq(&heap->entries[left], &heap->entries[worst]) > 0) worst = left;
+        if (right < heap->count && compareColorFreq(&heap->entries[right], &heap->entries[worst]) > 0) worst = right;
+        if (worst == i) return;
+        ColorFreq swap = heap->entries[i];
+        heap->entries[i] = heap->entries[worst];
+        heap->entries[worst] = swap;
+        i = worst;
+    }
+}
+
+// Offer a color to the heap, keeping it only if it beats the worst color held.
+static void topColorOffer(TopColorHeap *heap, uint32_t color, uint32_t count) {
+    ColorFreq candidate = {color, count, calculateLuminance(color)};
+
+    if (heap->count < TOPCOLORENTRIES) {
+        size_t i = heap->count++;
+        heap->entries[i] = candidate;
+        while (i > 0 && compareColorFreq(&heap->entries[(i - 1) / 2], &heap->entries[i]) < 0) {
+            ColorFreq swap = heap->entries[i];
+            heap->entries[i] = heap->entries[(i - 1) / 2];
+            heap->entries[(i - 1) / 2] = swap;
+            i = (i - 1) / 2;
+        }
+    } else if (compareColorFreq(&candidate, &heap->entries[0]) < 0) {
+        heap->entries[0] = candidate;
+        topColorSiftDown(heap, 0);
+    }
+}
+
+// Count colors by radix sorting the pixels and measuring the runs. Memory is two words per pixel.
+static bool histogramBySort(const uint8_t *image, size_t width, size_t height, size_t rowBytes, TopColorHeap *heap) {
+    size_t pixelCount = width * height;
+    uint32_t *colors = malloc(pixelCount * sizeof(uint32_t) + 1);
+    uint32_t *scratch = malloc(pixelCount * sizeof(uint32_t) + 1);
+    if (!colors || !scratch) {
+        free(colors);
+        free(scratch);
+        return false;
+    }
+
+    for (size_t row = 0; row < height; row++) {
+        const uint8_t *pixel = image + row * rowBytes;
+        for (size_t col = 0; col < width; col++, pixel += 3) {
+            colors[row * width + col] = (pixel[0] << 16) | (pixel[1] << 8) | pixel[2];
+        }
+    }
+
+    // Three byte-wide least significant digit passes sort the 24-bit colors.
+    for (int shift = 0; shift < 24; shift += 8) {
+        size_t offsets[256] = {0};
+        for (size_t i = 0; i < pixelCount; i++) {
+            offsets[(colors[i] >> shift) & 0xFF]++;
+        }
+        size_t total = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            size_t count = offsets[digit];
+            offsets[digit] = total;
+            total += count;
+        }
+        for (size_t i = 0; i < pixelCount; i++) {
+            scratch[offsets[(colors[i] >> shift) & 0xFF]++] = colors[i];
+        }
+        uint32_t *swap = colors;
+        colors = scratch;
+        scratch = swap;
+    }
+
+    for (size_t i = 0; i < pixelCount;) {
+        size_t run = i + 1;
+        while (run < pixelCount && colors[run] == colors[i]) {
+            run++;
+        }
+        topColorOffer(heap, colors[i], (uint32_t)(run - i));
+        STATS_ADD(distinctColors, 1);
+        i = run;
+    }
+
+    free(colors);
+    free(scratch);
+    return true;
+}
+
+static uint32_t histogramSlot(uint32_t color, uint32_t mask) {
+    return (color * 0x9E3779B1u >> 7) & mask;
+}
+
+// Count colors in an open-addressing hash that grows with the number of distinct colors.
+static bool histogramByHash(const uint8_t *image, size_t width, size_t height, size_t rowBytes, TopColorHeap *heap) {
+    uint32_t capacity = 4096;
+    uint32_t used = 0;
+    uint32_t *keys = malloc(capacity * sizeof(uint32_t));
+    uint32_t *counts = calloc(capacity, sizeof(uint32_t));
+    if (!keys || !counts) {
+        free(keys);
+        free(counts);
+        return false;
+    }
+    memset(keys, 0xFF, capacity * sizeof(uint32_t));
+
+    const uint8_t *rowStart = image;
+    size_t col = 0;
+    for (size_t i = 0; i < width * height; i++) {
+        // Step over any padding at the end of a row.
+        if (col == width) {
+            rowStart += rowBytes;
+            col = 0;
+        }
+        const uint8_t *pixel = rowStart + 3 * col++;
+        uint32_t color = (pixel[0] << 16) | (pixel[1] << 8) | pixel[2];
+        uint32_t mask = capacity - 1;
+        uint32_t slot = histogramSlot(color, mask);
+        while (keys[slot] != color && keys[slot] != HISTOGRAM_EMPTY) {
+            slot = (slot + 1) & mask;
+        }
+        if (keys[slot] == color) {
+            counts[slot]++;
+            continue;
+        }
+        keys[slot] = color;
+        counts[slot] = 1;
+
+        // Keep the table at most half full.
+        if (++used * 2 > capacity) {
+            uint32_t grownCapacity = capacity * 2;
+            uint32_t grownMask = grownCapacity - 1;
+            uint32_t *grownKeys = malloc(grownCapacity * sizeof(uint32_t));
+            uint32_t *grownCounts = calloc(grownCapacity, sizeof(uint32_t));
+            if (!grownKeys || !grownCounts) {
+                free(grownKeys);
+                free(grownCounts);
+                free(keys);
+                free(counts);
+                return false;
+            }
+            memset(grownKeys, 0xFF, grownCapacity * sizeof(uint32_t));
+            for (uint32_t old = 0; old < capacity; old++) {
+                if (keys[old] == HISTOGRAM_EMPTY) continue;
+                uint32_t moved = histogramSlot(keys[old], grownMask);
+                while (grownKeys[moved] != HISTOGRAM_EMPTY) {
+                    moved = (moved + 1) & grownMask;
+                }
+                grownKeys[moved] = keys[old];
+                grownCounts[moved] = counts[old];
+            }
+            free(keys);
+            free(counts);
+            keys = grownKeys;
+            counts = grownCounts;
+            capacity = grownCapacity;
+        }
+    }
+
+    STATS_ADD(distinctColors, used);
+    for (uint32_t slot = 0; slot < capacity; slot++) {
+        if (keys[slot] != HISTOGRAM_EMPTY) {
+            topColorOffer(heap, keys[slot], counts[slot]);
+        }
+    }
+
+    free(keys);
+    free(counts);
+    return true;
+}
+
+// Find the top colors in pixels rowBytes apart and their pixel counts.
+// Small images are counted by sorting and larger ones with a hash table, so the work and memory
+// follow the pixel and distinct color counts rather than the 24-bit color space.
+static void findTopColorsInRows(const uint8_t *image, size_t width, size_t height, size_t rowBytes,
+                                uint32_t topColors[TOPCOLORENTRIES], uint32_t pixelCounts[TOPCOLORENTRIES]) {
+    size_t pixelCount = width * height;
+    TopColorHeap heap = {.count = 0};
+    STATS_START(topColorStart);
+
+    bool counted = (pixelCount <= HISTOGRAM_SORT_LIMIT) ? histogramBySort(image, width, height, rowBytes, &heap)
+                                                        : histogramByHash(image, width, height, rowBytes, &heap);
+    if (!counted) {
+        fprintf(stderr, "Memory allocation failed\n");
+        heap.count = 0;
+    }
+
+    // Sort the survivors by frequency and luminance.
+    qsort(heap.entries, heap.count, sizeof(ColorFreq), compareColorFreq);
+
+    // Extract the top TOPCOLORENTRIES colors.
+    for (size_t i = 0; i < heap.count; ++i) {
+        topColors[i] = heap.entries[i].color;
+        pixelCounts[i] = heap.entries[i].count;
+    }
+
+    // Fill remaining entries with 0 if there are fewer than TOPCOLORENTRIES colors.
+    for (size_t i = heap.count; i < TOPCOLORENTRIES; ++i) {
+        topColors[i] = 0;
+        pixelCounts[i] = 0;
+    }
+    STATS_TIME(topColorSeconds, topColorStart);
+    STATS_MERGE();
+}
+
+// Find the top colors in a packed RGB image and their pixel counts.
+void findTopColors(uint8_t *image, size_t width, size_t height, uint32_t topColors[TOPCOLORENTRIES], uint32_t pixelCounts[TOPCOLORENTRIES]) {
+    findTopColorsInRows(image, width, height, width * 3, topColors, pixelCounts);
+}
+
+// Find the top colors of a working image, reading its padded rows in place.
+void findImageTopColors(const Image *image, uint32_t topColors[TOPCOLORENTRIES], uint32_t pixelCounts[TOPCOLORENTRIES]) {
+    findTopColorsInRows((const uint8_t *)image->pixels, image->width, image->height, image->stride * sizeof(RGB),
+                        topColors, pixelCounts);
+}
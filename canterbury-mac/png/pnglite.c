@@ -18,8 +18,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "pnglite.h"
 
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#define PNG_UNFILTER_SSE2 1
+#if defined(__GNUC__) || defined(__clang__)
+#define PNG_UNFILTER_SSSE3 1
+#endif
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define PNG_UNFILTER_NEON 1
+#endif
+
+#define PNG_DEFLATE_BAND_BYTES (256 * 1024)  // Filtered bytes per band deflated on its own thread
+#define PNG_DEFLATE_WINDOW 32768             // History each band is primed with, the whole deflate window
+#define PNG_FILTER_SAMPLE_BLOCKS 8           // Blocks of rows deflated to decide whether to filter at all
+#define PNG_FILTER_SAMPLE_ROWS 8             // Rows in each sample block
+
 // Function pointers for memory allocation and deallocation
 static png_alloc_t png_alloc;
 static png_free_t png_free;
@@ -260,6 +279,8 @@ int png_open_write(png_t* png, png_write_callback_t write_fun, void* user_pointe
     png->write_fun = write_fun;
     png->read_fun = 0;
     png->user_pointer = user_pointer;
+    png->compression_level = Z_DEFAULT_COMPRESSION;
+    png->compression_threads = 0;
 
     if (!write_fun && !user_pointer)
         return PNG_WRONG_ARGUMENTS;  // Must provide either a write function or a file pointer
@@ -444,37 +465,192 @@ static int png_deflate(png_t* png, char* outdata, int outlen, int* outwritten) {
     return result;
 }
 
-// Write IDAT chunks (compressed image data) to the file
+// One band of filtered rows and the raw deflate stream made from it
+typedef struct {
+    const unsigned char* data;
+    unsigned length;
+    unsigned dictionary_length;  // Bytes before data to prime the window with, 0 for the first band
+    int last;
+    unsigned char* out;
+    unsigned long out_length;
+    unsigned long adler;
+    int result;
+} png_deflate_band_t;
+
+// Bands shared by the deflate threads, taken in order under the lock
+typedef struct {
+    png_deflate_band_t* bands;
+    unsigned count;
+    unsigned next;
+    int level;
+    pthread_mutex_t lock;
+} png_deflate_job_t;
+
+// Deflate one band as raw deflate. Every band but the last ends on a byte boundary with a sync flush,
+// and each is primed with the input before it, so the bands join into one stream that compresses
+// almost as well as a single deflate.
+static void png_deflate_band(png_deflate_band_t* band, int level) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    band->result = PNG_ZLIB_ERROR;
+
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+
+    if (band->dictionary_length)
+        deflateSetDictionary(&stream, band->data - band->dictionary_length, band->dictionary_length);
+
+    // The bound covers stored blocks; the sync flush marker adds at most a few bytes more.
+    unsigned long bound = deflateBound(&stream, band->length) + 16;
+    band->out = png_alloc(bound);
+    if (!band->out) {
+        deflateEnd(&stream);
+        band->result = PNG_MEMORY_ERROR;
+        return;
+    }
+
+    stream.next_in = (unsigned char*)band->data;
+    stream.avail_in = band->length;
+    stream.next_out = band->out;
+    stream.avail_out = (unsigned)bound;
+
+    int status = deflate(&stream, band->last ? Z_FINISH : Z_SYNC_FLUSH);
+    if ((band->last && status == Z_STREAM_END) || (!band->last && status == Z_OK && stream.avail_in == 0 && stream.avail_out > 0)) {
+        band->out_length = bound - stream.avail_out;
+        band->adler = adler32(adler32(0L, Z_NULL, 0), band->data, band->length);
+        band->result = PNG_NO_ERROR;
+    }
+    deflateEnd(&stream);
+}
+
+// Deflate bands until none are left
+static void* png_deflate_worker(void* argument) {
+    png_deflate_job_t* job = argument;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        unsigned index = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (index >= job->count)
+            return 0;
+        png_deflate_band(&job->bands[index], job->level);
+    }
+}
+
+// Write one IDAT chunk from up to three pieces, so the zlib header and trailer need no copy
+static void png_write_idat_pieces(png_t* png, const unsigned char* head, unsigned head_length, const unsigned char* body,
+                                  unsigned long body_length, const unsigned char* tail, unsigned tail_length) {
+    unsigned long crc = crc32(0L, (const unsigned char*)"IDAT", 4);
+    crc = crc32(crc, head, head_length);
+    crc = crc32(crc, body, (unsigned int)body_length);
+    crc = crc32(crc, tail, tail_length);
+
+    file_write_ul(png, (unsigned)(head_length + body_length + tail_length));
+    file_write(png, "IDAT", 1, 4);
+    file_write(png, (void*)head, 1, head_length);
+    file_write(png, (void*)body, 1, body_length);
+    file_write(png, (void*)tail, 1, tail_length);
+    file_write_ul(png, (unsigned)crc);
+}
+
+// Write IDAT chunks (compressed image data) to the file.
+// The filtered rows are cut into bands deflated in parallel, one IDAT chunk per band.
 static int png_write_idats(png_t* png, unsigned char* data) {
-    unsigned char* chunk;
-    unsigned long written;
-    unsigned long crc;
-    unsigned size = png->width * png->height * png->bpp + png->height;
-    unsigned chunk_size = (unsigned)compressBound(size);
-
-    chunk = png_alloc(chunk_size + 4);
-    memcpy(chunk, "IDAT", 4);
-
-    written = chunk_size;
-    compress(chunk + 4, &written, data, size);
-
-    crc = crc32(0L, Z_NULL, 0);
-    crc = (unsigned long)crc32(crc, chunk, (unsigned int)(written + 4));
-    set_ul(chunk + written + 4, (unsigned int)crc);
-    file_write_ul(png, (unsigned int)written);
-    file_write(png, chunk, 1, written + 8);
-    png_free(chunk);
-
-    file_write_ul(png, 0);
-    file_write(png, "IEND", 1, 4);
-    crc = crc32(0L, (const unsigned char*)"IEND", 4);
-    file_write_ul(png, (unsigned int)crc);
+    unsigned row_bytes = png->width * png->bpp + 1;
+    unsigned rows_per_band = PNG_DEFLATE_BAND_BYTES / row_bytes;
+    png_deflate_job_t job;
+    unsigned threads = png->compression_threads;
+    unsigned i;
+    int result = PNG_NO_ERROR;
 
-    return PNG_NO_ERROR;
+    if (rows_per_band == 0)
+        rows_per_band = 1;
+
+    job.count = png->height ? (png->height + rows_per_band - 1) / rows_per_band : 1;
+    job.next = 0;
+    job.level = png->compression_level;
+    job.bands = png_alloc(job.count * sizeof(png_deflate_band_t));
+    if (!job.bands)
+        return PNG_MEMORY_ERROR;
+
+    for (i = 0; i < job.count; i++) {
+        unsigned first = i * rows_per_band;
+        unsigned count = (first + rows_per_band <= png->height) ? rows_per_band : png->height - first;
+        unsigned offset = first * row_bytes;
+        png_deflate_band_t* band = &job.bands[i];
+
+        memset(band, 0, sizeof(*band));
+        band->data = data + offset;
+        band->length = count * row_bytes;
+        band->dictionary_length = (offset < PNG_DEFLATE_WINDOW) ? offset : PNG_DEFLATE_WINDOW;
+        band->last = (i + 1 == job.count);
+    }
+
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (online > 0) ? (unsigned)online : 1;
+    }
+    if (threads > job.count)
+        threads = job.count;
+
+    // Run the bands on this thread when there is only one, or no threads can be started.
+    pthread_t* workers = (threads > 1) ? png_alloc(threads * sizeof(pthread_t)) : 0;
+    unsigned started = 0;
+    pthread_mutex_init(&job.lock, 0);
+    if (workers) {
+        for (started = 0; started < threads; started++) {
+            if (pthread_create(&workers[started], 0, png_deflate_worker, &job) != 0)
+                break;
+        }
+    }
+    png_deflate_worker(&job);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], 0);
+    }
+    pthread_mutex_destroy(&job.lock);
+    if (workers)
+        png_free(workers);
+
+    for (i = 0; i < job.count; i++) {
+        if (job.bands[i].result != PNG_NO_ERROR)
+            result = job.bands[i].result;
+    }
+
+    if (result == PNG_NO_ERROR) {
+        // zlib header for a 32K window, with the level hint and check bits a reader expects.
+        int level = (job.level < 0) ? 6 : job.level;
+        unsigned char header[2] = {0x78, (unsigned char)((level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6)};
+        header[1] += (unsigned char)(31 - (header[0] * 256 + header[1]) % 31);
+
+        unsigned char trailer[4];
+        unsigned long adler = adler32(0L, Z_NULL, 0);
+        for (i = 0; i < job.count; i++) {
+            adler = adler32_combine(adler, job.bands[i].adler, job.bands[i].length);
+        }
+        set_ul(trailer, (unsigned)adler);
+
+        for (i = 0; i < job.count; i++) {
+            png_write_idat_pieces(png, header, (i == 0) ? 2 : 0, job.bands[i].out, job.bands[i].out_length,
+                                  trailer, (i + 1 == job.count) ? 4 : 0);
+        }
+
+        file_write_ul(png, 0);
+        file_write(png, "IEND", 1, 4);
+        file_write_ul(png, (unsigned)crc32(0L, (const unsigned char*)"IEND", 4));
+    }
+
+    for (i = 0; i < job.count; i++) {
+        if (job.bands[i].out)
+            png_free(job.bands[i].out);
+    }
+    png_free(job.bands);
+
+    return result;
 }
 
-// Read IDAT chunks (compressed image data) from the file
-static int png_read_idat(png_t* png, unsigned length) {
+// Read the body of an IDAT chunk into the read buffer and check its CRC
+static int png_read_idat_data(png_t* png, unsigned length) {
 #if DO_CRC_CHECKS
     unsigned orig_crc, calc_crc;
 #endif
@@ -506,6 +682,15 @@ static int png_read_idat(png_t* png, unsigned length) {
     file_read_ul(png);  // Skip CRC check if disabled
 #endif
 
+    return PNG_NO_ERROR;
+}
+
+// Read IDAT chunks (compressed image data) from the file
+static int png_read_idat(png_t* png, unsigned length) {
+    int result = png_read_idat_data(png, length);
+    if (result != PNG_NO_ERROR)
+        return result;
+
     return png_inflate(png, png->readbuf, length);  // Inflate the data
 }
 
@@ -629,61 +814,458 @@ static void png_filter_paeth(int stride, unsigned char* in, unsigned char* out,
     }
 }
 
-// Apply PNG filters (placeholder, not implemented)
+// Unfilter kernels for 3 and 4 byte pixels. Every pixel depends on the one decoded before it, so they go
+// a pixel at a time with its bytes side by side in one register, instead of a byte at a time with
+// branches. They are inlined with a constant stride, and every pixel but the last of a 3 byte row is
+// moved with 4 byte loads and stores; the extra byte written is overwritten by the next pixel.
+#if PNG_UNFILTER_SSE2 || PNG_UNFILTER_NEON
+static int png_unfilter_simd = 1;  // Changed only by png_set_unfilter_simd, before decoding starts
+#else
+static int png_unfilter_simd = 0;
+#endif
+
+static inline unsigned png_load_pixel(const unsigned char* p, int stride, int i, int len) {
+    unsigned v;
+    if (stride == 4 || i + 4 <= len) {
+        memcpy(&v, p + i, 4);
+        return v;
+    }
+    return p[i] | (p[i + 1] << 8) | (p[i + 2] << 16);
+}
+
+static inline void png_store_pixel(unsigned char* p, unsigned v, int stride, int i, int len) {
+    if (stride == 4 || i + 4 <= len) {
+        memcpy(p + i, &v, 4);
+    } else {
+        p[i] = (unsigned char)v;
+        p[i + 1] = (unsigned char)(v >> 8);
+        p[i + 2] = (unsigned char)(v >> 16);
+    }
+}
+
+#if PNG_UNFILTER_SSE2
+
+static inline void png_unfilter_sub_sse2(int stride, const unsigned char* in, unsigned char* out, int len) {
+    __m128i a = _mm_setzero_si128();
+    int i;
+
+    for (i = 0; i < len; i += stride) {
+        a = _mm_add_epi8(a, _mm_cvtsi32_si128((int)png_load_pixel(in, stride, i, len)));
+        png_store_pixel(out, (unsigned)_mm_cvtsi128_si32(a), stride, i, len);
+    }
+}
+
+static inline void png_unfilter_average_sse2(int stride, const unsigned char* in, unsigned char* out, const unsigned char* prev_line, int len) {
+    __m128i a = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi8(1);
+    int i;
+
+    for (i = 0; i < len; i += stride) {
+        __m128i b = _mm_cvtsi32_si128((int)png_load_pixel(prev_line, stride, i, len));
+        // _mm_avg_epu8 rounds up, so take off the bit it rounded with.
+        __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        a = _mm_add_epi8(_mm_cvtsi32_si128((int)png_load_pixel(in, stride, i, len)), average);
+        png_store_pixel(out, (unsigned)_mm_cvtsi128_si32(a), stride, i, len);
+    }
+}
+
+static inline __m128i png_select_sse2(__m128i mask, __m128i chosen, __m128i other) {
+    return _mm_or_si128(_mm_and_si128(mask, chosen), _mm_andnot_si128(mask, other));
+}
+
+// The Paeth predictor on 16 bit lanes. With p = a + b - c the three distances are |b - c|, |a - c|
+// and |a + b - 2c|, and ties go to a, then b, then c.
+static inline __m128i png_paeth_sse2(__m128i a, __m128i b, __m128i c, __m128i pa, __m128i pb, __m128i pc) {
+    __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    return png_select_sse2(_mm_cmpeq_epi16(smallest, pa), a,
+                           png_select_sse2(_mm_cmpeq_epi16(smallest, pb), b, c));
+}
+
+static inline void png_unfilter_paeth_sse2(int stride, const unsigned char* in, unsigned char* out, const unsigned char* prev_line, int len) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i a = zero;
+    __m128i c = zero;
+    int i;
+
+    for (i = 0; i < len; i += stride) {
+        __m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)png_load_pixel(prev_line, stride, i, len)), zero);
+        __m128i pa = _mm_sub_epi16(b, c);
+        __m128i pb = _mm_sub_epi16(a, c);
+        __m128i pc = _mm_add_epi16(pa, pb);
+        __m128i predicted;
+
+        pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+        pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+        pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+        predicted = png_paeth_sse2(a, b, c, pa, pb, pc);
+        predicted = _mm_add_epi8(_mm_cvtsi32_si128((int)png_load_pixel(in, stride, i, len)), _mm_packus_epi16(predicted, predicted));
+        png_store_pixel(out, (unsigned)_mm_cvtsi128_si32(predicted), stride, i, len);
+        a = _mm_unpacklo_epi8(predicted, zero);
+        c = b;
+    }
+}
+
+#endif
+
+#if PNG_UNFILTER_SSSE3
+
+// Whether the processor has SSSE3, checked once by whichever decoding thread needs it first.
+static int png_has_ssse3 = 0;
+static pthread_once_t png_ssse3_checked = PTHREAD_ONCE_INIT;
+
+static void png_check_ssse3(void) {
+    png_has_ssse3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
+}
+
+// Paeth again with the SSSE3 absolute value, which shortens the chain from one pixel to the next.
+__attribute__((target("ssse3")))
+static inline void png_unfilter_paeth_ssse3_stride(int stride, const unsigned char* in, unsigned char* out, const unsigned char* prev_line, int len) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i a = zero;
+    __m128i c = zero;
+    int i;
+
+    for (i = 0; i < len; i += stride) {
+        __m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)png_load_pixel(prev_line, stride, i, len)), zero);
+        __m128i pa = _mm_sub_epi16(b, c);
+        __m128i pb = _mm_sub_epi16(a, c);
+        __m128i pc = _mm_add_epi16(pa, pb);
+        __m128i predicted = png_paeth_sse2(a, b, c, _mm_abs_epi16(pa), _mm_abs_epi16(pb), _mm_abs_epi16(pc));
+
+        predicted = _mm_add_epi8(_mm_cvtsi32_si128((int)png_load_pixel(in, stride, i, len)), _mm_packus_epi16(predicted, predicted));
+        png_store_pixel(out, (unsigned)_mm_cvtsi128_si32(predicted), stride, i, len);
+        a = _mm_unpacklo_epi8(predicted, zero);
+        c = b;
+    }
+}
+
+__attribute__((target("ssse3")))
+static void png_unfilter_paeth_ssse3(int stride, const unsigned char* in, unsigned char* out, const unsigned char* prev_line, int len) {
+    if (stride == 3)
+        png_unfilter_paeth_ssse3_stride(3, in, out, prev_line, len);
+    else
+        png_unfilter_paeth_ssse3_stride(4, in, out, prev_line, len);
+}
+
+#endif
+
+#if PNG_UNFILTER_NEON
+
+static inline uint8x8_t png_neon_pixel(const unsigned char* p, int stride, int i, int len) {
+    return vreinterpret_u8_u32(vdup_n_u32(png_load_pixel(p, stride, i, len)));
+}
+
+static inline void png_unfilter_sub_neon(int stride, const unsigned char* in, unsigned char* out, int len) {
+    uint8x8_t a = vdup_n_u8(0);
+    int i;
+
+    for (i = 0; i < len; i += stride) {
+        a = vadd_u8(a, png_neon_pixel(in, stride, i, len));
+        png_store_pixel(out, vget_lane_u32(vreinterpret_u32_u8(a), 0), stride, i, len);
+    }
+}
+
+static inline void png_unfilter_average_neon(int stride, const unsigned char* in, unsigned char* out, const unsigned char* prev_line, int len) {
+    uint8x8_t a = vdup_n_u8(0);
+    int i;
+
+    for (i = 0; i < len; i += stride) {
+        a = vadd_u8(png_neon_pixel(in, stride, i, len), vhadd_u8(a, png_neon_pixel(prev_line, stride, i, len)));
+        png_store_pixel(out, vget_lane_u32(vreinterpret_u32_u8(a), 0), stride, i, len);
+    }
+}
+
+static inline void png_unfilter_paeth_neon(int stride, const unsigned char* in, unsigned char* out, const unsigned char* prev_line, int len) {
+    uint8x8_t a = vdup_n_u8(0);
+    uint8x8_t c = vdup_n_u8(0);
+    int i;
+
+    for (i = 0; i < len; i += stride) {
+        uint8x8_t b = png_neon_pixel(prev_line, stride, i, len);
+        uint16x8_t pa = vabdl_u8(b, c);
+        uint16x8_t pb = vabdl_u8(a, c);
+        uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vaddl_u8(c, c));
+        uint8x8_t choose_a = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+        uint8x8_t choose_b = vmovn_u16(vcleq_u16(pb, pc));
+
+        a = vadd_u8(png_neon_pixel(in, stride, i, len), vbsl_u8(choose_a, a, vbsl_u8(choose_b, b, c)));
+        png_store_pixel(out, vget_lane_u32(vreinterpret_u32_u8(a), 0), stride, i, len);
+        c = b;
+    }
+}
+
+#endif
+
+// Choose between the SIMD and scalar unfilter kernels
+int png_set_unfilter_simd(int enabled) {
+#if PNG_UNFILTER_SSE2 || PNG_UNFILTER_NEON
+    png_unfilter_simd = enabled ? 1 : 0;
+#else
+    png_unfilter_simd = 0;
+#endif
+    return png_unfilter_simd;
+}
+
+// Unfilter a row with the SIMD kernels for its filter and stride. Returns 0 when there is no kernel
+// for them, leaving the row to the scalar code; None and Up need none, being copies and a plain add.
+static int png_unfilter_row_simd(int filter, int stride, const unsigned char* in, unsigned char* out, const unsigned char* prev_line, int len) {
+#if PNG_UNFILTER_SSE2 || PNG_UNFILTER_NEON
+    if (!png_unfilter_simd || (stride != 3 && stride != 4) || (filter != 1 && !prev_line))
+        return 0;
+
+#if PNG_UNFILTER_SSE2
+    switch (filter) {
+        case 1:
+            if (stride == 3)
+                png_unfilter_sub_sse2(3, in, out, len);
+            else
+                png_unfilter_sub_sse2(4, in, out, len);
+            return 1;
+        case 3:
+            if (stride == 3)
+                png_unfilter_average_sse2(3, in, out, prev_line, len);
+            else
+                png_unfilter_average_sse2(4, in, out, prev_line, len);
+            return 1;
+        case 4:
+#if PNG_UNFILTER_SSSE3
+            pthread_once(&png_ssse3_checked, png_check_ssse3);
+            if (png_has_ssse3) {
+                png_unfilter_paeth_ssse3(stride, in, out, prev_line, len);
+                return 1;
+            }
+#endif
+            if (stride == 3)
+                png_unfilter_paeth_sse2(3, in, out, prev_line, len);
+            else
+                png_unfilter_paeth_sse2(4, in, out, prev_line, len);
+            return 1;
+    }
+#else
+    switch (filter) {
+        case 1:
+            if (stride == 3)
+                png_unfilter_sub_neon(3, in, out, len);
+            else
+                png_unfilter_sub_neon(4, in, out, len);
+            return 1;
+        case 3:
+            if (stride == 3)
+                png_unfilter_average_neon(3, in, out, prev_line, len);
+            else
+                png_unfilter_average_neon(4, in, out, prev_line, len);
+            return 1;
+        case 4:
+            if (stride == 3)
+                png_unfilter_paeth_neon(3, in, out, prev_line, len);
+            else
+                png_unfilter_paeth_neon(4, in, out, prev_line, len);
+            return 1;
+    }
+#endif
+#endif
+    return 0;
+}
+
+// Filter kernels for writing, the inverse of the ones above. Each takes the raw row, the raw row above
+// (all zero for the first row) and the bytes per pixel. They have no branches in the loop and no
+// dependency from one byte to the next, so the compiler turns them into vector code.
+static void png_encode_sub(int stride, const unsigned char* in, unsigned char* out, int len) {
+    int i;
+    for (i = 0; i < stride && i < len; i++)
+        out[i] = in[i];
+    for (; i < len; i++)
+        out[i] = (unsigned char)(in[i] - in[i - stride]);
+}
+
+static void png_encode_up(const unsigned char* in, unsigned char* out, const unsigned char* prev_line, int len) {
+    int i;
+    for (i = 0; i < len; i++)
+        out[i] = (unsigned char)(in[i] - prev_line[i]);
+}
+
+static void png_encode_average(int stride, const unsigned char* in, unsigned char* out, const unsigned char* prev_line, int len) {
+    int i;
+    for (i = 0; i < stride && i < len; i++)
+        out[i] = (unsigned char)(in[i] - (prev_line[i] >> 1));
+    for (; i < len; i++)
+        out[i] = (unsigned char)(in[i] - ((in[i - stride] + prev_line[i]) >> 1));
+}
+
+static void png_encode_paeth(int stride, const unsigned char* in, unsigned char* out, const unsigned char* prev_line, int len) {
+    int i;
+    for (i = 0; i < stride && i < len; i++)
+        out[i] = (unsigned char)(in[i] - prev_line[i]);  // With a and c zero the predictor is b
+    for (; i < len; i++) {
+        int a = in[i - stride], b = prev_line[i], c = prev_line[i - stride];
+        int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+        int pr = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+        out[i] = (unsigned char)(in[i] - pr);
+    }
+}
+
+// Sum of the filtered bytes taken as signed magnitudes, the usual estimate of how well a row compresses
+static unsigned png_filter_cost(const unsigned char* row, int len) {
+    unsigned sum = 0;
+    int i;
+    for (i = 0; i < len; i++)
+        sum += (unsigned)abs((signed char)row[i]);
+    return sum;
+}
+
+// Filter a raw row every way into candidates, four rows for Sub, Up, Average and Paeth, and return the
+// filter with the smallest cost, 0 if the raw row itself is cheapest
+static int png_filter_row(int stride, const unsigned char* row, const unsigned char* prev_line, unsigned char* candidates, int len) {
+    unsigned best_cost = png_filter_cost(row, len);
+    int best = 0;
+    int filter;
+
+    png_encode_sub(stride, row, candidates, len);
+    png_encode_up(row, candidates + len, prev_line, len);
+    png_encode_average(stride, row, candidates + 2 * len, prev_line, len);
+    png_encode_paeth(stride, row, candidates + 3 * len, prev_line, len);
+
+    for (filter = 1; filter <= 4; filter++) {
+        unsigned cost = png_filter_cost(candidates + (size_t)(filter - 1) * len, len);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = filter;
+        }
+    }
+    return best;
+}
+
+// Deflated size at level 1 of a sample of the rows, filtered per row or left raw. Blocks of rows spread
+// over the image keep some of the vertical context deflate would see.
+static unsigned long png_filter_sample(png_t* png, unsigned char* data, int filtered, unsigned char* candidates,
+                                       const unsigned char* zero_line, unsigned char* sample, unsigned char* out, unsigned long out_size) {
+    int len = png->width * png->bpp;
+    unsigned long sample_length = 0;
+    unsigned long written = out_size;
+    int block;
+    unsigned y;
+
+    for (block = 0; block < PNG_FILTER_SAMPLE_BLOCKS; block++) {
+        unsigned first = (unsigned)((unsigned long)png->height * block / PNG_FILTER_SAMPLE_BLOCKS);
+        for (y = first; y < first + PNG_FILTER_SAMPLE_ROWS && y < png->height; y++) {
+            unsigned char* row = data + (size_t)y * (len + 1) + 1;
+            int filter = filtered ? png_filter_row(png->bpp, row, y ? row - (len + 1) : zero_line, candidates, len) : 0;
+
+            sample[sample_length++] = (unsigned char)filter;
+            memcpy(sample + sample_length, filter ? candidates + (size_t)(filter - 1) * len : row, len);
+            sample_length += len;
+        }
+    }
+
+    if (compress2(out, &written, sample, sample_length, 1) != Z_OK)
+        return 0;
+    return written;
+}
+
+// Apply PNG filters to the rows laid out by png_set_data, each a filter byte of 0 followed by the raw row.
+// Every row takes whichever of None, Sub, Up, Average and Paeth has the smallest cost. That estimate is
+// poor for flat colored images like our maps, where deflate already matches the repeated pixels of raw
+// rows and filtering makes files over half as big again, so a sample of rows is first deflated both
+// ways and the image is left unfiltered if that is smaller. Rows are filtered in place from the bottom
+// up, so the row above is still raw when each row is filtered.
 static int png_filter(png_t* png, unsigned char* data) {
+    int len = png->width * png->bpp;
+    unsigned long sample_size = (unsigned long)(len + 1) * PNG_FILTER_SAMPLE_BLOCKS * PNG_FILTER_SAMPLE_ROWS;
+    unsigned long out_size = compressBound(sample_size);
+    unsigned char* candidates;
+    unsigned char* zero_line;
+    unsigned char* sample;
+    unsigned char* out;
+    unsigned long raw_size, filtered_size;
+    int use_filters;
+    int y;
+
+    // A stored stream gains nothing from filtering.
+    if (png->compression_level == Z_NO_COMPRESSION || png->height == 0)
+        return PNG_NO_ERROR;
+
+    candidates = png_alloc((size_t)len * 5 + sample_size + out_size);
+    if (!candidates)
+        return PNG_MEMORY_ERROR;  // The rows stay unfiltered, which is still a valid PNG
+    zero_line = candidates + (size_t)len * 4;
+    sample = zero_line + len;
+    out = sample + sample_size;
+    memset(zero_line, 0, len);
+
+    raw_size = png_filter_sample(png, data, 0, candidates, zero_line, sample, out, out_size);
+    filtered_size = png_filter_sample(png, data, 1, candidates, zero_line, sample, out, out_size);
+    use_filters = filtered_size && filtered_size < raw_size;
+
+    for (y = (int)png->height - 1; use_filters && y >= 0; y--) {
+        unsigned char* row = data + (size_t)y * (len + 1) + 1;
+        int filter = png_filter_row(png->bpp, row, y ? row - (len + 1) : zero_line, candidates, len);
+
+        if (filter) {
+            memcpy(row, candidates + (size_t)(filter - 1) * len, len);
+            row[-1] = (unsigned char)filter;
+        }
+    }
+
+    png_free(candidates);
+    return PNG_NO_ERROR;
+}
+
+// Remove the PNG filter from one scanline; prev_line is 0 for the first row
+static int png_unfilter_row(png_t* png, unsigned char filter, unsigned char* in, unsigned char* out, unsigned char* prev_line) {
+    unsigned i;
+    int stride = png->bpp;
+    int len = png->width * stride;
+
+    if (png->depth == 16) {
+        for (i = 0; i < (unsigned)len; i += 2) {
+            *(short*)(in + i) = (in[i] << 8) | in[i + 1];
+        }
+    }
+
+    if (png->depth == 8 && png_unfilter_row_simd(filter, stride, in, out, prev_line, len))
+        return PNG_NO_ERROR;
+
+    switch (filter) {
+        case 0:  // None filter
+            memcpy(out, in, len);
+            break;
+        case 1:  // Sub filter
+            png_filter_sub(stride, in, out, len);
+            break;
+        case 2:  // Up filter
+            png_filter_up(stride, in, out, prev_line, len);
+            break;
+        case 3:  // Average filter
+            png_filter_average(stride, in, out, prev_line, len);
+            break;
+        case 4:  // Paeth filter
+            png_filter_paeth(stride, in, out, prev_line, len);
+            break;
+        default:
+            return PNG_UNKNOWN_FILTER;  // Unknown filter type
+    }
+
     return PNG_NO_ERROR;
 }
 
 // Remove PNG filters from decompressed data
 static int png_unfilter(png_t* png, unsigned char* data) {
-    unsigned i;
     unsigned pos = 0;
     unsigned outpos = 0;
     unsigned char* filtered = png->png_data;
-
-    int stride = png->bpp;
+    unsigned rowlen = png->width * png->bpp;
 
     while (pos < png->png_datalen) {
         unsigned char filter = filtered[pos];
+        int result;
         pos++;
 
-        if (png->depth == 16) {
-            for (i = 0; i < png->width * stride; i += 2) {
-                *(short*)(filtered + pos + i) = (filtered[pos + i] << 8) | filtered[pos + i + 1];
-            }
-        }
-
-        switch (filter) {
-            case 0:  // None filter
-                memcpy(data + outpos, filtered + pos, png->width * stride);
-                break;
-            case 1:  // Sub filter
-                png_filter_sub(stride, filtered + pos, data + outpos, png->width * stride);
-                break;
-            case 2:  // Up filter
-                if (outpos)
-                    png_filter_up(stride, filtered + pos, data + outpos, data + outpos - (png->width * stride), png->width * stride);
-                else
-                    png_filter_up(stride, filtered + pos, data + outpos, 0, png->width * stride);
-                break;
-            case 3:  // Average filter
-                if (outpos)
-                    png_filter_average(stride, filtered + pos, data + outpos, data + outpos - (png->width * stride), png->width * stride);
-                else
-                    png_filter_average(stride, filtered + pos, data + outpos, 0, png->width * stride);
-                break;
-            case 4:  // Paeth filter
-                if (outpos)
-                    png_filter_paeth(stride, filtered + pos, data + outpos, data + outpos - (png->width * stride), png->width * stride);
-                else
-                    png_filter_paeth(stride, filtered + pos, data + outpos, 0, png->width * stride);
-                break;
-            default:
-                return PNG_UNKNOWN_FILTER;  // Unknown filter type
-        }
+        result = png_unfilter_row(png, filter, filtered + pos, data + outpos, outpos ? data + outpos - rowlen : 0);
+        if (result != PNG_NO_ERROR)
+            return result;
 
-        outpos += png->width * stride;
-        pos += png->width * stride;
+        outpos += rowlen;
+        pos += rowlen;
     }
 
     return PNG_NO_ERROR;
@@ -722,6 +1304,176 @@ int png_get_data(png_t* png, unsigned char* data) {
     return result;
 }
 
+// State of a scanline-at-a-time decode
+typedef struct {
+    unsigned char* filtered;   // One filtered scanline, filter byte first
+    unsigned filled;           // Bytes of the filtered scanline inflated so far
+    unsigned rowlen;           // Filter byte plus width * bpp
+    unsigned char* rows;       // The caller's ring of two unfiltered rows, or the whole image
+    size_t row_stride;         // Bytes from one row of rows to the next
+    int ring;                  // Rows alternate between the two halves of rows
+    unsigned y;                // Next row to be delivered
+    png_row_callback_t callback;
+    void* user_pointer;
+} png_row_state_t;
+
+// Inflate the read buffer a scanline at a time, unfiltering and delivering each row as it completes
+static int png_inflate_rows(png_t* png, png_row_state_t* state, unsigned len) {
+    int result;
+#if USE_ZLIB
+    z_stream* stream = png->zs;
+#else
+    zl_stream* stream = png->zs;
+#endif
+
+    if (!stream)
+        return PNG_MEMORY_ERROR;  // Error if stream is not initialized
+
+    stream->next_in = png->readbuf;
+    stream->avail_in = len;
+
+    while (state->y < png->height) {
+        unsigned space = state->rowlen - state->filled;
+        unsigned consumed = stream->avail_in;
+
+        stream->next_out = state->filtered + state->filled;
+        stream->avail_out = space;
+
+#if USE_ZLIB
+        result = inflate(stream, Z_SYNC_FLUSH);
+#else
+        result = z_inflate(stream);
+#endif
+
+        if (result != Z_STREAM_END && result != Z_OK && result != Z_BUF_ERROR) {
+            printf("%s\n", stream->msg);
+            return PNG_ZLIB_ERROR;  // Error if inflation fails
+        }
+
+        state->filled += space - stream->avail_out;
+        consumed -= stream->avail_in;
+
+        if (state->filled == state->rowlen) {
+            unsigned row = state->ring ? (state->y & 1) : state->y;
+            unsigned prev_row = state->ring ? ((state->y - 1) & 1) : state->y - 1;
+            unsigned char* out = state->rows + row * state->row_stride;
+            unsigned char* prev = state->y ? state->rows + prev_row * state->row_stride : 0;
+
+            result = png_unfilter_row(png, state->filtered[0], state->filtered + 1, out, prev);
+            if (result != PNG_NO_ERROR)
+                return result;
+
+            if (state->callback) {
+                result = state->callback(out, state->y, state->user_pointer);
+                if (result != PNG_NO_ERROR)
+                    return result;
+            }
+
+            state->y++;
+            state->filled = 0;
+        } else if (stream->avail_in == 0 || (consumed == 0 && space == stream->avail_out) || result == Z_STREAM_END) {
+            break;  // Needs the next IDAT chunk, or the stream has ended
+        }
+    }
+
+    return PNG_NO_ERROR;
+}
+
+// Decode the opened PNG a scanline at a time into rows described by the state
+static int png_decode_rows(png_t* png, png_row_state_t* state) {
+    int result = PNG_NO_ERROR;
+
+    png->zs = NULL;
+    png->png_datalen = 0;
+    png->png_data = NULL;
+    png->readbuf = NULL;
+    png->readbuflen = 0;
+
+    state->rowlen = png->width * png->bpp + 1;
+    state->filtered = png_alloc(state->rowlen);
+    state->filled = 0;
+    state->y = 0;
+
+    if (!state->filtered)
+        return PNG_MEMORY_ERROR;
+
+    while (result == PNG_NO_ERROR) {
+        unsigned type;
+        unsigned length;
+
+        file_read_ul(png, &length);  // Read chunk length
+
+        if (file_read(png, &type, 1, 4) != 4) {
+            result = PNG_FILE_ERROR;  // Error if unable to read chunk type
+        } else if (type == *(unsigned int*)"IDAT") {
+            if (!png->zs)
+                result = png_init_inflate(png);
+            if (result == PNG_NO_ERROR)
+                result = png_read_idat_data(png, length);
+            if (result == PNG_NO_ERROR)
+                result = png_inflate_rows(png, state, length);
+        } else if (type == *(unsigned int*)"IEND") {
+            result = PNG_DONE;
+        } else {
+            file_read(png, 0, 1, length + 4);  // Skip unknown chunks
+        }
+    }
+
+    if (png->readbuf) {
+        png_free(png->readbuf);
+        png->readbuflen = 0;
+    }
+    if (png->zs) {
+        png_end_inflate(png);  // Finalize inflation
+    }
+    png_free(state->filtered);
+
+    if (result != PNG_DONE)
+        return result;
+
+    return (state->y == png->height) ? PNG_NO_ERROR : PNG_EOF_ERROR;
+}
+
+// Decode the opened PNG a scanline at a time into the caller's ring of two rows
+int png_get_rows(png_t* png, unsigned char* rows, png_row_callback_t callback, void* user_pointer) {
+    png_row_state_t state;
+
+    if (!rows || !callback)
+        return PNG_WRONG_ARGUMENTS;
+
+    state.rows = rows;
+    state.row_stride = png->width * png->bpp;
+    state.ring = 1;
+    state.callback = callback;
+    state.user_pointer = user_pointer;
+    return png_decode_rows(png, &state);
+}
+
+// Decode the opened PNG straight into rows row_stride bytes apart, each unfiltered against the one above
+int png_get_data_stride(png_t* png, unsigned char* data, size_t row_stride) {
+    png_row_state_t state;
+
+    if (!data || row_stride < (size_t)png->width * png->bpp)
+        return PNG_WRONG_ARGUMENTS;
+
+    state.rows = data;
+    state.row_stride = row_stride;
+    state.ring = 0;
+    state.callback = NULL;
+    state.user_pointer = NULL;
+    return png_decode_rows(png, &state);
+}
+
+// Set the compression level and deflate threads used by png_set_data
+int png_set_compression(png_t* png, int level, unsigned threads) {
+    if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION)
+        return PNG_WRONG_ARGUMENTS;
+
+    png->compression_level = level;
+    png->compression_threads = threads;
+    return PNG_NO_ERROR;
+}
+
 // Set image data and write it to a PNG file
 int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int color, unsigned char* data) {
     int i;
@@ -739,13 +1491,13 @@ int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int co
         memcpy(&filtered[i * png->width * png->bpp + i + 1], data + i * png->width * png->bpp, png->width * png->bpp);
     }
 
-    png_filter(png, filtered);  // Apply filters (placeholder)
+    png_filter(png, filtered);  // Choose a filter for every row
     png_write_ihdr(png);        // Write IHDR chunk
-    png_write_idats(png, filtered);  // Write IDAT chunks
+    int result = png_write_idats(png, filtered);  // Write IDAT chunks
 
     png_free(filtered);
 
-    return PNG_NO_ERROR;
+    return result;
 }
 
 // Convert error codes to human-readable strings
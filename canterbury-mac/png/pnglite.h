@@ -74,6 +74,7 @@ enum
 
 typedef unsigned (*png_write_callback_t)(void* input, size_t size, size_t numel, void* user_pointer);
 typedef unsigned (*png_read_callback_t)(void* output, size_t size, size_t numel, void* user_pointer);
+typedef int (*png_row_callback_t)(unsigned char* row, unsigned y, void* user_pointer);
 typedef void (*png_free_t)(void* p);
 typedef void * (*png_alloc_t)(size_t s);
 
@@ -98,6 +99,9 @@ typedef struct
 
 	unsigned char*			readbuf;
 	unsigned			readbuflen;
+
+	int				compression_level;		/* zlib level 0-9, -1 for zlib's default */
+	unsigned			compression_threads;		/* threads deflating row bands, 0 for one per core */
 } png_t;
 
 /*
@@ -210,6 +214,90 @@ char* png_error_string(int error);
 
 int png_get_data(png_t* png, unsigned char* data);
 
+/*
+	Function: png_get_rows
+
+	This function decodes the opened png file one scanline at a time, so the whole image is never held in memory.
+	Each scanline is inflated and unfiltered into rows, a buffer owned by the caller that holds two rows:
+
+	> 2*width*(bytes per pixel)
+
+	The rows alternate between the two halves of the buffer, as unfiltering a row needs the one above it. The
+	callback is called once per row, top to bottom, and should copy out whatever it needs before returning:
+
+	> int (*png_row_callback_t)(unsigned char* row, unsigned y, void* user_pointer)
+
+	Returning anything but PNG_NO_ERROR from the callback stops decoding and is passed back to the caller.
+
+	Parameters:
+		rows - Ring of two rows to decode into.
+		callback - Called with each decoded row.
+		user_pointer - User pointer to be passed to callback.
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise an error code.
+*/
+
+int png_get_rows(png_t* png, unsigned char* rows, png_row_callback_t callback, void* user_pointer);
+
+/*
+	Function: png_get_data_stride
+
+	This function decodes the opened png file like png_get_data, but into rows that may be further apart
+	than a row of the png, such as an image whose rows are padded. Each scanline is unfiltered straight
+	into its place in data, against the row above it there, so nothing is copied and no other image sized
+	buffer is allocated. Required size will be:
+
+	> (height-1)*row_stride + width*(bytes per pixel)
+
+	Bytes between the end of one row and the start of the next are left as they are.
+
+	Parameters:
+		data - Where to store result.
+		row_stride - Bytes from the start of one row to the start of the next, at least width*(bytes per pixel).
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise an error code.
+*/
+
+int png_get_data_stride(png_t* png, unsigned char* data, size_t row_stride);
+
+/*
+	Function: png_set_compression
+
+	This function sets how png_set_data compresses the image. The filtered image is cut into bands of rows
+	that are deflated on separate threads and written as one IDAT chunk each, together forming a single
+	zlib stream that any PNG reader accepts. Call it after opening the png for writing.
+
+	Parameters:
+		level - zlib compression level, 0 (store) to 9 (smallest), or -1 for zlib's default. 1 is
+			much faster than the default for debugging dumps.
+		threads - Threads to deflate with, 0 for one per processor.
+
+	Returns:
+		PNG_NO_ERROR, or PNG_WRONG_ARGUMENTS for a level out of range.
+*/
+
+int png_set_compression(png_t* png, int level, unsigned threads);
+
+/*
+	Function: png_set_unfilter_simd
+
+	This function turns the SIMD unfilter kernels on or off for every png decoded afterwards. They
+	are on by default wherever the processor has them and cover the Sub, Average and Paeth filters
+	of 8 bit images with 3 or 4 bytes per pixel. Turning them off decodes with the scalar kernels,
+	which is only useful for checking one against the other. The setting is shared by every thread,
+	so change it only while no other thread is decoding.
+
+	Parameters:
+		enabled - 0 for the scalar kernels, anything else for SIMD where available.
+
+	Returns:
+		1 if SIMD kernels will be used, 0 otherwise.
+*/
+
+int png_set_unfilter_simd(int enabled);
+
 int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int color, unsigned char* data);
 
 /*
@@ -226,8 +314,14 @@ int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int co
 
 unsigned char * read_png_file(char * filename, png_t * ptr);
 
+int read_png_header(char * filename, png_t * ptr);
+
+int read_png_pixels(png_t * ptr, unsigned char * target, size_t stride, unsigned target_bpp);
+
 int write_png_file(char* filename, int width, int height, unsigned char *buffer);
 
+int write_png_file_level(char* filename, int width, int height, unsigned char *buffer, int level);
+
 int png_close_file(png_t* png);
 
 #ifdef __cplusplus
@@ -1,16 +1,45 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zlib.h>
 #include "pnglite.h"
 
-/// Reads a PNG file and decodes its pixel data.
+// Destination for rows decoded by read_png_pixels when the layouts differ
+typedef struct {
+    unsigned char *buffer; // First target row
+    size_t stride;         // Bytes from one target row to the next
+    unsigned target_bpp;   // 3 for RGB, 4 for RGBX
+    unsigned width;
+    unsigned bpp;
+} png_rgb_target;
+
+/// Copies one decoded row into the target, keeping red, green and blue and filling any fourth byte.
+/// - Parameter row: The decoded row, `width * bpp` bytes.
+/// - Parameter y: The index of the row.
+/// - Parameter user_pointer: The `png_rgb_target` being filled.
+/// - Returns: `PNG_NO_ERROR` to keep decoding.
+static int png_row_to_rgb(unsigned char *row, unsigned y, void *user_pointer) {
+    png_rgb_target *target = (png_rgb_target *)user_pointer;
+    unsigned char *out = target->buffer + (size_t)y * target->stride;
+
+    // Convert RGBA (or other formats) to RGB or RGBX
+    for (unsigned i = 0; i < target->width; i++) {
+        out[target->target_bpp * i] = row[i * target->bpp];         // Red
+        out[target->target_bpp * i + 1] = row[i * target->bpp + 1]; // Green
+        out[target->target_bpp * i + 2] = row[i * target->bpp + 2]; // Blue
+        if (target->target_bpp == 4) {
+            out[4 * i + 3] = (target->bpp == 4) ? row[i * 4 + 3] : 0xFF; // Alpha, or opaque
+        }
+    }
+    return PNG_NO_ERROR;
+}
+
+/// Opens a PNG file and reads its header, so the caller can size the target before decoding.
 /// - Parameter filename: The path to the PNG file.
 /// - Parameter ptr: A pointer to the `png_t` structure to store the PNG file information.
-/// - Returns: A pointer to the decoded pixel data (RGB format). Returns `NULL` on failure.
-unsigned char *read_png_file(char *filename, png_t *ptr) {
+/// - Returns: 0 with the file left open for `read_png_pixels`, 1 on failure.
+int read_png_header(char *filename, png_t *ptr) {
     int retval;
-    unsigned char *buffer = NULL; // Buffer to store the raw pixel data
-    unsigned char *buffer2 = NULL; // Buffer to store RGB data (if conversion is needed)
 
     // Initialize the PNG library
     png_init(0, 0);
@@ -33,77 +62,125 @@ unsigned char *read_png_file(char *filename, png_t *ptr) {
             case PNG_NOT_SUPPORTED: printf("PNG format not supported\n"); break;
             case PNG_WRONG_ARGUMENTS: printf("Wrong arguments\n"); break;
         }
-        return NULL; // Return NULL on failure
+        return 1;
     }
 
     // Ensure the PNG has at least 3 bytes per pixel (RGB)
     if (ptr->bpp < 3) {
         printf("Not enough bytes per pixel\n");
-        return NULL;
+        png_close_file(ptr);
+        return 1;
     }
+    return 0;
+}
 
-    // Allocate memory for the raw pixel data
-    buffer = (unsigned char *)malloc(ptr->width * ptr->height * ptr->bpp);
-    if (!buffer) {
-        printf("Memory allocation failed\n");
-        return NULL;
-    }
+/// Decodes the PNG opened by `read_png_header` into the caller's pixels and closes it.
+/// When the target has the PNG's own layout every row is unfiltered in place, with no copy and no
+/// other buffer; otherwise rows go through a ring of two and are converted as they arrive.
+/// - Parameter ptr: The `png_t` filled by `read_png_header`.
+/// - Parameter target: The first row of the target, at least `height` rows of `stride` bytes.
+/// - Parameter stride: Bytes from one target row to the next, which may include padding.
+/// - Parameter target_bpp: 3 for RGB or 4 for RGBX, whose fourth byte is the alpha or 255.
+/// - Returns: 0 on success, 1 on failure.
+int read_png_pixels(png_t *ptr, unsigned char *target, size_t stride, unsigned target_bpp) {
+    int retval;
 
-    // Decode the PNG data into the buffer
-    png_get_data(ptr, buffer);
+    if ((target_bpp != 3 && target_bpp != 4) || stride < (size_t)ptr->width * target_bpp) {
+        printf("%s\n", png_error_string(PNG_WRONG_ARGUMENTS));
+        png_close_file(ptr);
+        return 1;
+    }
 
-    // If the PNG has more than 3 bytes per pixel (e.g., RGBA), convert it to RGB
-    if (ptr->bpp > 3) {
-        int i, j = 0;
-        buffer2 = (unsigned char *)malloc(ptr->width * ptr->height * 3); // Allocate memory for RGB data
-        if (!buffer2) {
+    if (ptr->bpp == target_bpp) {
+        retval = png_get_data_stride(ptr, target, stride);
+    } else {
+        png_rgb_target rgb = {target, stride, target_bpp, ptr->width, ptr->bpp};
+        unsigned char *rows = (unsigned char *)malloc((size_t)ptr->width * ptr->bpp * 2); // Ring of two decoded rows
+        if (!rows) {
             printf("Memory allocation failed\n");
-            free(buffer);
-            return NULL;
+            png_close_file(ptr);
+            return 1;
         }
+        retval = png_get_rows(ptr, rows, png_row_to_rgb, &rgb);
+        free(rows);
+    }
+    png_close_file(ptr);
 
-        // Convert RGBA (or other formats) to RGB
-        for (i = 0; i < ptr->width * ptr->height * ptr->bpp; i += ptr->bpp, j += 3) {
-            buffer2[j] = buffer[i];     // Red
-            buffer2[j + 1] = buffer[i + 1]; // Green
-            buffer2[j + 2] = buffer[i + 2]; // Blue
-        }
+    if (retval != PNG_NO_ERROR) {
+        printf("%s\n", png_error_string(retval));
+        return 1;
+    }
+    return 0;
+}
+
+/// Reads a PNG file and decodes its pixel data into a new packed RGB buffer.
+/// - Parameter filename: The path to the PNG file.
+/// - Parameter ptr: A pointer to the `png_t` structure to store the PNG file information.
+/// - Returns: A pointer to the decoded pixel data (RGB format). Returns `NULL` on failure.
+unsigned char *read_png_file(char *filename, png_t *ptr) {
+    unsigned char *buffer = NULL; // Buffer to store the RGB data
 
-        free(buffer); // Free the original buffer
-        buffer = buffer2; // Use the RGB buffer
+    if (read_png_header(filename, ptr) != 0) {
+        return NULL;
+    }
+
+    // Allocate memory for the RGB data
+    buffer = (unsigned char *)malloc((size_t)ptr->width * ptr->height * 3);
+    if (!buffer) {
+        printf("Memory allocation failed\n");
+        png_close_file(ptr);
+        return NULL;
+    }
+
+    // Decode the PNG data row by row into the buffer
+    if (read_png_pixels(ptr, buffer, (size_t)ptr->width * 3, 3) != 0) {
+        free(buffer);
+        return NULL;
     }
 
     return buffer; // Return the decoded pixel data
 }
 
-/// Writes a PNG file from pixel data.
+/// Writes a PNG file from pixel data, deflated on every processor at the given level.
 /// - Parameter filename: The name of the output PNG file.
 /// - Parameter width: The width of the image.
 /// - Parameter height: The height of the image.
 /// - Parameter buffer: The pixel data buffer (RGB format).
+/// - Parameter level: The zlib compression level, 0 to 9, or -1 for the default. 1 is much faster for debugging dumps.
 /// - Returns: 0 on success, 1 on failure.
-int write_png_file(char *filename, int width, int height, unsigned char *buffer) {
+int write_png_file_level(char *filename, int width, int height, unsigned char *buffer, int level) {
     png_t png;
-    FILE *fp = fopen(filename, "wb");
-
-    // Check if the file was opened successfully
-    if (fp == NULL) {
-        fprintf(stderr, "Could not open file %s for writing\n", filename);
-        return 1;
-    }
-    fclose(fp); // Close the file as `pnglite` will handle writing
+    int retval;
 
     // Initialize the PNG library
     png_init(0, 0);
 
     // Open the file for writing
-    png_open_file_write(&png, filename);
+    if (png_open_file_write(&png, filename) != PNG_NO_ERROR) {
+        fprintf(stderr, "Could not open file %s for writing\n", filename);
+        return 1;
+    }
 
     // Write the pixel data to the PNG file
-    png_set_data(&png, width, height, 8, PNG_TRUECOLOR, buffer);
+    png_set_compression(&png, level, 0);
+    retval = png_set_data(&png, width, height, 8, PNG_TRUECOLOR, buffer);
 
     // Close the PNG file
     png_close_file(&png);
 
+    if (retval != PNG_NO_ERROR) {
+        fprintf(stderr, "Failed to write %s: %s\n", filename, png_error_string(retval));
+        return 1;
+    }
     return 0; // Success
 }
+
+/// Writes a PNG file from pixel data at the default compression level.
+/// - Parameter filename: The name of the output PNG file.
+/// - Parameter width: The width of the image.
+/// - Parameter height: The height of the image.
+/// - Parameter buffer: The pixel data buffer (RGB format).
+/// - Returns: 0 on success, 1 on failure.
+int write_png_file(char *filename, int width, int height, unsigned char *buffer) {
+    return write_png_file_level(filename, width, height, buffer, -1);
+}
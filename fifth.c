@@ -3,8 +3,11 @@
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+// Build with the shared line file code: cc fifth.c canterbury-mac/core1940/linefile.c -lm -o fifth
+#include "canterbury-mac/core1940/linefile.h"
 
-#define MAX_LINES 100000
 #define DISTANCE_THRESHOLD 10.0 // Threshold for considering lines "close by"
 #define GRADIENT_THRESHOLD 0.1  // Threshold for considering gradients "similar"
 
@@ -48,82 +51,229 @@ bool areLinesClose(LineInfo line1, LineInfo line2) {
     return startDistance < DISTANCE_THRESHOLD && endDistance < DISTANCE_THRESHOLD && gradientsSimilar;
 }
 
-// Function to read lines from a JSON file.
-int readLinesFromJSON(const char *filename, LineInfo *lines) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Failed to open JSON file for reading.\n");
-        return 0;
+// How lines are picked from the input.
+typedef enum {
+    SAMPLE_STRIDE,    // Every stride-th line: the stride-th, twice the stride-th and so on.
+    SAMPLE_RESERVOIR, // A uniform random choice of count lines, kept in input order.
+    SAMPLE_GRID       // The first line whose midpoint falls in each cell of a square grid.
+} SampleMode;
+
+typedef struct {
+    SampleMode mode;
+    size_t stride;
+    size_t count;
+    int cellSize;
+    uint64_t seed;
+} SampleOptions;
+
+// A binary line file or JSON output, appended to one line at a time.
+typedef struct {
+    bool binary;
+    LineFileWriter lineFile;
+    LineJSONWriter json;
+} LineSink;
+
+static bool openLineSink(LineSink *sink, const char *filename) {
+    sink->binary = isLineFileName(filename);
+    return sink->binary ? openLineFile(&sink->lineFile, filename, NULL, 0) : openLineJSON(&sink->json, filename, false, false);
+}
+
+static void appendLineSink(LineSink *sink, LineRecord line) {
+    if (sink->binary) {
+        appendLineFile(&sink->lineFile, line);
+    } else {
+        appendLineJSON(&sink->json, line);
+    }
+}
+
+static bool closeLineSink(LineSink *sink) {
+    return sink->binary ? closeLineFile(&sink->lineFile) : closeLineJSON(&sink->json);
+}
+
+// Function to step a splitmix64 generator, for the reservoir.
+static uint64_t nextRandom(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// A line held in the reservoir with its place in the input.
+typedef struct {
+    size_t index;
+    LineRecord line;
+} ReservoirEntry;
+
+static int compareReservoirEntry(const void *a, const void *b) {
+    size_t index1 = ((const ReservoirEntry *)a)->index;
+    size_t index2 = ((const ReservoirEntry *)b)->index;
+    return (index1 > index2) - (index1 < index2);
+}
+
+// The grid cells that already have a line, as an open-addressing set that doubles when half full.
+typedef struct {
+    uint64_t *cells; // Cell keys plus one, 0 marks a free slot.
+    size_t mask;
+    size_t count;
+} CellSet;
+
+// Cell coordinate of a pixel coordinate, rounding towards negative infinity.
+static int64_t gridCell(int64_t value, int cellSize) {
+    return (value >= 0) ? value / cellSize : -((-value + cellSize - 1) / cellSize);
+}
+
+static size_t cellSlot(const CellSet *set, uint64_t key) {
+    size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 20) & set->mask;
+    while (set->cells[slot] != 0 && set->cells[slot] != key) {
+        slot = (slot + 1) & set->mask;
     }
+    return slot;
+}
 
-    char buffer[1024];
-    int lineCount = 0;
-
-    while (fgets(buffer, sizeof(buffer), file)) {
-        if (strstr(buffer, "\"startX\":")) {
-            sscanf(buffer, "    \"startX\": %d,", &lines[lineCount].startX);
-            fgets(buffer, sizeof(buffer), file); // Read next line
-            sscanf(buffer, "    \"startY\": %d,", &lines[lineCount].startY);
-            fgets(buffer, sizeof(buffer), file); // Read next line
-            sscanf(buffer, "    \"endX\": %d,", &lines[lineCount].endX);
-            fgets(buffer, sizeof(buffer), file); // Read next line
-            sscanf(buffer, "    \"endY\": %d,", &lines[lineCount].endY);
-            fgets(buffer, sizeof(buffer), file); // Read next line
-            sscanf(buffer, "    \"color\": {\"r\": %d, \"g\": %d, \"b\": %d}", &lines[lineCount].color.r, &lines[lineCount].color.g, &lines[lineCount].color.b);
-
-            // Calculate gradient for the line
-            lines[lineCount].gradient = calculateGradient(lines[lineCount]);
-            lineCount++;
+// Function to add a cell to the set. Returns true if it was not there before, false if it was or on failure.
+static bool addCell(CellSet *set, uint64_t key, bool *failed) {
+    if ((set->count + 1) * 2 > set->mask + 1) {
+        size_t capacity = (set->mask + 1) * 2;
+        CellSet grown = {calloc(capacity, sizeof(uint64_t)), capacity - 1, set->count};
+        if (!grown.cells) {
+            *failed = true;
+            return false;
+        }
+        for (size_t i = 0; i <= set->mask; i++) {
+            if (set->cells[i]) {
+                grown.cells[cellSlot(&grown, set->cells[i])] = set->cells[i];
+            }
         }
+        free(set->cells);
+        *set = grown;
     }
 
-    fclose(file);
-    return lineCount;
+    size_t slot = cellSlot(set, key);
+    if (set->cells[slot] == key) {
+        return false;
+    }
+    set->cells[slot] = key;
+    set->count++;
+    return true;
 }
 
-// Function to write every fifth line to a JSON file.
-void writeEveryFifthLineToJSON(const char *filename, LineInfo *lines, int lineCount) {
-    FILE *file = fopen(filename, "w");
-    if (!file) {
-        fprintf(stderr, "Failed to open JSON file for writing.\n");
-        return;
+// Function to thin a line file in one pass, reading and writing a line at a time. Stride and grid
+// sampling keep nothing but the grid's occupied cells; the reservoir keeps the lines it has chosen.
+// Returns the number of lines written, with the number read in lineCount, or -1 on failure.
+static long long sampleLines(const char *inputFile, const char *outputFile, const SampleOptions *options, size_t *lineCount) {
+    LineReader reader;
+    LineSink sink;
+    *lineCount = 0;
+
+    if (!openLineReader(&reader, inputFile)) {
+        return -1;
+    }
+    if (!openLineSink(&sink, outputFile)) {
+        closeLineReader(&reader);
+        return -1;
     }
 
-    fprintf(file, "[\n");
-    for (int i = 0; i < lineCount; i++) {
-        if ((i + 1) % 5 == 0) { // Select every fifth line note (5th, 10th, 15th, etc.)
-            fprintf(file, "  {\n");
-            fprintf(file, "    \"startX\": %d,\n", lines[i].startX);
-            fprintf(file, "    \"startY\": %d,\n", lines[i].startY);
-            fprintf(file, "    \"endX\": %d,\n", lines[i].endX);
-            fprintf(file, "    \"endY\": %d,\n", lines[i].endY);
-            fprintf(file, "    \"color\": {\"r\": %d, \"g\": %d, \"b\": %d}\n", lines[i].color.r, lines[i].color.g, lines[i].color.b);
-            fprintf(file, "  }%s\n", (i < lineCount - 1) ? "," : "");
+    ReservoirEntry *reservoir = NULL;
+    CellSet cells = {NULL, 0, 0};
+    uint64_t random = options->seed;
+    bool failed = false;
+    size_t written = 0;
+    LineRecord line;
+
+    if (options->mode == SAMPLE_RESERVOIR) {
+        reservoir = malloc((options->count + 1) * sizeof(ReservoirEntry));
+        failed = !reservoir;
+    } else if (options->mode == SAMPLE_GRID) {
+        cells.cells = calloc(1024, sizeof(uint64_t));
+        cells.mask = 1023;
+        failed = !cells.cells;
+    }
+
+    for (size_t i = 0; !failed && readLineRecord(&reader, &line); i++) {
+        if (options->mode == SAMPLE_STRIDE) {
+            if ((i + 1) % options->stride == 0) {
+                appendLineSink(&sink, line);
+                written++;
+            }
+        } else if (options->mode == SAMPLE_RESERVOIR) {
+            // Algorithm R: the i-th line replaces a random held one with probability count / (i + 1).
+            if (i < options->count) {
+                reservoir[written++] = (ReservoirEntry){i, line};
+            } else {
+                uint64_t slot = nextRandom(&random) % (i + 1);
+                if (slot < options->count) {
+                    reservoir[slot] = (ReservoirEntry){i, line};
+                }
+            }
+        } else {
+            int64_t cellX = gridCell(((int64_t)line.startX + line.endX) >> 1, options->cellSize);
+            int64_t cellY = gridCell(((int64_t)line.startY + line.endY) >> 1, options->cellSize);
+            uint64_t key = ((uint64_t)(uint32_t)cellX << 32 | (uint32_t)cellY) + 1;
+            if (addCell(&cells, key, &failed)) {
+                appendLineSink(&sink, line);
+                written++;
+            }
         }
     }
-    fprintf(file, "]\n");
 
-    fclose(file);
-}
+    if (options->mode == SAMPLE_RESERVOIR && !failed) {
+        qsort(reservoir, written, sizeof(ReservoirEntry), compareReservoirEntry);
+        for (size_t k = 0; k < written; k++) {
+            appendLineSink(&sink, reservoir[k].line);
+        }
+    }
 
-int main(int argc, const char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input_json> <output_json>\n", argv[0]);
-        return 1;
+    if (failed) {
+        fprintf(stderr, "Memory allocation failed\n");
     }
+    failed = failed || reader.failed;
+    *lineCount = reader.read;
+    failed = !closeLineSink(&sink) || failed;
+    closeLineReader(&reader);
+    free(cells.cells);
+    free(reservoir);
+    return failed ? -1 : (long long)written;
+}
 
-    const char *inputFile = argv[1];
-    const char *outputFile = argv[2];
+int main(int argc, const char *argv[]) {
+    SampleOptions options = {SAMPLE_STRIDE, 5, 0, 0, 1};
+    int i = 1;
 
-    LineInfo lines[MAX_LINES];
-    int lineCount = readLinesFromJSON(inputFile, lines);
+    for (; i < argc - 2; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc - 2) {
+            options.mode = SAMPLE_STRIDE;
+            options.stride = (size_t)strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc - 2) {
+            options.mode = SAMPLE_RESERVOIR;
+            options.count = (size_t)strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc - 2) {
+            options.mode = SAMPLE_GRID;
+            options.cellSize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc - 2) {
+            options.seed = strtoull(argv[++i], NULL, 10);
+        } else {
+            break;
+        }
+    }
 
-    printf("Read %d lines from JSON.\n", lineCount);
+    bool valid = (options.mode != SAMPLE_STRIDE || options.stride > 0) && (options.mode != SAMPLE_GRID || options.cellSize > 0);
+    if (argc - i != 2 || !valid) {
+        fprintf(stderr, "Usage: %s [-n stride | -r count [-s seed] | -g cell_size] <input_lines> <output_lines>\n", argv[0]);
+        fprintf(stderr, "Without options every fifth line is kept.\n");
+        return 1;
+    }
 
-    // Write every fifth line to the output file
-    writeEveryFifthLineToJSON(outputFile, lines, lineCount);
+    const char *inputFile = argv[i];
+    const char *outputFile = argv[i + 1];
 
-    printf("Every fifth line note has been written to %s.\n", outputFile);
+    // Stream the input; neither file is ever held in memory.
+    size_t lineCount;
+    long long written = sampleLines(inputFile, outputFile, &options, &lineCount);
+    if (written < 0) {
+        return 1;
+    }
 
+    printf("Read %zu lines from %s.\n", lineCount, inputFile);
+    printf("%lld sampled lines have been written to %s.\n", written, outputFile);
     return 0;
 }
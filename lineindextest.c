@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+// Checks the searches of the line index against a brute force pass over every line, on sets of lines
+// in the eight directions the extractor finds, sized to leave the last block of each level part full.
+// Queries include the whole int range, which reaches the empty boxes of those slots, and each set has
+// lines spanning the whole int32 range, whose cross products need more than 64 bits.
+// Build: cc -O2 lineindextest.c -lm -o lineindextest
+#include "canterbury-mac/core1940/lineindex.c"
+
+#define LINEINDEX_TEST_QUERIES 500 // Random rectangles and points for each set of lines
+#define LINEINDEX_TEST_EXTENT 1000 // Side of the area the ordinary lines lie in
+
+static uint64_t testSeed = 0x2545F4914F6CDD1Dull;
+
+// Function to draw the next value of a splitmix64 sequence.
+static uint64_t nextRandom(void) {
+    uint64_t z = (testSeed += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static int randomIn(int low, int high) {
+    return low + (int)(nextRandom() % (uint64_t)(high - low + 1));
+}
+
+static const RGB testColors[3] = {{{200, 30, 30}}, {{30, 30, 200}}, {{40, 40, 40}}};
+
+// Function to make a line of up to 60 pixels in one of the eight directions.
+static LineInfo randomLine(void) {
+    static const int steps[8][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {-1, -1}, {1, -1}, {-1, 1}};
+    int direction = randomIn(0, 7);
+    int length = randomIn(0, 60);
+    int x = randomIn(0, LINEINDEX_TEST_EXTENT), y = randomIn(0, LINEINDEX_TEST_EXTENT);
+    return (LineInfo){x, y, x + steps[direction][0] * length, y + steps[direction][1] * length, testColors[randomIn(0, 2)]};
+}
+
+// Function to narrow the steps [*first, *last] along a line to those whose coordinate on one axis lies
+// in [low, high], for a line starting at start and moving step, -1, 0 or 1, each time.
+static void clipSteps(int64_t start, int step, int64_t low, int64_t high, int64_t *first, int64_t *last) {
+    if (step == 0) {
+        if (start < low || start > high) {
+            *first = 1;
+            *last = 0;
+        }
+        return;
+    }
+    int64_t from = (step > 0) ? low - start : start - high;
+    int64_t to = (step > 0) ? high - start : start - low;
+    *first = (from > *first) ? from : *first;
+    *last = (to < *last) ? to : *last;
+}
+
+// Function to check whether a line meets a rectangle, inclusive of its edges. Every step of a line in
+// one of the eight directions lands on a pixel, and the steps inside the rectangle are a run whose ends
+// are whole numbers, so the line meets it exactly when that run is not empty.
+static int lineMeets(LineInfo line, int left, int top, int right, int bottom) {
+    int64_t dx = (int64_t)line.endX - line.startX, dy = (int64_t)line.endY - line.startY;
+    int stepX = (dx > 0) - (dx < 0), stepY = (dy > 0) - (dy < 0);
+    int64_t first = 0, last = (dx * stepX > dy * stepY) ? dx * stepX : dy * stepY;
+    clipSteps(line.startX, stepX, left, right, &first, &last);
+    clipSteps(line.startY, stepY, top, bottom, &first, &last);
+    return first <= last;
+}
+
+// Function to measure the squared distance from a point to a line.
+static double lineDistanceSquared(LineInfo line, double x, double y) {
+    double dx = (double)line.endX - line.startX, dy = (double)line.endY - line.startY;
+    double px = x - line.startX, py = y - line.startY;
+    double lengthSquared = dx * dx + dy * dy;
+    double t = (px * dx + py * dy) / (lengthSquared > 0.0 ? lengthSquared : 1.0);
+    t = (t > 0.0) ? t : 0.0;
+    t = (t < 1.0) ? t : 1.0;
+    px -= t * dx;
+    py -= t * dy;
+    return px * px + py * py;
+}
+
+static int sameColor(RGB a, RGB b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static int compareSizes(const void *a, const void *b) {
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to search the index and by brute force for one rectangle and color, returning 1 if they differ.
+static int checkSearch(const LineIndex *index, const LineInfo *lines, size_t count, int left, int top, int right,
+                       int bottom, const RGB *color, size_t *found, size_t *expected) {
+    size_t foundCount = lineIndexSearch(index, left, top, right, bottom, color, found, count);
+    size_t expectedCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        if ((!color || sameColor(lines[i].color, *color)) && lineMeets(lines[i], left, top, right, bottom)) {
+            expected[expectedCount++] = i;
+        }
+    }
+    if (foundCount != expectedCount) {
+        printf("  search %d %d %d %d found %zu lines, not %zu\n", left, top, right, bottom, foundCount, expectedCount);
+        return 1;
+    }
+    qsort(found, foundCount, sizeof(size_t), compareSizes);
+    if (memcmp(found, expected, foundCount * sizeof(size_t)) != 0) {
+        printf("  search %d %d %d %d found other lines\n", left, top, right, bottom);
+        return 1;
+    }
+    return 0;
+}
+
+// Function to find the nearest line with the index and by brute force, returning 1 if they differ.
+static int checkNearest(const LineIndex *index, const LineInfo *lines, size_t count, double x, double y, const RGB *color) {
+    double best = INFINITY;
+    for (size_t i = 0; i < count; i++) {
+        if (!color || sameColor(lines[i].color, *color)) {
+            double distance = lineDistanceSquared(lines[i], x, y);
+            best = (distance < best) ? distance : best;
+        }
+    }
+
+    size_t result;
+    double distance;
+    bool found = lineIndexNearest(index, x, y, color, &result, &distance);
+    if (found != (best < INFINITY)) {
+        printf("  nearest to %.1f %.1f %s a line\n", x, y, found ? "found" : "missed");
+        return 1;
+    }
+    if (found && (result >= count || lineDistanceSquared(lines[result], x, y) != best)) {
+        printf("  nearest to %.1f %.1f is not the closest line\n", x, y);
+        return 1;
+    }
+    return 0;
+}
+
+// Function to index a set of lines and check every kind of query against brute force.
+static int checkSet(size_t ordinary) {
+    size_t count = ordinary + 3;
+    LineInfo *lines = malloc(count * sizeof(LineInfo));
+    size_t *found = malloc(count * sizeof(size_t));
+    size_t *expected = malloc(count * sizeof(size_t));
+    if (!lines || !found || !expected) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < ordinary; i++) {
+        lines[i] = randomLine();
+    }
+    lines[ordinary] = (LineInfo){INT32_MIN + 1, INT32_MIN + 1, INT32_MAX, INT32_MAX, testColors[0]};
+    lines[ordinary + 1] = (LineInfo){INT32_MAX, INT32_MIN + 1, INT32_MIN + 1, INT32_MAX, testColors[1]};
+    lines[ordinary + 2] = (LineInfo){INT32_MIN, 500, INT32_MAX, 500, testColors[2]};
+
+    LineIndex index;
+    if (!lineIndexBuild(&index, lines, count)) {
+        exit(1);
+    }
+
+    int differ = 0;
+    for (int c = -1; c < 3; c++) {
+        const RGB *color = (c < 0) ? NULL : &testColors[c];
+        differ += checkSearch(&index, lines, count, INT_MIN, INT_MIN, INT_MAX, INT_MAX, color, found, expected);
+        differ += checkSearch(&index, lines, count, INT_MIN, 0, 500, INT_MAX, color, found, expected);
+        differ += checkSearch(&index, lines, count, 500, INT_MIN, INT_MAX, 400, color, found, expected);
+        for (int q = 0; q < LINEINDEX_TEST_QUERIES; q++) {
+            int left = randomIn(-50, LINEINDEX_TEST_EXTENT + 50), top = randomIn(-50, LINEINDEX_TEST_EXTENT + 50);
+            differ += checkSearch(&index, lines, count, left, top, left + randomIn(0, 80), top + randomIn(0, 80), color,
+                                  found, expected);
+            differ += checkNearest(&index, lines, count, randomIn(-50, LINEINDEX_TEST_EXTENT + 50) + 0.5,
+                                   randomIn(-50, LINEINDEX_TEST_EXTENT + 50) + 0.25, color);
+        }
+    }
+    printf("%6zu lines, %d levels, %d queries differ\n", count, index.levelCount, differ);
+
+    lineIndexFree(&index);
+    free(expected);
+    free(found);
+    free(lines);
+    return differ;
+}
+
+int main(void) {
+    static const size_t sizes[] = {0, 1, 13, 14, 20, 250, 253, 254, 4093, 5000};
+    int failures = 0;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        failures += checkSet(sizes[s]);
+    }
+
+    if (failures) {
+        printf("FAILED: %d queries differ between the index and brute force\n", failures);
+        return 1;
+    }
+    printf("Line index searches agree with brute force\n");
+    return 0;
+}
@@ -3,10 +3,19 @@
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Build with the shared line file code: cc reduction.c canterbury-mac/core1940/linefile.c -lm -lpthread -o reduction
+#include "canterbury-mac/core1940/linefile.h"
 
-#define MAX_LINES 100000
 #define DISTANCE_THRESHOLD 10.0 // Threshold for considering lines "close by"
 #define GRADIENT_THRESHOLD 0.1  // Threshold for considering gradients "similar"
+#define PAIRWISE_BENCHMARK_LIMIT 100000 // Largest benchmark size also run through the pairwise reducer
+#define SWEEP_GRADIENT_BUCKET (GRADIENT_THRESHOLD * 1.000001) // Gradient bucket, a hair wider than the threshold
+#define SWEEP_PARALLEL_MINIMUM 65536 // Smallest radix sort split across threads
 
 typedef struct {
     int r, g, b;
@@ -29,12 +38,13 @@ bool isColorEqual(RGB color1, RGB color2) {
     return color1.r == color2.r && color1.g == color2.g && color1.b == color2.b;
 }
 
-// Function to calculate the gradient of a line.
+// Function to calculate the gradient of a line. It is taken row over column, as when the line files
+// held the row in X: the duplicate rules are not symmetric in the axes, so this keeps the same lines.
 double calculateGradient(LineInfo line) {
-    if (line.endX == line.startX) {
-        return INFINITY; // Vertical line
+    if (line.endY == line.startY) {
+        return INFINITY; // Line along a row
     }
-    return (double)(line.endY - line.startY) / (double)(line.endX - line.startX);
+    return (double)(line.endX - line.startX) / (double)(line.endY - line.startY);
 }
 
 // Function to check if two lines are close to each other and have similar gradients.
@@ -48,64 +58,81 @@ bool areLinesClose(LineInfo line1, LineInfo line2) {
     return startDistance < DISTANCE_THRESHOLD && endDistance < DISTANCE_THRESHOLD && gradientsSimilar;
 }
 
-// Function to read lines from a JSON file.
-int readLinesFromJSON(const char *filename, LineInfo *lines) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Failed to open JSON file for reading.\n");
-        return 0;
+// Function to read lines from a binary line file or a JSON file into a heap array.
+LineInfo *readLinesFromFile(const char *filename, int *lineCount) {
+    LineView view;
+    *lineCount = 0;
+
+    if (!openLineView(filename, &view)) {
+        return NULL;
     }
 
-    char buffer[1024];
-    int lineCount = 0;
+    LineInfo *lines = malloc((view.count + 1) * sizeof(LineInfo));
+    if (!lines) {
+        fprintf(stderr, "Memory allocation failed\n");
+        closeLineView(&view);
+        return NULL;
+    }
 
-    while (fgets(buffer, sizeof(buffer), file)) {
-        if (strstr(buffer, "\"startX\":")) {
-            sscanf(buffer, "    \"startX\": %d,", &lines[lineCount].startX);
-            fgets(buffer, sizeof(buffer), file); // Read next line
-            sscanf(buffer, "    \"startY\": %d,", &lines[lineCount].startY);
-            fgets(buffer, sizeof(buffer), file); // Read next line
-            sscanf(buffer, "    \"endX\": %d,", &lines[lineCount].endX);
-            fgets(buffer, sizeof(buffer), file); // Read next line
-            sscanf(buffer, "    \"endY\": %d,", &lines[lineCount].endY);
-            fgets(buffer, sizeof(buffer), file); // Read next line
-            sscanf(buffer, "    \"color\": {\"r\": %d, \"g\": %d, \"b\": %d}", &lines[lineCount].color.r, &lines[lineCount].color.g, &lines[lineCount].color.b);
+    for (size_t i = 0; i < view.count; i++) {
+        LineRecord record = lineViewAt(&view, i);
+        lines[i].startX = record.startX;
+        lines[i].startY = record.startY;
+        lines[i].endX = record.endX;
+        lines[i].endY = record.endY;
+        lines[i].color = (RGB){record.r, record.g, record.b};
 
-            // Calculate gradient for the line
-            lines[lineCount].gradient = calculateGradient(lines[lineCount]);
-            lineCount++;
-        }
+        // Calculate gradient for the line
+        lines[i].gradient = calculateGradient(lines[i]);
     }
 
-    fclose(file);
-    return lineCount;
+    *lineCount = (int)view.count;
+    closeLineView(&view);
+    return lines;
+}
+
+// Function to write lines as a binary line file.
+void writeLinesToLineFile(const char *filename, LineInfo *lines, int lineCount) {
+    LineRecord *records = malloc((lineCount + 1) * sizeof(LineRecord));
+    if (!records) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return;
+    }
+
+    for (int i = 0; i < lineCount; i++) {
+        records[i] = (LineRecord){lines[i].startX, lines[i].startY, lines[i].endX, lines[i].endY,
+                                  (uint8_t)lines[i].color.r, (uint8_t)lines[i].color.g, (uint8_t)lines[i].color.b};
+    }
+    writeLineFile(filename, records, lineCount, NULL, 0);
+    free(records);
 }
 
 // Function to write lines to a JSON file.
 void writeLinesToJSON(const char *filename, LineInfo *lines, int lineCount) {
-    FILE *file = fopen(filename, "w");
-    if (!file) {
-        fprintf(stderr, "Failed to open JSON file for writing.\n");
+    LineJSONWriter writer;
+    if (!openLineJSON(&writer, filename, false, false)) {
         return;
     }
-
-    fprintf(file, "[\n");
     for (int i = 0; i < lineCount; i++) {
-        fprintf(file, "  {\n");
-        fprintf(file, "    \"startX\": %d,\n", lines[i].startX);
-        fprintf(file, "    \"startY\": %d,\n", lines[i].startY);
-        fprintf(file, "    \"endX\": %d,\n", lines[i].endX);
-        fprintf(file, "    \"endY\": %d,\n", lines[i].endY);
-        fprintf(file, "    \"color\": {\"r\": %d, \"g\": %d, \"b\": %d}\n", lines[i].color.r, lines[i].color.g, lines[i].color.b);
-        fprintf(file, "  }%s\n", (i < lineCount - 1) ? "," : "");
+        appendLineJSON(&writer, (LineRecord){lines[i].startX, lines[i].startY, lines[i].endX, lines[i].endY,
+                                             lines[i].color.r, lines[i].color.g, lines[i].color.b});
     }
-    fprintf(file, "]\n");
+    closeLineJSON(&writer);
+}
 
-    fclose(file);
+// Apply the duplicate rule to a close pair (i < j), favoring lines with non-integer gradients.
+static void markDuplicate(LineInfo *lines, bool *toRemove, int i, int j) {
+    if (fabs(lines[i].gradient - round(lines[i].gradient)) > GRADIENT_THRESHOLD) {
+        toRemove[j] = true; // Mark line j for removal.
+    } else if (fabs(lines[j].gradient - round(lines[j].gradient)) > GRADIENT_THRESHOLD) {
+        toRemove[i] = true; // Mark line i for removal.
+    } else {
+        toRemove[j] = true; // Default to removing line j if both have integer gradients.
+    }
 }
 
-// Function to remove near-duplicate lines, favoring lines with non-integer gradients.
-int removeNearDuplicateLines(LineInfo *lines, int lineCount) {
+// Reference pairwise reducer, O(n^2). Kept for the benchmark and to check the grid reducer.
+int removeNearDuplicateLinesPairwise(LineInfo *lines, int lineCount) {
     bool *toRemove = malloc(lineCount * sizeof(bool));
     memset(toRemove, 0, lineCount * sizeof(bool));
 
@@ -114,16 +141,501 @@ int removeNearDuplicateLines(LineInfo *lines, int lineCount) {
 
         for (int j = i + 1; j < lineCount; j++) {
             if (isColorEqual(lines[i].color, lines[j].color) && areLinesClose(lines[i], lines[j])) {
-                // Favor lines with non-integer gradients
-                if (fabs(lines[i].gradient - round(lines[i].gradient)) > GRADIENT_THRESHOLD) {
-                    toRemove[j] = true; // Mark line j for removal.
-                } else if (fabs(lines[j].gradient - round(lines[j].gradient)) > GRADIENT_THRESHOLD) {
-                    toRemove[i] = true; // Mark line i for removal.
-                } else {
-                    toRemove[j] = true; // Default to removing line j if both have integer gradients.
+                markDuplicate(lines, toRemove, i, j);
+            }
+        }
+    }
+
+    // Compact the array by removing marked lines.
+    int newLineCount = 0;
+    for (int i = 0; i < lineCount; i++) {
+        if (!toRemove[i]) {
+            lines[newLineCount++] = lines[i];
+        }
+    }
+
+    free(toRemove);
+    return newLineCount;
+}
+
+// A grid cell of DISTANCE_THRESHOLD pixels, partitioned by color.
+typedef struct {
+    int r, g, b;
+    int cellX, cellY;
+} GridKey;
+
+// A line bucketed into the grid by its start point.
+typedef struct {
+    GridKey key;
+    int index;
+} GridEntry;
+
+// A run of entries in the sorted entry array sharing the same key.
+typedef struct {
+    int start;
+    int count;
+} GridBucket;
+
+// Cell coordinate of a pixel coordinate, rounding towards negative infinity.
+static int gridCell(int value) {
+    return (int)floor(value / DISTANCE_THRESHOLD);
+}
+
+static int compareGridKey(const GridKey *a, const GridKey *b) {
+    if (a->r != b->r) return (a->r < b->r) ? -1 : 1;
+    if (a->g != b->g) return (a->g < b->g) ? -1 : 1;
+    if (a->b != b->b) return (a->b < b->b) ? -1 : 1;
+    if (a->cellY != b->cellY) return (a->cellY < b->cellY) ? -1 : 1;
+    if (a->cellX != b->cellX) return (a->cellX < b->cellX) ? -1 : 1;
+    return 0;
+}
+
+// Comparator ordering entries by key and then by line index.
+static int compareGridEntry(const void *a, const void *b) {
+    const GridEntry *e1 = (const GridEntry *)a;
+    const GridEntry *e2 = (const GridEntry *)b;
+    int result = compareGridKey(&e1->key, &e2->key);
+    if (result != 0) return result;
+    return (e1->index < e2->index) ? -1 : (e1->index > e2->index);
+}
+
+static uint32_t hashGridKey(const GridKey *key) {
+    uint32_t hash = 2166136261u;
+    int values[5] = {key->r, key->g, key->b, key->cellX, key->cellY};
+    for (int i = 0; i < 5; i++) {
+        hash = (hash ^ (uint32_t)values[i]) * 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+// Open-addressing table from grid key to bucket; slots hold bucket index + 1, 0 is empty.
+typedef struct {
+    int *slots;
+    uint32_t mask;
+    const GridEntry *entries;
+    const GridBucket *buckets;
+} GridTable;
+
+static const GridBucket *gridLookup(const GridTable *table, const GridKey *key) {
+    uint32_t slot = hashGridKey(key) & table->mask;
+    while (table->slots[slot]) {
+        const GridBucket *bucket = &table->buckets[table->slots[slot] - 1];
+        if (compareGridKey(&table->entries[bucket->start].key, key) == 0) {
+            return bucket;
+        }
+        slot = (slot + 1) & table->mask;
+    }
+    return NULL;
+}
+
+// Function to remove near-duplicate lines, favoring lines with non-integer gradients.
+// Lines are bucketed by color and start point into DISTANCE_THRESHOLD cells, so only
+// lines in the neighbouring cells are compared. The result matches the pairwise reducer.
+int removeNearDuplicateLines(LineInfo *lines, int lineCount) {
+    if (lineCount <= 0) {
+        return lineCount;
+    }
+
+    bool *toRemove = calloc(lineCount, sizeof(bool));
+    GridEntry *entries = malloc(lineCount * sizeof(GridEntry));
+    GridBucket *buckets = malloc(lineCount * sizeof(GridBucket));
+    uint32_t tableSize = 1;
+    while (tableSize < (uint32_t)lineCount * 2) {
+        tableSize <<= 1;
+    }
+    int *slots = calloc(tableSize, sizeof(int));
+    if (!toRemove || !entries || !buckets || !slots) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(toRemove);
+        free(entries);
+        free(buckets);
+        free(slots);
+        return lineCount;
+    }
+
+    // Bucket every line by its color and start cell.
+    for (int i = 0; i < lineCount; i++) {
+        entries[i].key = (GridKey){lines[i].color.r, lines[i].color.g, lines[i].color.b,
+                                   gridCell(lines[i].startX), gridCell(lines[i].startY)};
+        entries[i].index = i;
+    }
+    qsort(entries, lineCount, sizeof(GridEntry), compareGridEntry);
+
+    GridTable table = {slots, tableSize - 1, entries, buckets};
+    int bucketCount = 0;
+    for (int i = 0; i < lineCount; i++) {
+        if (i > 0 && compareGridKey(&entries[i - 1].key, &entries[i].key) == 0) {
+            buckets[bucketCount - 1].count++;
+            continue;
+        }
+        buckets[bucketCount] = (GridBucket){i, 1};
+        uint32_t slot = hashGridKey(&entries[i].key) & table.mask;
+        while (slots[slot]) {
+            slot = (slot + 1) & table.mask;
+        }
+        slots[slot] = ++bucketCount;
+    }
+
+    // Visit lines in input order so the marking matches the pairwise reducer.
+    for (int i = 0; i < lineCount; i++) {
+        if (toRemove[i]) continue; // Skip already marked lines.
+
+        GridKey key = {lines[i].color.r, lines[i].color.g, lines[i].color.b, 0, 0};
+        int cellX = gridCell(lines[i].startX);
+        int cellY = gridCell(lines[i].startY);
+
+        for (int offsetY = -1; offsetY <= 1; offsetY++) {
+            for (int offsetX = -1; offsetX <= 1; offsetX++) {
+                key.cellX = cellX + offsetX;
+                key.cellY = cellY + offsetY;
+                const GridBucket *bucket = gridLookup(&table, &key);
+                if (!bucket) continue;
+
+                // Entries in a bucket are sorted by index, so only later lines are visited.
+                for (int k = bucket->count - 1; k >= 0; k--) {
+                    int j = entries[bucket->start + k].index;
+                    if (j <= i) break;
+                    if (areLinesClose(lines[i], lines[j])) {
+                        markDuplicate(lines, toRemove, i, j);
+                    }
+                }
+            }
+        }
+    }
+
+    // Compact the array by removing marked lines.
+    int newLineCount = 0;
+    for (int i = 0; i < lineCount; i++) {
+        if (!toRemove[i]) {
+            lines[newLineCount++] = lines[i];
+        }
+    }
+
+    free(slots);
+    free(buckets);
+    free(entries);
+    free(toRemove);
+    return newLineCount;
+}
+
+// A line in the sweep order: the sort key and the line's index.
+typedef struct {
+    uint64_t key;
+    int index;
+} SweepEntry;
+
+// One thread's share of a radix sort pass.
+typedef struct {
+    const SweepEntry *source;
+    SweepEntry *target;
+    size_t start, end;
+    int shift;
+    size_t counts[256]; // Digit counts, turned into scatter offsets between the two steps.
+    bool scatter;
+} RadixWorker;
+
+static void *radixWorker(void *argument) {
+    RadixWorker *worker = (RadixWorker *)argument;
+    if (!worker->scatter) {
+        memset(worker->counts, 0, sizeof(worker->counts));
+        for (size_t i = worker->start; i < worker->end; i++) {
+            worker->counts[(worker->source[i].key >> worker->shift) & 0xFF]++;
+        }
+    } else {
+        for (size_t i = worker->start; i < worker->end; i++) {
+            worker->target[worker->counts[(worker->source[i].key >> worker->shift) & 0xFF]++] = worker->source[i];
+        }
+    }
+    return NULL;
+}
+
+// Run one step of a radix pass on every worker, the first on this thread.
+static void runRadixWorkers(RadixWorker *workers, int threadCount, bool scatter) {
+    pthread_t threads[threadCount];
+    int started = 1;
+    for (int t = 0; t < threadCount; t++) {
+        workers[t].scatter = scatter;
+    }
+    for (int t = 1; t < threadCount; t++) {
+        if (pthread_create(&threads[t], NULL, radixWorker, &workers[t]) != 0) {
+            break;
+        }
+        started++;
+    }
+    radixWorker(&workers[0]);
+    for (int t = 1; t < threadCount; t++) {
+        if (t < started) {
+            pthread_join(threads[t], NULL);
+        } else {
+            radixWorker(&workers[t]);
+        }
+    }
+}
+
+// Function to sort entries by the low keyBits of their keys with a stable LSD radix sort,
+// eight bits a pass. Each pass counts and scatters contiguous chunks on their own threads.
+// The sorted entries end up back in entries; scratch must hold as many.
+static void radixSortEntries(SweepEntry *entries, SweepEntry *scratch, size_t count, int keyBits, int threadCount) {
+    if (count < SWEEP_PARALLEL_MINIMUM || threadCount < 1) {
+        threadCount = 1;
+    }
+    RadixWorker workers[threadCount];
+
+    SweepEntry *source = entries;
+    SweepEntry *target = scratch;
+    for (int shift = 0; shift < keyBits; shift += 8) {
+        for (int t = 0; t < threadCount; t++) {
+            workers[t] = (RadixWorker){source, target, count * t / threadCount, count * (t + 1) / threadCount, shift, {0}, false};
+        }
+        runRadixWorkers(workers, threadCount, false);
+
+        // Skip a digit every entry shares.
+        size_t total[256] = {0};
+        for (int t = 0; t < threadCount; t++) {
+            for (int d = 0; d < 256; d++) {
+                total[d] += workers[t].counts[d];
+            }
+        }
+        bool constant = false;
+        for (int d = 0; d < 256; d++) {
+            constant = constant || total[d] == count;
+        }
+        if (constant) {
+            continue;
+        }
+
+        // Digit-major, chunk-minor offsets keep the pass stable.
+        size_t offset = 0;
+        for (int d = 0; d < 256; d++) {
+            for (int t = 0; t < threadCount; t++) {
+                size_t digitCount = workers[t].counts[d];
+                workers[t].counts[d] = offset;
+                offset += digitCount;
+            }
+        }
+        runRadixWorkers(workers, threadCount, true);
+
+        SweepEntry *swap = source;
+        source = target;
+        target = swap;
+    }
+
+    if (source != entries) {
+        memcpy(entries, source, count * sizeof(SweepEntry));
+    }
+}
+
+// Number of bits needed to hold values up to range.
+static int bitsFor(uint64_t range) {
+    int bits = 0;
+    while (bits < 64 && (range >> bits) != 0) {
+        bits++;
+    }
+    return bits;
+}
+
+// State shared by the sweep threads.
+typedef struct {
+    LineInfo *lines;
+    bool *toRemove;
+    const SweepEntry *entries;
+    const size_t *partitions; // Start of each color partition in entries, and the end.
+    size_t partitionCount;
+    int xBits; // Key bits below the gradient bucket.
+    int indexBits; // Bits of the largest line index.
+    size_t nextPartition;
+    pthread_mutex_t lock;
+} SweepJob;
+
+// Function to record a close pair, keyed by the earlier index so pairs can be replayed in input order.
+static bool pushPair(SweepEntry **pairs, size_t *count, size_t *capacity, int i, int j) {
+    if (*count == *capacity) {
+        size_t newCapacity = (*capacity) ? *capacity * 2 : 1024;
+        SweepEntry *grown = realloc(*pairs, newCapacity * sizeof(SweepEntry));
+        if (!grown) {
+            return false;
+        }
+        *pairs = grown;
+        *capacity = newCapacity;
+    }
+    (*pairs)[(*count)++] = (i < j) ? (SweepEntry){(uint64_t)i, j} : (SweepEntry){(uint64_t)j, i};
+    return true;
+}
+
+// Function to sweep color partitions until none are left. Within a partition the entries run by
+// gradient bucket and then startX, so every close partner of an entry is ahead of it in its own
+// bucket or inside a startX window of the next bucket, and both windows only ever move forward.
+static void *sweepWorker(void *argument) {
+    SweepJob *job = (SweepJob *)argument;
+    const SweepEntry *entries = job->entries;
+    LineInfo *lines = job->lines;
+    uint64_t xMask = ((uint64_t)1 << job->xBits) - 1;
+    SweepEntry *pairs = NULL;
+    SweepEntry *scratch = NULL;
+    size_t pairCapacity = 0;
+    size_t scratchCapacity = 0;
+    bool failed = false;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t partition = job->nextPartition++;
+        pthread_mutex_unlock(&job->lock);
+        if (partition >= job->partitionCount || failed) {
+            break;
+        }
+
+        size_t first = job->partitions[partition];
+        size_t last = job->partitions[partition + 1];
+        size_t pairCount = 0;
+        size_t next = first; // Start of the window in the next bucket.
+
+        for (size_t a = first; a < last && !failed; a++) {
+            LineInfo line = lines[entries[a].index];
+            uint64_t bucket = entries[a].key >> job->xBits;
+            int64_t x = (int64_t)(entries[a].key & xMask);
+
+            for (size_t b = a + 1; b < last && (entries[b].key >> job->xBits) == bucket; b++) {
+                if ((int64_t)(entries[b].key & xMask) - x >= DISTANCE_THRESHOLD) break;
+                int j = entries[b].index;
+                if (isColorEqual(line.color, lines[j].color) && areLinesClose(line, lines[j])) {
+                    failed = !pushPair(&pairs, &pairCount, &pairCapacity, entries[a].index, j);
                 }
             }
+
+            // Bring the next bucket's window up to this entry's startX.
+            if (next <= a) {
+                next = a + 1;
+            }
+            while (next < last && ((entries[next].key >> job->xBits) <= bucket ||
+                                   ((entries[next].key >> job->xBits) == bucket + 1 &&
+                                    x - (int64_t)(entries[next].key & xMask) >= DISTANCE_THRESHOLD))) {
+                next++;
+            }
+            for (size_t b = next; b < last && (entries[b].key >> job->xBits) == bucket + 1; b++) {
+                if ((int64_t)(entries[b].key & xMask) - x >= DISTANCE_THRESHOLD) break;
+                int j = entries[b].index;
+                if (isColorEqual(line.color, lines[j].color) && areLinesClose(line, lines[j])) {
+                    failed = !pushPair(&pairs, &pairCount, &pairCapacity, entries[a].index, j);
+                }
+            }
+        }
+        if (failed) {
+            break;
+        }
+
+        // Replay the pairs in input order, as the pairwise reducer meets them.
+        if (pairCount > scratchCapacity) {
+            SweepEntry *grown = realloc(scratch, pairCount * sizeof(SweepEntry));
+            if (!grown) {
+                failed = true;
+                break;
+            }
+            scratch = grown;
+            scratchCapacity = pairCount;
+        }
+        radixSortEntries(pairs, scratch, pairCount, job->indexBits, 1);
+        for (size_t p = 0; p < pairCount;) {
+            int i = (int)pairs[p].key;
+            bool skip = job->toRemove[i];
+            for (; p < pairCount && (int)pairs[p].key == i; p++) {
+                if (!skip) {
+                    markDuplicate(lines, job->toRemove, i, pairs[p].index);
+                }
+            }
+        }
+    }
+
+    if (failed) {
+        fprintf(stderr, "Memory allocation failed\n");
+    }
+    free(scratch);
+    free(pairs);
+    return NULL;
+}
+
+// Function to remove near-duplicate lines by sorting and sweeping, for very large batches.
+// Lines are radix sorted by color, gradient bucket and startX, then each color partition is
+// swept on its own thread with windows bounded by DISTANCE_THRESHOLD and GRADIENT_THRESHOLD.
+// Vertical lines have an infinite gradient and are never close, so they are left out.
+// The result matches the pairwise reducer.
+int removeNearDuplicateLinesSweep(LineInfo *lines, int lineCount, int threadCount) {
+    if (lineCount <= 0) {
+        return lineCount;
+    }
+    if (threadCount <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = (cores > 0) ? (int)cores : 1;
+    }
+
+    bool *toRemove = calloc(lineCount, sizeof(bool));
+    SweepEntry *entries = malloc(lineCount * sizeof(SweepEntry));
+    SweepEntry *scratch = malloc(lineCount * sizeof(SweepEntry));
+    size_t *partitions = malloc((lineCount + 1) * sizeof(size_t));
+    if (!toRemove || !entries || !scratch || !partitions) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(toRemove);
+        free(entries);
+        free(scratch);
+        free(partitions);
+        return lineCount;
+    }
+
+    // Work out how many key bits startX and the gradient bucket need.
+    int64_t minX = INT64_MAX, maxX = INT64_MIN;
+    int64_t minBucket = INT64_MAX, maxBucket = INT64_MIN;
+    for (int i = 0; i < lineCount; i++) {
+        if (isinf(lines[i].gradient)) continue;
+        int64_t bucket = (int64_t)fmax(fmin(floor(lines[i].gradient / SWEEP_GRADIENT_BUCKET), 1e18), -1e18);
+        minX = (lines[i].startX < minX) ? lines[i].startX : minX;
+        maxX = (lines[i].startX > maxX) ? lines[i].startX : maxX;
+        minBucket = (bucket < minBucket) ? bucket : minBucket;
+        maxBucket = (bucket > maxBucket) ? bucket : maxBucket;
+    }
+
+    size_t entryCount = 0;
+    if (minX <= maxX) {
+        // Colors take 24 bits. Clamping the steepest buckets together, if they don't fit,
+        // still leaves every close pair in the same or neighbouring buckets.
+        int xBits = bitsFor((uint64_t)(maxX - minX));
+        int bucketBits = bitsFor((uint64_t)(maxBucket - minBucket) + 1);
+        if (24 + xBits + bucketBits > 64) {
+            bucketBits = 64 - 24 - xBits;
+        }
+        int64_t bucketLimit = (int64_t)(((uint64_t)1 << bucketBits) - 2);
+
+        for (int i = 0; i < lineCount; i++) {
+            if (isinf(lines[i].gradient)) continue;
+            int64_t bucket = (int64_t)fmax(fmin(floor(lines[i].gradient / SWEEP_GRADIENT_BUCKET), 1e18), -1e18) - minBucket;
+            bucket = (bucket > bucketLimit) ? bucketLimit : bucket;
+            uint64_t color = ((uint64_t)(lines[i].color.r & 0xFF) << 16) | ((uint64_t)(lines[i].color.g & 0xFF) << 8) |
+                             (uint64_t)(lines[i].color.b & 0xFF);
+            uint64_t key = (color << (bucketBits + xBits)) | ((uint64_t)bucket << xBits) | (uint64_t)(lines[i].startX - minX);
+            entries[entryCount++] = (SweepEntry){key, i};
+        }
+        radixSortEntries(entries, scratch, entryCount, 24 + bucketBits + xBits, threadCount);
+
+        SweepJob job = {lines, toRemove, entries, partitions, 0, xBits, bitsFor((uint64_t)lineCount), 0, PTHREAD_MUTEX_INITIALIZER};
+        for (size_t e = 0; e < entryCount; e++) {
+            if (e == 0 || (entries[e].key >> (bucketBits + xBits)) != (entries[e - 1].key >> (bucketBits + xBits))) {
+                partitions[job.partitionCount++] = e;
+            }
+        }
+        partitions[job.partitionCount] = entryCount;
+
+        int sweepThreads = (threadCount < (int)job.partitionCount) ? threadCount : (int)job.partitionCount;
+        pthread_t threads[sweepThreads];
+        int started = 0;
+        for (int t = 1; t < sweepThreads; t++) {
+            if (pthread_create(&threads[started], NULL, sweepWorker, &job) != 0) {
+                break;
+            }
+            started++;
         }
+        sweepWorker(&job);
+        for (int t = 0; t < started; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        pthread_mutex_destroy(&job.lock);
     }
 
     // Compact the array by removing marked lines.
@@ -134,31 +646,149 @@ int removeNearDuplicateLines(LineInfo *lines, int lineCount) {
         }
     }
 
+    free(partitions);
+    free(scratch);
+    free(entries);
     free(toRemove);
     return newLineCount;
 }
 
+// Function to return a monotonic time in seconds.
+static double currentSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Function to fill lines with a synthetic map: short lines fanning out from shared start
+// pixels in a handful of colors, at roughly the line density of the extracted maps.
+static void generateSyntheticLines(LineInfo *lines, int lineCount, uint32_t seed) {
+    static const RGB palette[8] = {
+        {0, 0, 0}, {168, 184, 144}, {200, 120, 80}, {80, 120, 200},
+        {240, 200, 120}, {120, 80, 40}, {40, 160, 40}, {160, 40, 160}
+    };
+    int side = (int)sqrt((double)lineCount * 6.0) + 1;
+    int i = 0;
+
+    while (i < lineCount) {
+        seed = seed * 1664525u + 1013904223u;
+        int startX = (int)((seed >> 8) % (uint32_t)side);
+        seed = seed * 1664525u + 1013904223u;
+        int startY = (int)((seed >> 8) % (uint32_t)side);
+        RGB color = palette[(seed >> 4) & 7];
+        int fan = 1 + (int)((seed >> 12) % 8);
+
+        for (int k = 0; k < fan && i < lineCount; k++, i++) {
+            seed = seed * 1664525u + 1013904223u;
+            lines[i].startX = startX;
+            lines[i].startY = startY;
+            lines[i].endX = startX + (int)((seed >> 8) % 25) - 12;
+            lines[i].endY = startY + (int)((seed >> 16) % 25) - 12;
+            lines[i].color = color;
+            lines[i].gradient = calculateGradient(lines[i]);
+        }
+    }
+}
+
+// Function to time the grid and sweep reducers against the pairwise reducer at increasing sizes.
+static int runBenchmark(void) {
+    static const int sizes[] = {10000, 100000, 1000000};
+    double pairwisePerPair = 0.0;
+    int result = 0;
+
+    printf("%10s %10s %12s %12s %12s %10s\n", "lines", "kept", "grid (s)", "sweep (s)", "pairwise (s)", "speedup");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int lineCount = sizes[s];
+        LineInfo *lines = malloc(lineCount * sizeof(LineInfo));
+        LineInfo *swept = malloc(lineCount * sizeof(LineInfo));
+        LineInfo *reference = malloc(lineCount * sizeof(LineInfo));
+        if (!lines || !swept || !reference) {
+            fprintf(stderr, "Memory allocation failed\n");
+            free(lines);
+            free(swept);
+            free(reference);
+            return 1;
+        }
+
+        generateSyntheticLines(lines, lineCount, (uint32_t)lineCount);
+        memcpy(swept, lines, lineCount * sizeof(LineInfo));
+        memcpy(reference, lines, lineCount * sizeof(LineInfo));
+
+        double start = currentSeconds();
+        int kept = removeNearDuplicateLines(lines, lineCount);
+        double gridTime = currentSeconds() - start;
+
+        start = currentSeconds();
+        int sweptKept = removeNearDuplicateLinesSweep(swept, lineCount, 0);
+        double sweepTime = currentSeconds() - start;
+
+        if (sweptKept != kept || memcmp(lines, swept, kept * sizeof(LineInfo)) != 0) {
+            fprintf(stderr, "Sweep reducer differs from grid reducer at %d lines.\n", lineCount);
+            result = 1;
+        }
+
+        if (lineCount <= PAIRWISE_BENCHMARK_LIMIT) {
+            start = currentSeconds();
+            int referenceKept = removeNearDuplicateLinesPairwise(reference, lineCount);
+            double pairwiseTime = currentSeconds() - start;
+            pairwisePerPair = pairwiseTime / ((double)lineCount * lineCount);
+
+            if (referenceKept != kept || memcmp(lines, reference, kept * sizeof(LineInfo)) != 0) {
+                fprintf(stderr, "Grid reducer differs from pairwise reducer at %d lines.\n", lineCount);
+                result = 1;
+            }
+            printf("%10d %10d %12.4f %12.4f %12.4f %9.1fx\n", lineCount, kept, gridTime, sweepTime, pairwiseTime, pairwiseTime / gridTime);
+        } else {
+            // Too slow to run; extrapolate quadratically from the largest measured size.
+            double pairwiseTime = pairwisePerPair * (double)lineCount * lineCount;
+            printf("%10d %10d %12.4f %12.4f %11.1f~ %8.0fx~\n", lineCount, kept, gridTime, sweepTime, pairwiseTime, pairwiseTime / gridTime);
+        }
+
+        free(reference);
+        free(swept);
+        free(lines);
+    }
+
+    return result;
+}
+
 int main(int argc, const char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input_json> <output_json>\n", argv[0]);
+    if (argc == 2 && strcmp(argv[1], "--benchmark") == 0) {
+        return runBenchmark();
+    }
+
+    // --sweep picks the sort-and-sweep reducer, which suits very large batches.
+    bool sweep = (argc == 4 && strcmp(argv[1], "--sweep") == 0);
+    if (argc != 3 && !sweep) {
+        fprintf(stderr, "Usage: %s [--sweep] <input_lines> <output_lines>\n", argv[0]);
+        fprintf(stderr, "       %s --benchmark\n", argv[0]);
         return 1;
     }
 
-    const char *inputFile = argv[1];
-    const char *outputFile = argv[2];
+    const char *inputFile = argv[argc - 2];
+    const char *outputFile = argv[argc - 1];
 
-    LineInfo lines[MAX_LINES];
-    int lineCount = readLinesFromJSON(inputFile, lines);
+    int lineCount;
+    LineInfo *lines = readLinesFromFile(inputFile, &lineCount);
+    if (!lines) {
+        return 1;
+    }
 
-    printf("Read %d lines from JSON.\n", lineCount);
+    printf("Read %d lines from %s.\n", lineCount, inputFile);
 
-    lineCount = removeNearDuplicateLines(lines, lineCount);
+    lineCount = sweep ? removeNearDuplicateLinesSweep(lines, lineCount, 0) : removeNearDuplicateLines(lines, lineCount);
 
     printf("Reduced to %d lines after removing near-duplicates.\n", lineCount);
 
-    writeLinesToJSON(outputFile, lines, lineCount);
+    if (isLineFileName(outputFile)) {
+        writeLinesToLineFile(outputFile, lines, lineCount);
+    } else {
+        writeLinesToJSON(outputFile, lines, lineCount);
+    }
 
     printf("Output written to %s.\n", outputFile);
 
+    free(lines);
     return 0;
 }
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Checks the SIMD unfilter kernels of pnglite byte for byte against the scalar ones, on random rows of
+// every filter type with 3 and 4 bytes per pixel, with and without a row above. The kernels are static,
+// so the library is built into the test.
+// Build: cc -O2 unfiltertest.c -lz -lpthread -o unfiltertest
+#include "canterbury-mac/png/pnglite.c"
+
+#define UNFILTER_TEST_ROWS 2000      // Random rows for each filter, stride and row above
+#define UNFILTER_TEST_MAX_WIDTH 300  // Widest row tested, in pixels
+
+static uint64_t testSeed = 0x2545F4914F6CDD1Dull;
+
+// Function to draw the next value of a splitmix64 sequence.
+static uint64_t nextRandom(void) {
+    uint64_t z = (testSeed += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Function to fill a row with random bytes, half of them within two of zero as in the filtered rows of
+// a map, so the ties of the Paeth predictor come up often.
+static void fillRow(unsigned char *row, int len) {
+    for (int i = 0; i < len; i++) {
+        uint64_t value = nextRandom();
+        row[i] = (value & 1) ? (unsigned char)(value >> 8) : (unsigned char)((value >> 8) % 5 - 2);
+    }
+}
+
+// Function to unfilter one row with the scalar and the SIMD kernels and count the rows that differ.
+// Each output is exactly len bytes on the heap, so a kernel that writes past the row is caught by tools
+// such as AddressSanitizer.
+static int compareRow(int filter, int stride, int width, int withPrevious, int *simdRows) {
+    png_t png;
+    memset(&png, 0, sizeof(png));
+    png.width = (unsigned)width;
+    png.bpp = (unsigned char)stride;
+    png.depth = 8;
+
+    int len = width * stride;
+    unsigned char *in = malloc(len);
+    unsigned char *previous = malloc(len);
+    unsigned char *scalar = malloc(len);
+    unsigned char *simd = malloc(len);
+    if (!in || !previous || !scalar || !simd) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    fillRow(in, len);
+    fillRow(previous, len);
+    unsigned char *previousLine = withPrevious ? previous : NULL;
+
+    png_set_unfilter_simd(0);
+    png_unfilter_row(&png, (unsigned char)filter, in, scalar, previousLine);
+    int differ = 0;
+    if (png_set_unfilter_simd(1)) {
+        if (png_unfilter_row_simd(filter, stride, in, simd, previousLine, len))
+            (*simdRows)++;
+        else
+            png_unfilter_row(&png, (unsigned char)filter, in, simd, previousLine);
+        differ = memcmp(scalar, simd, len) != 0;
+
+#if PNG_UNFILTER_SSSE3
+        // The SSE2 Paeth kernel is only used without SSSE3, so it is checked directly as well.
+        if (filter == 4 && previousLine) {
+            memset(simd, 0, len);
+            if (stride == 3)
+                png_unfilter_paeth_sse2(3, in, simd, previousLine, len);
+            else
+                png_unfilter_paeth_sse2(4, in, simd, previousLine, len);
+            differ |= memcmp(scalar, simd, len) != 0;
+        }
+#endif
+    }
+
+    free(simd);
+    free(scalar);
+    free(previous);
+    free(in);
+    return differ;
+}
+
+int main(void) {
+    static const char *filterNames[] = {"None", "Sub", "Up", "Average", "Paeth"};
+    int failures = 0;
+
+    for (int filter = 0; filter <= 4; filter++) {
+        for (int stride = 3; stride <= 4; stride++) {
+            for (int withPrevious = 0; withPrevious <= 1; withPrevious++) {
+                int differ = 0, simdRows = 0;
+                for (int row = 0; row < UNFILTER_TEST_ROWS; row++) {
+                    int width = 1 + (int)(nextRandom() % UNFILTER_TEST_MAX_WIDTH);
+                    differ += compareRow(filter, stride, width, withPrevious, &simdRows);
+                }
+                printf("%-8s stride %d %-12s %5d rows, %5d by SIMD kernels, %d differ\n", filterNames[filter], stride,
+                       withPrevious ? "row above" : "no row above", UNFILTER_TEST_ROWS, simdRows, differ);
+                failures += differ;
+            }
+        }
+    }
+
+    if (failures) {
+        printf("FAILED: %d rows differ between the SIMD and scalar kernels\n", failures);
+        return 1;
+    }
+    printf("SIMD and scalar unfiltering agree\n");
+    return 0;
+}